@@ -10,12 +10,14 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <ctype.h>
+#include "unixsock.h"
 
 #define TARGET_IP "127.0.0.1"
 #define MAX_EVENTS 1024 
 #define BUFFER_SIZE 8192
 
 int g_target_port = 5222;
+const char* g_target_unix = NULL;
 
 typedef enum { 
     STATE_HANDSHAKE, 
@@ -347,17 +349,32 @@ int handle_handshake(struct Session *s, char *buffer) {
 
     s->state = STATE_ESTABLISHED;
     
-    int target_fd = socket(AF_INET, SOCK_STREAM, 0);
-    struct sockaddr_in target_addr;
-    target_addr.sin_family = AF_INET;
-    target_addr.sin_port = htons(g_target_port);
+    int target_fd;
 
-    inet_pton(AF_INET, TARGET_IP, &target_addr.sin_addr);
+    if (g_target_unix) {
+        target_fd = unixsock_connect(g_target_unix);
 
-    if (connect(target_fd, (struct sockaddr*)&target_addr, sizeof(target_addr)) < 0) {
-        perror("[Bridge] Failed to connect to XMPP target");
+        if (target_fd < 0) {
+            perror("[Bridge] Failed to connect to XMPP target");
 
-        return -1;
+            return -1;
+        }
+    }
+    else {
+        target_fd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in target_addr;
+        target_addr.sin_family = AF_INET;
+        target_addr.sin_port = htons(g_target_port);
+
+        inet_pton(AF_INET, TARGET_IP, &target_addr.sin_addr);
+
+        if (connect(target_fd, (struct sockaddr*)&target_addr, sizeof(target_addr)) < 0) {
+            perror("[Bridge] Failed to connect to XMPP target");
+
+            close(target_fd);
+
+            return -1;
+        }
     }
 
     int flags = fcntl(target_fd, F_GETFL, 0);
@@ -493,8 +510,13 @@ void forward_target_to_client(struct Session *s) {
 int main(int argc, char *argv[]) {
     setbuf(stdout, NULL);
 
-    if (argc > 1) {
-        g_target_port = atoi(argv[2]);
+    // The target is either a TCP port on localhost or "unix:/path" for a co-located xmppd.
+    if (argc > 2) {
+        g_target_unix = unixsock_path(argv[2]);
+
+        if (!g_target_unix) {
+            g_target_port = atoi(argv[2]);
+        }
     }
 
     int port = (argc > 1) ? atoi(argv[1]) : 8082;
@@ -513,7 +535,12 @@ int main(int argc, char *argv[]) {
 
     listen(listen_fd, 10);
     
-    printf("[Bridge] Listening on %d -> Forwarding to localhost:%d\n", port, g_target_port);
+    if (g_target_unix) {
+        printf("[Bridge] Listening on %d -> Forwarding to unix:%s\n", port, g_target_unix);
+    }
+    else {
+        printf("[Bridge] Listening on %d -> Forwarding to localhost:%d\n", port, g_target_port);
+    }
 
     int epoll_fd = epoll_create1(0);
     struct epoll_event ev, events[MAX_EVENTS];
@@ -0,0 +1,410 @@
+#define _GNU_SOURCE
+#include "broadcast.h"
+#include "topology.h"
+#include <stdio.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/timerfd.h>
+
+char g_broadcast_buffer[BROADCAST_SLOTS][BROADCAST_SLOT_SIZE];
+size_t g_buffer_chunk_size[BROADCAST_SLOTS];
+size_t g_buffer_header_len[BROADCAST_SLOTS];
+volatile int g_slot_pins[BROADCAST_SLOTS];
+int g_broadcast_zerocopy = 0;
+int g_broadcast_burst_seconds = BROADCAST_DEFAULT_BURST_SECONDS;
+BroadcastPacing g_broadcast_pacing;
+volatile uint64_t g_broadcast_seq = 0;
+uint64_t g_slot_seq[BROADCAST_SLOTS];
+
+typedef struct {
+    int fd;
+    const int* listeners;
+} BroadcastWaiter;
+
+static const char* g_playlist = BROADCAST_PLAYLIST;
+static BroadcastWaiter g_waiters[BROADCAST_MAX_WAITERS];
+static int g_waiter_count = 0;
+
+int broadcast_parse_config(const char* key, const char* value) {
+    if (strcmp(key, "RADIO_ZEROCOPY") == 0) {
+        g_broadcast_zerocopy = (strcasecmp(value, "on") == 0 || strcmp(value, "1") == 0);
+
+        printf("Config: Radio zero-copy fan-out %s\n", g_broadcast_zerocopy ? "on" : "off");
+    }
+    else if (strcmp(key, "RADIO_BURST_SECONDS") == 0) {
+        int seconds = atoi(value);
+
+        if (seconds < 0) {
+            seconds = 0;
+        }
+
+        if (seconds > BROADCAST_MAX_BURST_SECONDS) {
+            seconds = BROADCAST_MAX_BURST_SECONDS;
+        }
+
+        g_broadcast_burst_seconds = seconds;
+
+        printf("Config: Radio burst-on-connect %d s\n", g_broadcast_burst_seconds);
+    }
+    else {
+        return -1;
+    }
+
+    return 0;
+}
+
+void broadcast_load_config_file(const char* filename) {
+    FILE* file = fopen(filename, "r");
+
+    if (!file) {
+        return;
+    }
+
+    char line[512];
+
+    while (fgets(line, sizeof(line), file)) {
+        char key[64], value[256];
+
+        if (line[0] != '#' && sscanf(line, "%63s %255s", key, value) == 2) {
+            broadcast_parse_config(key, value);
+        }
+    }
+
+    fclose(file);
+}
+
+// Length of the MPEG-1/2/2.5 Layer III frame whose header starts at h, or 0 if h is not one.
+static size_t mp3_frame_length(const unsigned char* h) {
+    static const int bitrates[2][15] = {
+        { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },
+        { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 }
+    };
+    static const int sample_rates[4][3] = {
+        { 11025, 12000, 8000 },
+        { 0, 0, 0 },
+        { 22050, 24000, 16000 },
+        { 44100, 48000, 32000 }
+    };
+
+    if (h[0] != 0xFF || (h[1] & 0xE0) != 0xE0) {
+        return 0;
+    }
+
+    int version = (h[1] >> 3) & 3;
+    int layer = (h[1] >> 1) & 3;
+    int bitrate_index = h[2] >> 4;
+    int rate_index = (h[2] >> 2) & 3;
+    int padding = (h[2] >> 1) & 1;
+
+    if (version == 1 || layer != 1 || bitrate_index == 0 || bitrate_index == 15 || rate_index == 3) {
+        return 0;
+    }
+
+    int mpeg1 = (version == 3);
+    size_t bitrate = (size_t)bitrates[mpeg1 ? 0 : 1][bitrate_index] * 1000;
+    size_t sample_rate = (size_t)sample_rates[version][rate_index];
+
+    return (mpeg1 ? 144 : 72) * bitrate / sample_rate + (size_t)padding;
+}
+
+// First offset in payload where a frame header is followed by another one (or by the end of
+// the chunk), so a stray 0xFF in audio data is not taken for a boundary. len if there is none.
+static size_t find_frame_boundary(const unsigned char* payload, size_t len) {
+    for (size_t i = 0; i + 4 <= len; i++) {
+        size_t frame = mp3_frame_length(payload + i);
+
+        if (frame == 0) {
+            continue;
+        }
+
+        if (i + frame + 4 > len || mp3_frame_length(payload + i + frame) > 0) {
+            return i;
+        }
+    }
+
+    return len;
+}
+
+ssize_t broadcast_read_slot(uint64_t seq, size_t offset, char* buf, size_t cap, size_t* framed) {
+    int slot = (int)(seq % BROADCAST_SLOTS);
+
+    if (__atomic_load_n(&g_slot_seq[slot], __ATOMIC_ACQUIRE) != seq) {
+        return -1;
+    }
+
+    size_t len = g_buffer_chunk_size[slot];
+
+    *framed = len;
+
+    len = offset < len ? len - offset : 0;
+
+    if (len > cap) {
+        len = cap;
+    }
+
+    memcpy(buf, g_broadcast_buffer[slot] + offset, len);
+
+    // Whatever was copied is only good if the slot was not rewritten underneath it.
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if (__atomic_load_n(&g_slot_seq[slot], __ATOMIC_RELAXED) != seq) {
+        return -1;
+    }
+
+    return (ssize_t)len;
+}
+
+uint64_t broadcast_burst_start(char* lead, size_t* lead_len) {
+    uint64_t burst = (uint64_t)g_broadcast_burst_seconds * BROADCAST_SLOTS_PER_SEC;
+    char chunk[BROADCAST_SLOT_SIZE];
+    size_t framed;
+
+    *lead_len = 0;
+
+    uint64_t newest = broadcast_newest();
+
+    if (burst == 0 || newest == 0) {
+        return newest + 1;
+    }
+
+    uint64_t first = newest >= burst ? newest - burst + 1 : 1;
+
+    // Only a listener start so stale it lapped the ring can miss; it joins live instead.
+    if (broadcast_read_slot(first, 0, chunk, sizeof(chunk), &framed) < 0) {
+        return broadcast_newest() + 1;
+    }
+
+    size_t header_len = (size_t)(strchr(chunk, '\n') - chunk) + 1;
+    size_t payload_len = framed - header_len - 2;
+    const char* payload = chunk + header_len;
+    size_t boundary = find_frame_boundary((const unsigned char*)payload, payload_len);
+
+    // No frame header in the chunk (or it starts on one): send the slot whole.
+    if (boundary == 0 || boundary == payload_len) {
+        return first;
+    }
+
+    int lead_header = snprintf(lead, BROADCAST_FRAME_OVERHEAD, "%zx\r\n", payload_len - boundary);
+
+    memcpy(lead + lead_header, payload + boundary, payload_len - boundary);
+    memcpy(lead + lead_header + payload_len - boundary, "\r\n", 2);
+
+    *lead_len = (size_t)lead_header + payload_len - boundary + 2;
+
+    return first + 1;
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Play time of a byte count at the stream bitrate, split so it cannot overflow on long sessions.
+static uint64_t stream_bytes_to_ns(uint64_t bytes) {
+    return bytes / BROADCAST_BYTES_PER_SEC * 1000000000ull + bytes % BROADCAST_BYTES_PER_SEC * 1000000000ull / BROADCAST_BYTES_PER_SEC;
+}
+
+static void pacing_store(uint64_t* field, uint64_t value) {
+    __atomic_store_n(field, value, __ATOMIC_RELAXED);
+}
+
+// Blocks until the stream clock reaches total_bytes, on an absolute timerfd deadline so wakeup
+// jitter never accumulates. The clock only moves on a stall past BROADCAST_RESYNC_NS.
+static void wait_for_stream_clock(int timer_fd, uint64_t* start_ns, uint64_t total_bytes) {
+    uint64_t deadline = *start_ns + stream_bytes_to_ns(total_bytes);
+    struct itimerspec when;
+    uint64_t expirations;
+
+    memset(&when, 0, sizeof(when));
+
+    when.it_value.tv_sec = (time_t)(deadline / 1000000000ull);
+    when.it_value.tv_nsec = (long)(deadline % 1000000000ull);
+
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &when, NULL) < 0) {
+        perror("broadcast: timerfd_settime");
+
+        return;
+    }
+
+    while (read(timer_fd, &expirations, sizeof(expirations)) < 0 && errno == EINTR) {
+    }
+
+    uint64_t now = monotonic_ns();
+    uint64_t lateness = now > deadline ? now - deadline : 0;
+    BroadcastPacing* stats = &g_broadcast_pacing;
+
+    pacing_store(&stats->ticks, stats->ticks + 1);
+    pacing_store(&stats->lateness_ns_total, stats->lateness_ns_total + lateness);
+    pacing_store(&stats->drift_ns, lateness);
+
+    if (lateness > stats->lateness_ns_max) {
+        pacing_store(&stats->lateness_ns_max, lateness);
+    }
+
+    if (lateness > BROADCAST_LATE_NS) {
+        pacing_store(&stats->late_ticks, stats->late_ticks + 1);
+    }
+
+    if (lateness > BROADCAST_RESYNC_NS) {
+        *start_ns += lateness;
+
+        pacing_store(&stats->resyncs, stats->resyncs + 1);
+
+        printf("[Radio Broadcaster] Stalled %llu ms, re-anchoring the stream clock.\n", (unsigned long long)(lateness / 1000000));
+    }
+}
+
+static void* broadcast_thread_function(void* arg) {
+    (void)arg;
+
+    topology_pin_current_thread(THREAD_ROLE_BROADCAST, 0);
+
+    char local_buffer[BROADCAST_CHUNK_SIZE];
+    FILE* file = fopen(g_playlist, "rb");
+
+    if (file == NULL) {
+        perror("broadcast: fopen");
+
+        exit(1);
+    }
+
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+
+    if (timer_fd == -1) {
+        perror("broadcast: timerfd_create");
+
+        exit(1);
+    }
+
+    printf("[Radio Broadcaster] Starting stream (Bitrate: %d bps)\n", BROADCAST_BITRATE);
+
+    // Bytes published since start_ns; both run on across playlist loops, so a wrap is seamless.
+    uint64_t start_ns = monotonic_ns();
+    uint64_t total_bytes = 0;
+
+    while (1) {
+        size_t bytes_read = fread(local_buffer, 1, BROADCAST_CHUNK_SIZE, file);
+
+        if (bytes_read == 0) {
+            if (feof(file)) {
+                BroadcastPacing* stats = &g_broadcast_pacing;
+
+                printf("[Radio Broadcaster] Playlist loop. Pacing: drift %llu us, mean lateness %llu us, max %llu us, %llu/%llu late, %llu resyncs.\n",
+                       (unsigned long long)(stats->drift_ns / 1000),
+                       (unsigned long long)(stats->ticks ? stats->lateness_ns_total / stats->ticks / 1000 : 0),
+                       (unsigned long long)(stats->lateness_ns_max / 1000),
+                       (unsigned long long)stats->late_ticks, (unsigned long long)stats->ticks,
+                       (unsigned long long)stats->resyncs);
+
+                fclose(file);
+
+                file = fopen(g_playlist, "rb");
+
+                if (file == NULL) {
+                    perror("broadcast: fopen");
+
+                    exit(1);
+                }
+
+                continue;
+            }
+
+            perror("broadcast: fread");
+
+            sleep(1);
+
+            continue;
+        }
+
+        uint64_t seq = g_broadcast_seq + 1;
+        int next = (int)(seq % BROADCAST_SLOTS);
+
+        // Senders drop listeners long before they lag a full ring, so this only waits out
+        // completions that are already on their way.
+        while (__atomic_load_n(&g_slot_pins[next], __ATOMIC_ACQUIRE) > 0) {
+            struct timespec pause = { 0, 1000000 };
+
+            nanosleep(&pause, NULL);
+        }
+
+        // Seqlock write: readers that catch the slot mid-rewrite see 0 and back off.
+        __atomic_store_n(&g_slot_seq[next], 0, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        char* slot = g_broadcast_buffer[next];
+        int header_len = snprintf(slot, BROADCAST_FRAME_OVERHEAD, "%zx\r\n", bytes_read);
+
+        memcpy(slot + header_len, local_buffer, bytes_read);
+        memcpy(slot + header_len + bytes_read, "\r\n", 2);
+
+        g_buffer_header_len[next] = (size_t)header_len;
+        g_buffer_chunk_size[next] = (size_t)header_len + bytes_read + 2;
+
+        __atomic_store_n(&g_slot_seq[next], seq, __ATOMIC_RELEASE);
+        __atomic_store_n(&g_broadcast_seq, seq, __ATOMIC_RELEASE);
+
+        // Only loops with listeners are woken; an idle sender thread sleeps through the stream.
+        int waiters = __atomic_load_n(&g_waiter_count, __ATOMIC_ACQUIRE);
+
+        for (int i = 0; i < waiters; i++) {
+            uint64_t one = 1;
+
+            if (__atomic_load_n(g_waiters[i].listeners, __ATOMIC_RELAXED) == 0) {
+                continue;
+            }
+
+            if (write(g_waiters[i].fd, &one, sizeof(one)) < 0) {
+                perror("broadcast: notify");
+            }
+        }
+
+        total_bytes += bytes_read;
+
+        wait_for_stream_clock(timer_fd, &start_ns, total_bytes);
+    }
+
+    fclose(file);
+
+    close(timer_fd);
+
+    return NULL;
+}
+
+int broadcast_add_waiter(int eventfd, const int* listeners) {
+    if (g_waiter_count >= BROADCAST_MAX_WAITERS) {
+        fprintf(stderr, "broadcast: too many waiters\n");
+
+        return -1;
+    }
+
+    g_waiters[g_waiter_count].fd = eventfd;
+    g_waiters[g_waiter_count].listeners = listeners;
+
+    __atomic_store_n(&g_waiter_count, g_waiter_count + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+int broadcast_start(const char* playlist) {
+    pthread_t broadcast_tid;
+
+    g_playlist = playlist;
+
+    if (pthread_create(&broadcast_tid, NULL, broadcast_thread_function, NULL) != 0) {
+        perror("broadcast: pthread_create");
+
+        return -1;
+    }
+
+    pthread_detach(broadcast_tid);
+
+    return 0;
+}
@@ -0,0 +1,98 @@
+#ifndef BROADCAST_H
+#define BROADCAST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define BROADCAST_BITRATE 128000
+#define BROADCAST_BYTES_PER_SEC (BROADCAST_BITRATE / 8)
+#define BROADCAST_PLAYLIST "public_html/mixtape/radio_playlist_cbr.mp3"
+#define BROADCAST_CHUNK_SIZE 4096
+#define BROADCAST_SLOTS_PER_SEC ((BROADCAST_BYTES_PER_SEC + BROADCAST_CHUNK_SIZE - 1) / BROADCAST_CHUNK_SIZE)
+
+// New listeners start up to RADIO_BURST_SECONDS in the past so their player buffer fills at once.
+#define BROADCAST_DEFAULT_BURST_SECONDS 3
+#define BROADCAST_MAX_BURST_SECONDS 8
+
+// How far a listener may fall behind its starting point before it is dropped or skipped ahead.
+#define BROADCAST_LAG_SLOTS 32
+
+// The ring holds the longest burst plus the lag slack, and two slots of margin around the one
+// being refilled, so no cursor still in play can point at a reused slot.
+#define BROADCAST_SLOTS (BROADCAST_MAX_BURST_SECONDS * BROADCAST_SLOTS_PER_SEC + BROADCAST_LAG_SLOTS + 2)
+
+// Room for the chunk-size line ("1000\r\n") ahead of the payload and the CRLF after it.
+#define BROADCAST_FRAME_OVERHEAD 16
+#define BROADCAST_SLOT_SIZE (BROADCAST_CHUNK_SIZE + BROADCAST_FRAME_OVERHEAD)
+
+#define BROADCAST_MAX_WAITERS 64
+
+// The live ring: one paced reader fills slots in turn, every listener reads behind it without
+// locks. Chunk number seq lives in slot seq % BROADCAST_SLOTS; g_broadcast_seq is the newest one,
+// published with release ordering once its slot is complete.
+// Slots are stored as ready-to-send HTTP/1.1 chunks: g_buffer_chunk_size is the framed length,
+// and the raw payload starts g_buffer_header_len bytes in.
+extern char g_broadcast_buffer[BROADCAST_SLOTS][BROADCAST_SLOT_SIZE];
+extern size_t g_buffer_chunk_size[BROADCAST_SLOTS];
+extern size_t g_buffer_header_len[BROADCAST_SLOTS];
+extern volatile uint64_t g_broadcast_seq;
+
+// Per-slot seqlock word: the chunk number a slot holds, 0 while the broadcaster rewrites it.
+extern uint64_t g_slot_seq[BROADCAST_SLOTS];
+
+static inline uint64_t broadcast_newest(void) {
+    return __atomic_load_n(&g_broadcast_seq, __ATOMIC_ACQUIRE);
+}
+
+// Zero-copy sends still in flight per slot; the broadcaster does not reuse a pinned slot.
+extern volatile int g_slot_pins[BROADCAST_SLOTS];
+
+// RADIO_ZEROCOPY on: fan slots out with MSG_ZEROCOPY where the socket supports it.
+extern int g_broadcast_zerocopy;
+
+extern int g_broadcast_burst_seconds;
+
+// A broadcaster stalled longer than this (stopped process, slow disk) re-anchors its clock
+// instead of racing to catch up and lapping its listeners.
+#define BROADCAST_RESYNC_NS 1000000000ull
+
+// Wakes later than this past their deadline count as late.
+#define BROADCAST_LATE_NS 1000000ull
+
+// Pacing health, written by the broadcaster alone. The stream clock is absolute and never
+// resets, so drift stays bounded by a single wake's lateness; a growing drift means the
+// broadcaster cannot keep up, and listener buffers will drain.
+typedef struct {
+    uint64_t ticks;
+    uint64_t late_ticks;
+    uint64_t lateness_ns_total;
+    uint64_t lateness_ns_max;
+    uint64_t drift_ns;
+    uint64_t resyncs;
+} BroadcastPacing;
+
+extern BroadcastPacing g_broadcast_pacing;
+
+int broadcast_parse_config(const char* key, const char* value);
+
+void broadcast_load_config_file(const char* filename);
+
+// Picks a new listener's starting point: the configured burst back from the newest chunk, moved
+// forward to the first MP3 frame header in that chunk. The partial chunk from the frame on is
+// framed into lead (BROADCAST_SLOT_SIZE bytes) and *lead_len set, 0 when the start is a whole
+// slot. Returns the sequence number of the first whole slot to send after lead.
+uint64_t broadcast_burst_start(char* lead, size_t* lead_len);
+
+// Copies up to cap bytes of chunk seq, starting offset bytes into its framing, and sets *framed
+// to the chunk's framed length. Returns the bytes copied, or -1 once the slot has been reused.
+ssize_t broadcast_read_slot(uint64_t seq, size_t offset, char* buf, size_t cap, size_t* framed);
+
+// Registers an eventfd the broadcaster bumps after every chunk, but only while *listeners is
+// non-zero, so a loop with nobody to feed sleeps through the stream. Call before broadcast_start.
+int broadcast_add_waiter(int eventfd, const int* listeners);
+
+// Starts the detached broadcaster on playlist, looping it at the stream bitrate.
+int broadcast_start(const char* playlist);
+
+#endif
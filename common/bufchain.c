@@ -0,0 +1,209 @@
+#define _GNU_SOURCE
+#include "bufchain.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+size_t g_output_buffer_cap = OUTPUT_DEFAULT_CAP;
+
+static BufSegment* g_free_segments = NULL;
+static int g_free_count = 0;
+static int g_segments_in_use = 0;
+static pthread_mutex_t g_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void bufchain_metrics_source(MetricsWriter* w) {
+    metrics_write_value(w, "output_buffer_cap_bytes", "Per-connection output buffer limit", (uint64_t)g_output_buffer_cap);
+    metrics_write_value(w, "output_segments_in_use", "Output buffer segments held by connections", (uint64_t)__atomic_load_n(&g_segments_in_use, __ATOMIC_RELAXED));
+    metrics_write_value(w, "output_segments_pooled", "Free output buffer segments kept for reuse", (uint64_t)__atomic_load_n(&g_free_count, __ATOMIC_RELAXED));
+}
+
+void bufchain_init_metrics(void) {
+    metrics_register_source(bufchain_metrics_source);
+}
+
+int bufchain_parse_config(const char* key, const char* value) {
+    if (strcmp(key, "OUTPUT_BUFFER_LIMIT") != 0) {
+        return -1;
+    }
+
+    long size = atol(value);
+
+    g_output_buffer_cap = size < OUTPUT_MIN_CAP ? OUTPUT_MIN_CAP : (size_t)size;
+
+    printf("Config: Output buffer per connection = %zu bytes\n", g_output_buffer_cap);
+
+    return 0;
+}
+
+static BufSegment* segment_get(void) {
+    BufSegment* seg = NULL;
+
+    pthread_mutex_lock(&g_pool_mutex);
+
+    if (g_free_segments) {
+        seg = g_free_segments;
+        g_free_segments = seg->next;
+        g_free_count--;
+    }
+
+    pthread_mutex_unlock(&g_pool_mutex);
+
+    if (!seg) {
+        seg = (BufSegment*)malloc(sizeof(BufSegment));
+
+        if (!seg) {
+            return NULL;
+        }
+    }
+
+    seg->next = NULL;
+    seg->start = 0;
+    seg->end = 0;
+
+    __atomic_add_fetch(&g_segments_in_use, 1, __ATOMIC_RELAXED);
+
+    return seg;
+}
+
+static void segment_put(BufSegment* seg) {
+    __atomic_sub_fetch(&g_segments_in_use, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&g_pool_mutex);
+
+    if (g_free_count < BUFCHAIN_POOL_MAX) {
+        seg->next = g_free_segments;
+        g_free_segments = seg;
+        g_free_count++;
+
+        seg = NULL;
+    }
+
+    pthread_mutex_unlock(&g_pool_mutex);
+
+    free(seg);
+}
+
+void bufchain_init(BufChain* chain) {
+    chain->head = NULL;
+    chain->tail = NULL;
+    chain->len = 0;
+}
+
+char* bufchain_reserve(BufChain* chain, size_t* avail) {
+    if (!chain->tail || chain->tail->end == BUFCHAIN_SEGMENT_SIZE) {
+        BufSegment* seg = segment_get();
+
+        if (!seg) {
+            return NULL;
+        }
+
+        if (chain->tail) {
+            chain->tail->next = seg;
+        }
+        else {
+            chain->head = seg;
+        }
+
+        chain->tail = seg;
+    }
+
+    *avail = BUFCHAIN_SEGMENT_SIZE - chain->tail->end;
+
+    return chain->tail->data + chain->tail->end;
+}
+
+void bufchain_commit(BufChain* chain, size_t n) {
+    chain->tail->end += n;
+    chain->len += n;
+}
+
+int bufchain_append(BufChain* chain, const void* data, size_t len) {
+    const char* src = (const char*)data;
+
+    while (len > 0) {
+        size_t avail;
+        char* dst = bufchain_reserve(chain, &avail);
+
+        if (!dst) {
+            return -1;
+        }
+
+        size_t n = len < avail ? len : avail;
+
+        memcpy(dst, src, n);
+
+        bufchain_commit(chain, n);
+
+        src += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+const char* bufchain_peek(const BufChain* chain, size_t* len) {
+    if (!chain->head) {
+        *len = 0;
+
+        return NULL;
+    }
+
+    *len = chain->head->end - chain->head->start;
+
+    return chain->head->data + chain->head->start;
+}
+
+int bufchain_iov(const BufChain* chain, struct iovec* iov, int max) {
+    int count = 0;
+
+    for (BufSegment* seg = chain->head; seg && count < max; seg = seg->next) {
+        if (seg->end > seg->start) {
+            iov[count].iov_base = seg->data + seg->start;
+            iov[count].iov_len = seg->end - seg->start;
+
+            count++;
+        }
+    }
+
+    return count;
+}
+
+void bufchain_consume(BufChain* chain, size_t n) {
+    chain->len -= n;
+
+    while (n > 0 && chain->head) {
+        BufSegment* seg = chain->head;
+        size_t have = seg->end - seg->start;
+
+        if (n < have) {
+            seg->start += n;
+
+            return;
+        }
+
+        n -= have;
+
+        chain->head = seg->next;
+
+        if (!chain->head) {
+            chain->tail = NULL;
+        }
+
+        segment_put(seg);
+    }
+}
+
+void bufchain_free(BufChain* chain) {
+    while (chain->head) {
+        BufSegment* seg = chain->head;
+
+        chain->head = seg->next;
+
+        segment_put(seg);
+    }
+
+    chain->tail = NULL;
+    chain->len = 0;
+}
@@ -0,0 +1,49 @@
+#ifndef BUFCHAIN_H
+#define BUFCHAIN_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#define BUFCHAIN_SEGMENT_SIZE (16 * 1024)
+#define BUFCHAIN_POOL_MAX 1024
+#define OUTPUT_DEFAULT_CAP (256 * 1024)
+#define OUTPUT_MIN_CAP BUFCHAIN_SEGMENT_SIZE
+
+typedef struct BufSegment {
+    struct BufSegment* next;
+    size_t start;
+    size_t end;
+    char data[BUFCHAIN_SEGMENT_SIZE];
+} BufSegment;
+
+// Pending output for one connection: fixed-size pooled segments, consumed from the head.
+typedef struct {
+    BufSegment* head;
+    BufSegment* tail;
+    size_t len;
+} BufChain;
+
+extern size_t g_output_buffer_cap;
+
+void bufchain_init_metrics(void);
+
+int bufchain_parse_config(const char* key, const char* value);
+
+void bufchain_init(BufChain* chain);
+
+int bufchain_append(BufChain* chain, const void* data, size_t len);
+
+// Free space at the tail for reading straight into the chain; follow with bufchain_commit.
+char* bufchain_reserve(BufChain* chain, size_t* avail);
+
+void bufchain_commit(BufChain* chain, size_t n);
+
+const char* bufchain_peek(const BufChain* chain, size_t* len);
+
+int bufchain_iov(const BufChain* chain, struct iovec* iov, int max);
+
+void bufchain_consume(BufChain* chain, size_t n);
+
+void bufchain_free(BufChain* chain);
+
+#endif
@@ -0,0 +1,146 @@
+#include "chunked.h"
+#include <string.h>
+
+void chunked_init(ChunkedDecoder* d) {
+    d->state = CHUNKED_SIZE;
+    d->left = 0;
+    d->digits = 0;
+}
+
+static int hex_value(char ch) {
+    if (ch >= '0' && ch <= '9') {
+        return ch - '0';
+    }
+
+    if (ch >= 'a' && ch <= 'f') {
+        return ch - 'a' + 10;
+    }
+
+    if (ch >= 'A' && ch <= 'F') {
+        return ch - 'A' + 10;
+    }
+
+    return -1;
+}
+
+static void end_size_line(ChunkedDecoder* d) {
+    d->state = d->left > 0 ? CHUNKED_DATA : CHUNKED_TRAILER_START;
+    d->digits = 0;
+}
+
+static void step(ChunkedDecoder* d, char ch) {
+    switch (d->state) {
+        case CHUNKED_SIZE: {
+            int v = hex_value(ch);
+
+            if (v >= 0) {
+                d->left = d->left * 16 + v;
+                d->digits++;
+
+                if (d->left > CHUNKED_MAX_CHUNK) {
+                    d->state = CHUNKED_ERROR;
+                }
+            }
+            else if (d->digits == 0) {
+                d->state = CHUNKED_ERROR;
+            }
+            else if (ch == '\n') {
+                end_size_line(d);
+            }
+            else if (ch == ';' || ch == ' ' || ch == '\t' || ch == '\r') {
+                d->state = CHUNKED_EXT;
+            }
+            else {
+                d->state = CHUNKED_ERROR;
+            }
+
+            break;
+        }
+
+        case CHUNKED_EXT:
+            if (ch == '\n') {
+                end_size_line(d);
+            }
+
+            break;
+
+        case CHUNKED_DATA_END:
+            if (ch == '\n') {
+                d->state = CHUNKED_SIZE;
+                d->left = 0;
+            }
+            else if (ch != '\r') {
+                d->state = CHUNKED_ERROR;
+            }
+
+            break;
+
+        case CHUNKED_TRAILER_START:
+            if (ch == '\n') {
+                d->state = CHUNKED_DONE;
+            }
+            else if (ch != '\r') {
+                d->state = CHUNKED_TRAILER;
+            }
+
+            break;
+
+        case CHUNKED_TRAILER:
+            if (ch == '\n') {
+                d->state = CHUNKED_TRAILER_START;
+            }
+
+            break;
+
+        default:
+            break;
+    }
+}
+
+size_t chunked_skip_framing(ChunkedDecoder* d, const char* in, size_t len) {
+    size_t used = 0;
+
+    while (used < len && d->state != CHUNKED_DATA && d->state != CHUNKED_DONE && d->state != CHUNKED_ERROR) {
+        step(d, in[used]);
+
+        used++;
+    }
+
+    return used;
+}
+
+void chunked_consume(ChunkedDecoder* d, size_t n) {
+    d->left -= n;
+
+    if (d->left == 0) {
+        d->state = CHUNKED_DATA_END;
+    }
+}
+
+size_t chunked_decode(ChunkedDecoder* d, char* buf, size_t len) {
+    size_t in = 0;
+    size_t out = 0;
+
+    while (in < len && d->state != CHUNKED_DONE && d->state != CHUNKED_ERROR) {
+        in += chunked_skip_framing(d, buf + in, len - in);
+
+        if (d->state != CHUNKED_DATA) {
+            continue;
+        }
+
+        size_t n = len - in;
+
+        if (n > d->left) {
+            n = (size_t)d->left;
+        }
+
+        memmove(buf + out, buf + in, n);
+
+        chunked_consume(d, n);
+
+        in += n;
+        out += n;
+    }
+
+    return out;
+}
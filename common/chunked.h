@@ -0,0 +1,40 @@
+#ifndef CHUNKED_H
+#define CHUNKED_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Chunk sizes past this are treated as malformed rather than trusted.
+#define CHUNKED_MAX_CHUNK (1ull << 40)
+
+typedef enum {
+    CHUNKED_SIZE,
+    CHUNKED_EXT,
+    CHUNKED_DATA,
+    CHUNKED_DATA_END,
+    CHUNKED_TRAILER_START,
+    CHUNKED_TRAILER,
+    CHUNKED_DONE,
+    CHUNKED_ERROR
+} ChunkedState;
+
+// Incremental decoder for a chunked message body (RFC 9112 section 7.1). Input may be split anywhere.
+typedef struct {
+    ChunkedState state;
+    uint64_t left;
+    int digits;
+} ChunkedDecoder;
+
+void chunked_init(ChunkedDecoder* d);
+
+// Steps over sizes, extensions, line ends and trailers until chunk payload is due, the body
+// ends or the input runs out. Returns bytes consumed.
+size_t chunked_skip_framing(ChunkedDecoder* d, const char* in, size_t len);
+
+// Accounts for n payload bytes taken while in CHUNKED_DATA; n must not exceed d->left.
+void chunked_consume(ChunkedDecoder* d, size_t n);
+
+// Decodes in place, moving payload bytes to the front of buf. Returns the payload length.
+size_t chunked_decode(ChunkedDecoder* d, char* buf, size_t len);
+
+#endif
@@ -0,0 +1,323 @@
+#define _GNU_SOURCE
+#include "credentials.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <crypt.h>
+
+// Only used when no AUTH_FILE is configured, so existing setups keep working.
+#define LEGACY_CREDENTIALS "admin:password123"
+
+static Credential* g_buckets[CREDENTIAL_BUCKETS];
+static int g_credential_count = 0;
+static int g_file_configured = 0;
+static uint64_t g_cache_ttl_ns = (uint64_t)AUTH_DEFAULT_CACHE_TTL * 1000000000ull;
+
+// Hashed against for unknown users, so they cost as much as a wrong password and usernames
+// cannot be told apart by timing. A copy of the first loaded entry: same algorithm and cost.
+static char g_dummy_hash[sizeof(((Credential*)0)->hash)] = "";
+
+static AuthCacheSlot g_cache[AUTH_CACHE_SLOTS];
+static pthread_mutex_t g_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t g_cache_hits = 0;
+static uint64_t g_cache_misses = 0;
+static uint64_t g_failures = 0;
+
+static __thread struct crypt_data* t_crypt_data = NULL;
+
+static uint64_t fnv1a64(const char* data, size_t len) {
+    uint64_t hash = 14695981039346656037ull;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+static void credentials_metrics_source(MetricsWriter* w) {
+    metrics_write_value(w, "auth_users", "Users loaded from AUTH_FILE", (uint64_t)g_credential_count);
+    metrics_write_value(w, "auth_cache_hits_total", "Authorization headers answered from the cache", __atomic_load_n(&g_cache_hits, __ATOMIC_RELAXED));
+    metrics_write_value(w, "auth_cache_misses_total", "Authorization headers that needed a password hash", __atomic_load_n(&g_cache_misses, __ATOMIC_RELAXED));
+    metrics_write_value(w, "auth_failures_total", "Rejected Authorization headers", __atomic_load_n(&g_failures, __ATOMIC_RELAXED));
+}
+
+void credentials_init(void) {
+    metrics_register_source(credentials_metrics_source);
+}
+
+// Plain-text, MD5 ($apr1$, $1$) and {SHA} entries are unsalted or too fast to be worth accepting.
+static int is_slow_hash(const char* hash) {
+    return strncmp(hash, "$2y$", 4) == 0 || strncmp(hash, "$2b$", 4) == 0 || strncmp(hash, "$2a$", 4) == 0 ||
+           strncmp(hash, "$5$", 3) == 0 || strncmp(hash, "$6$", 3) == 0 || strncmp(hash, "$y$", 3) == 0;
+}
+
+static Credential* find_user(const char* user, size_t len) {
+    Credential* c = g_buckets[fnv1a64(user, len) % CREDENTIAL_BUCKETS];
+
+    while (c) {
+        if (strlen(c->user) == len && memcmp(c->user, user, len) == 0) {
+            return c;
+        }
+
+        c = c->next;
+    }
+
+    return NULL;
+}
+
+int credentials_load_file(const char* filename) {
+    FILE* file = fopen(filename, "r");
+
+    if (!file) {
+        perror("credentials: fopen");
+
+        return -1;
+    }
+
+    char line[512];
+    int loaded = 0;
+
+    while (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        char* colon = strchr(line, ':');
+
+        if (line[0] == '#' || !colon) {
+            continue;
+        }
+
+        *colon = '\0';
+
+        const char* user = line;
+        const char* hash = colon + 1;
+
+        if (strlen(user) == 0 || strlen(user) >= sizeof(((Credential*)0)->user) || strlen(hash) >= sizeof(((Credential*)0)->hash)) {
+            fprintf(stderr, "credentials: skipping malformed entry for '%s'\n", user);
+
+            continue;
+        }
+
+        if (!is_slow_hash(hash)) {
+            fprintf(stderr, "credentials: skipping '%s', use bcrypt (htpasswd -B) or SHA-crypt hashes\n", user);
+
+            continue;
+        }
+
+        if (find_user(user, strlen(user))) {
+            fprintf(stderr, "credentials: duplicate user '%s', keeping the first entry\n", user);
+
+            continue;
+        }
+
+        Credential* c = (Credential*)calloc(1, sizeof(Credential));
+
+        if (!c) {
+            perror("credentials: calloc");
+
+            break;
+        }
+
+        strcpy(c->user, user);
+        strcpy(c->hash, hash);
+
+        if (g_dummy_hash[0] == '\0') {
+            strcpy(g_dummy_hash, hash);
+        }
+
+        uint64_t bucket = fnv1a64(user, strlen(user)) % CREDENTIAL_BUCKETS;
+
+        c->next = g_buckets[bucket];
+        g_buckets[bucket] = c;
+
+        loaded++;
+    }
+
+    fclose(file);
+
+    g_credential_count += loaded;
+
+    printf("Config: Loaded %d users from %s\n", loaded, filename);
+
+    return loaded;
+}
+
+int credentials_parse_config(const char* key, const char* value) {
+    if (strcmp(key, "AUTH_FILE") == 0) {
+        g_file_configured = 1;
+
+        credentials_load_file(value);
+    }
+    else if (strcmp(key, "AUTH_CACHE_TTL") == 0) {
+        int ttl = atoi(value);
+
+        g_cache_ttl_ns = ttl > 0 ? (uint64_t)ttl * 1000000000ull : 0;
+
+        printf("Config: Auth cache TTL = %d seconds\n", ttl > 0 ? ttl : 0);
+    }
+    else {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int b64_value(char c) {
+    if (c >= 'A' && c <= 'Z') {
+        return c - 'A';
+    }
+
+    if (c >= 'a' && c <= 'z') {
+        return c - 'a' + 26;
+    }
+
+    if (c >= '0' && c <= '9') {
+        return c - '0' + 52;
+    }
+
+    if (c == '+') {
+        return 62;
+    }
+
+    if (c == '/') {
+        return 63;
+    }
+
+    return -1;
+}
+
+static int decode_basic(const char* token, size_t len, char* out, size_t out_size) {
+    size_t j = 0;
+    uint32_t acc = 0;
+    int bits = 0;
+
+    for (size_t i = 0; i < len && token[i] != '='; i++) {
+        int v = b64_value(token[i]);
+
+        if (v < 0) {
+            return -1;
+        }
+
+        acc = (acc << 6) | (uint32_t)v;
+        bits += 6;
+
+        if (bits >= 8) {
+            bits -= 8;
+
+            if (j + 1 >= out_size) {
+                return -1;
+            }
+
+            out[j++] = (char)((acc >> bits) & 0xFF);
+        }
+    }
+
+    out[j] = '\0';
+
+    return (int)j;
+}
+
+static int constant_time_equal(const char* a, const char* b) {
+    size_t len_a = strlen(a);
+    size_t len_b = strlen(b);
+    unsigned char diff = (unsigned char)(len_a != len_b);
+
+    for (size_t i = 0; i < len_a && i < len_b; i++) {
+        diff |= (unsigned char)(a[i] ^ b[i]);
+    }
+
+    return diff == 0;
+}
+
+static int verify_password(const char* userpass) {
+    const char* colon = strchr(userpass, ':');
+
+    if (!colon) {
+        return 0;
+    }
+
+    if (!g_file_configured) {
+        return constant_time_equal(userpass, LEGACY_CREDENTIALS);
+    }
+
+    Credential* c = find_user(userpass, (size_t)(colon - userpass));
+    const char* hash = c ? c->hash : g_dummy_hash;
+
+    if (hash[0] == '\0') {
+        return 0;
+    }
+
+    if (!t_crypt_data) {
+        t_crypt_data = (struct crypt_data*)calloc(1, sizeof(struct crypt_data));
+
+        if (!t_crypt_data) {
+            return 0;
+        }
+    }
+
+    const char* computed = crypt_r(colon + 1, hash, t_crypt_data);
+
+    return c && computed && constant_time_equal(computed, hash);
+}
+
+static int cache_lookup(uint64_t key, const char* header, size_t len, uint64_t now) {
+    AuthCacheSlot* slot = &g_cache[key % AUTH_CACHE_SLOTS];
+    int hit = 0;
+
+    pthread_mutex_lock(&g_cache_mutex);
+
+    // The full header is compared as well, a hash collision must never authorize anyone.
+    if (slot->key == key && slot->len == len && now < slot->expires && memcmp(slot->header, header, len) == 0) {
+        hit = 1;
+    }
+
+    pthread_mutex_unlock(&g_cache_mutex);
+
+    return hit;
+}
+
+static void cache_store(uint64_t key, const char* header, size_t len, uint64_t now) {
+    AuthCacheSlot* slot = &g_cache[key % AUTH_CACHE_SLOTS];
+
+    pthread_mutex_lock(&g_cache_mutex);
+
+    slot->key = key;
+    slot->len = len;
+    slot->expires = now + g_cache_ttl_ns;
+
+    memcpy(slot->header, header, len);
+
+    pthread_mutex_unlock(&g_cache_mutex);
+}
+
+int credentials_check(const char* header, size_t len) {
+    int cacheable = g_cache_ttl_ns > 0 && len <= AUTH_HEADER_MAX;
+    uint64_t key = fnv1a64(header, len);
+    uint64_t now = metrics_now_ns();
+
+    if (cacheable && cache_lookup(key, header, len, now)) {
+        __atomic_add_fetch(&g_cache_hits, 1, __ATOMIC_RELAXED);
+
+        return 1;
+    }
+
+    __atomic_add_fetch(&g_cache_misses, 1, __ATOMIC_RELAXED);
+
+    char userpass[AUTH_HEADER_MAX];
+
+    if (len > 6 && strncmp(header, "Basic ", 6) == 0 && decode_basic(header + 6, len - 6, userpass, sizeof(userpass)) > 0 && verify_password(userpass)) {
+        if (cacheable) {
+            cache_store(key, header, len, now);
+        }
+
+        return 1;
+    }
+
+    __atomic_add_fetch(&g_failures, 1, __ATOMIC_RELAXED);
+
+    return 0;
+}
@@ -0,0 +1,35 @@
+#ifndef CREDENTIALS_H
+#define CREDENTIALS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CREDENTIAL_BUCKETS 256
+#define AUTH_CACHE_SLOTS 64
+#define AUTH_HEADER_MAX 256
+#define AUTH_DEFAULT_CACHE_TTL 60
+
+typedef struct Credential {
+    char user[64];
+    char hash[128];
+    struct Credential* next;
+} Credential;
+
+// Remembers Authorization headers that verified recently so the slow hash runs once per TTL.
+typedef struct {
+    uint64_t key;
+    uint64_t expires;
+    size_t len;
+    char header[AUTH_HEADER_MAX];
+} AuthCacheSlot;
+
+void credentials_init(void);
+
+int credentials_parse_config(const char* key, const char* value);
+
+int credentials_load_file(const char* filename);
+
+// header/len is the raw Authorization value ("Basic ..."). Returns 1 if it names a valid user.
+int credentials_check(const char* header, size_t len);
+
+#endif
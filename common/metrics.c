@@ -0,0 +1,439 @@
+#define _GNU_SOURCE
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <strings.h>
+#include <netinet/in.h>
+
+const char* g_metrics_server_name = "caligo";
+int g_metrics_queue_depth = 0;
+
+typedef enum {
+    STATS_ACCESS_LOCAL,
+    STATS_ACCESS_ANY,
+    STATS_ACCESS_OFF
+} StatsAccess;
+
+static StatsAccess g_stats_access = STATS_ACCESS_LOCAL;
+
+__thread MetricsShard* t_metrics_shard = NULL;
+
+static MetricsShard* g_shards[METRICS_MAX_SHARDS];
+static int g_shard_count = 0;
+static MetricsShard g_overflow_shard = { .shared = 1 };
+
+static MetricsSource g_sources[METRICS_MAX_SOURCES];
+static int g_source_count = 0;
+
+static const char* g_counter_names[METRIC_COUNTER_COUNT] = {
+    "connections_accepted_total",
+    "connections_closed_total",
+    "requests_static_total",
+    "requests_cgi_total",
+    "requests_proxy_total",
+    "requests_internal_total",
+    "requests_not_found_total",
+    "bytes_in_total",
+    "bytes_out_total",
+    "proxy_bytes_to_upstream_total",
+    "proxy_bytes_to_client_total",
+    "proxy_backpressure_stalls_total",
+    "tls_static_ktls_total",
+    "tls_static_userspace_total",
+    "tls_ktls_bytes_total",
+    "output_producer_pauses_total",
+    "tls_records_small_total",
+    "tls_records_full_total",
+    "tls_record_bytes_small_total",
+    "tls_record_bytes_full_total",
+    "tls_record_idle_resets_total",
+    "tls_early_data_accepted_total",
+    "tls_early_data_rejected_total",
+    "tls_early_data_replays_total",
+    "tls_early_data_bytes_total",
+    "tls_early_data_requests_total",
+    "tls_early_data_deferred_total",
+    "h2_connections_total",
+    "h2_streams_total",
+    "h2_streams_reset_total",
+    "h2_flow_control_stalls_total",
+    "request_body_bytes_total",
+    "request_body_spliced_bytes_total",
+    "request_body_rejected_total",
+    "expect_continue_total",
+    "response_streams_total",
+    "response_stream_bytes_total",
+    "requests_radio_total"
+};
+
+static const char* g_hist_names[METRIC_HIST_COUNT] = {
+    "read",
+    "queue",
+    "handle",
+    "write",
+    "static",
+    "cgi",
+    "proxy"
+};
+
+MetricsShard* metrics_shard_slow(void) {
+    int slot = __atomic_fetch_add(&g_shard_count, 1, __ATOMIC_RELAXED);
+
+    if (slot >= METRICS_MAX_SHARDS) {
+        t_metrics_shard = &g_overflow_shard;
+
+        return t_metrics_shard;
+    }
+
+    MetricsShard* shard = (MetricsShard*)calloc(1, sizeof(MetricsShard));
+
+    if (!shard) {
+        t_metrics_shard = &g_overflow_shard;
+
+        return t_metrics_shard;
+    }
+
+    __atomic_store_n(&g_shards[slot], shard, __ATOMIC_RELEASE);
+
+    t_metrics_shard = shard;
+
+    return shard;
+}
+
+void metrics_register_source(MetricsSource source) {
+    if (g_source_count < METRICS_MAX_SOURCES) {
+        g_sources[g_source_count++] = source;
+    }
+}
+
+static void merge_shard(MetricsShard* out, MetricsShard* in) {
+    for (int c = 0; c < METRIC_COUNTER_COUNT; c++) {
+        out->counters[c] += __atomic_load_n(&in->counters[c], __ATOMIC_RELAXED);
+    }
+
+    for (int h = 0; h < METRIC_HIST_COUNT; h++) {
+        Histogram* dst = &out->histograms[h];
+        Histogram* src = &in->histograms[h];
+
+        dst->count += __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+        dst->sum += __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+
+        uint64_t max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+
+        if (max > dst->max) {
+            dst->max = max;
+        }
+
+        for (int b = 0; b < HIST_BUCKETS; b++) {
+            dst->buckets[b] += __atomic_load_n(&src->buckets[b], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void merge_all(MetricsShard* out) {
+    memset(out, 0, sizeof(*out));
+
+    int count = __atomic_load_n(&g_shard_count, __ATOMIC_RELAXED);
+
+    if (count > METRICS_MAX_SHARDS) {
+        count = METRICS_MAX_SHARDS;
+    }
+
+    for (int i = 0; i < count; i++) {
+        MetricsShard* shard = __atomic_load_n(&g_shards[i], __ATOMIC_ACQUIRE);
+
+        if (shard) {
+            merge_shard(out, shard);
+        }
+    }
+
+    merge_shard(out, &g_overflow_shard);
+}
+
+static uint64_t bucket_upper_bound(int index) {
+    if (index < HIST_SUB_COUNT) {
+        return (uint64_t)index;
+    }
+
+    int shift = index / HIST_SUB_COUNT - 1;
+    uint64_t lower = (uint64_t)(HIST_SUB_COUNT + index % HIST_SUB_COUNT) << shift;
+
+    return lower + ((uint64_t)1 << shift) - 1;
+}
+
+static uint64_t histogram_percentile(const Histogram* h, double pct) {
+    if (h->count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)(pct / 100.0 * (double)h->count);
+    uint64_t seen = 0;
+
+    if (rank >= h->count) {
+        rank = h->count - 1;
+    }
+
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        seen += h->buckets[b];
+
+        if (seen > rank) {
+            uint64_t upper = bucket_upper_bound(b);
+
+            return upper < h->max ? upper : h->max;
+        }
+    }
+
+    return h->max;
+}
+
+static void writer_append(MetricsWriter* w, const char* fmt, ...) {
+    if (w->len >= w->cap) {
+        return;
+    }
+
+    va_list args;
+
+    va_start(args, fmt);
+
+    int n = vsnprintf(w->buf + w->len, w->cap - w->len, fmt, args);
+
+    va_end(args);
+
+    if (n < 0) {
+        return;
+    }
+
+    w->len += (size_t)n;
+
+    if (w->len >= w->cap) {
+        w->len = w->cap - 1;
+    }
+}
+
+static void writer_json_key(MetricsWriter* w, const char* key) {
+    writer_append(w, "%s\"%s\": ", w->first ? "" : ", ", key);
+
+    w->first = 0;
+}
+
+void metrics_write_value(MetricsWriter* w, const char* name, const char* help, uint64_t value) {
+    if (w->format == METRICS_FORMAT_JSON) {
+        writer_json_key(w, name);
+        writer_append(w, "%llu", (unsigned long long)value);
+
+        return;
+    }
+
+    if (help) {
+        writer_append(w, "# HELP caligo_%s %s\n", name, help);
+    }
+
+    writer_append(w, "caligo_%s{server=\"%s\"} %llu\n", name, g_metrics_server_name, (unsigned long long)value);
+}
+
+void metrics_write_labeled(MetricsWriter* w, const char* name, const char* label, const char* label_value, uint64_t value) {
+    if (w->format == METRICS_FORMAT_JSON) {
+        char key[256];
+
+        snprintf(key, sizeof(key), "%s:%s", name, label_value);
+
+        writer_json_key(w, key);
+        writer_append(w, "%llu", (unsigned long long)value);
+
+        return;
+    }
+
+    writer_append(w, "caligo_%s{server=\"%s\",%s=\"%s\"} %llu\n", name, g_metrics_server_name, label, label_value, (unsigned long long)value);
+}
+
+static void render_prometheus(MetricsWriter* w, MetricsShard* merged) {
+    for (int c = 0; c < METRIC_COUNTER_COUNT; c++) {
+        writer_append(w, "# TYPE caligo_%s counter\n", g_counter_names[c]);
+        writer_append(w, "caligo_%s{server=\"%s\"} %llu\n", g_counter_names[c], g_metrics_server_name, (unsigned long long)merged->counters[c]);
+    }
+
+    writer_append(w, "# TYPE caligo_queue_depth gauge\n");
+    writer_append(w, "caligo_queue_depth{server=\"%s\"} %d\n", g_metrics_server_name, __atomic_load_n(&g_metrics_queue_depth, __ATOMIC_RELAXED));
+
+    writer_append(w, "# TYPE caligo_stage_seconds histogram\n");
+    writer_append(w, "# TYPE caligo_route_seconds histogram\n");
+
+    for (int h = 0; h < METRIC_HIST_COUNT; h++) {
+        const Histogram* hist = &merged->histograms[h];
+        const char* family = h <= METRIC_HIST_STAGE_WRITE ? "stage" : "route";
+        uint64_t cumulative = 0;
+        int bucket = 0;
+
+        // Fixed power-of-two boundaries from ~1us to ~69s so the label set is stable across scrapes.
+        for (int k = 10; k <= 36; k++) {
+            uint64_t bound = (uint64_t)1 << k;
+
+            while (bucket < HIST_BUCKETS && bucket_upper_bound(bucket) < bound) {
+                cumulative += hist->buckets[bucket++];
+            }
+
+            writer_append(w, "caligo_%s_seconds_bucket{server=\"%s\",%s=\"%s\",le=\"%.9f\"} %llu\n",
+                          family, g_metrics_server_name, family, g_hist_names[h], (double)bound / 1e9, (unsigned long long)cumulative);
+        }
+
+        writer_append(w, "caligo_%s_seconds_bucket{server=\"%s\",%s=\"%s\",le=\"+Inf\"} %llu\n",
+                      family, g_metrics_server_name, family, g_hist_names[h], (unsigned long long)hist->count);
+        writer_append(w, "caligo_%s_seconds_sum{server=\"%s\",%s=\"%s\"} %.9f\n",
+                      family, g_metrics_server_name, family, g_hist_names[h], (double)hist->sum / 1e9);
+        writer_append(w, "caligo_%s_seconds_count{server=\"%s\",%s=\"%s\"} %llu\n",
+                      family, g_metrics_server_name, family, g_hist_names[h], (unsigned long long)hist->count);
+    }
+
+    for (int i = 0; i < g_source_count; i++) {
+        g_sources[i](w);
+    }
+}
+
+static void render_json(MetricsWriter* w, MetricsShard* merged) {
+    writer_append(w, "{\"server\": \"%s\", \"counters\": {", g_metrics_server_name);
+
+    for (int c = 0; c < METRIC_COUNTER_COUNT; c++) {
+        writer_append(w, "%s\"%s\": %llu", c ? ", " : "", g_counter_names[c], (unsigned long long)merged->counters[c]);
+    }
+
+    writer_append(w, "}, \"gauges\": {\"queue_depth\": %d}, \"histograms\": {", __atomic_load_n(&g_metrics_queue_depth, __ATOMIC_RELAXED));
+
+    for (int h = 0; h < METRIC_HIST_COUNT; h++) {
+        const Histogram* hist = &merged->histograms[h];
+
+        writer_append(w, "%s\"%s_%s\": {\"count\": %llu, \"sum_ns\": %llu, \"max_ns\": %llu, "
+                         "\"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu}",
+                      h ? ", " : "",
+                      h <= METRIC_HIST_STAGE_WRITE ? "stage" : "route",
+                      g_hist_names[h],
+                      (unsigned long long)hist->count,
+                      (unsigned long long)hist->sum,
+                      (unsigned long long)hist->max,
+                      (unsigned long long)histogram_percentile(hist, 50.0),
+                      (unsigned long long)histogram_percentile(hist, 90.0),
+                      (unsigned long long)histogram_percentile(hist, 99.0),
+                      (unsigned long long)histogram_percentile(hist, 99.9));
+    }
+
+    writer_append(w, "}, \"extra\": {");
+
+    w->first = 1;
+
+    for (int i = 0; i < g_source_count; i++) {
+        g_sources[i](w);
+    }
+
+    writer_append(w, "}}\n");
+}
+
+size_t metrics_render(char* buf, size_t cap, MetricsFormat format) {
+    MetricsShard* merged = (MetricsShard*)malloc(sizeof(MetricsShard));
+
+    if (!merged || cap == 0) {
+        free(merged);
+
+        return 0;
+    }
+
+    merge_all(merged);
+
+    MetricsWriter w;
+    w.buf = buf;
+    w.cap = cap;
+    w.len = 0;
+    w.format = format;
+    w.first = 1;
+
+    buf[0] = '\0';
+
+    if (format == METRICS_FORMAT_JSON) {
+        render_json(&w, merged);
+    }
+    else {
+        render_prometheus(&w, merged);
+    }
+
+    free(merged);
+
+    return w.len;
+}
+
+int metrics_is_stats_path(const char* requested_path) {
+    return strcmp(requested_path, "/__stats") == 0 || strcmp(requested_path, "/__stats.json") == 0;
+}
+
+int metrics_parse_config(const char* key, const char* value) {
+    if (strcmp(key, "STATS_ACCESS") != 0) {
+        return -1;
+    }
+
+    if (strcasecmp(value, "local") == 0) {
+        g_stats_access = STATS_ACCESS_LOCAL;
+    }
+    else if (strcasecmp(value, "any") == 0) {
+        g_stats_access = STATS_ACCESS_ANY;
+    }
+    else if (strcasecmp(value, "off") == 0) {
+        g_stats_access = STATS_ACCESS_OFF;
+    }
+    else {
+        fprintf(stderr, "Config: Unknown STATS_ACCESS %s (expected local, any or off)\n", value);
+
+        return 0;
+    }
+
+    printf("Config: Stats access = %s\n", value);
+
+    return 0;
+}
+
+int metrics_peer_is_local(const struct sockaddr* addr) {
+    if (addr->sa_family == AF_UNIX) {
+        return 1;
+    }
+
+    if (addr->sa_family == AF_INET) {
+        return (ntohl(((const struct sockaddr_in*)addr)->sin_addr.s_addr) >> 24) == 127;
+    }
+
+    if (addr->sa_family == AF_INET6) {
+        const struct in6_addr* ip = &((const struct sockaddr_in6*)addr)->sin6_addr;
+
+        return IN6_IS_ADDR_LOOPBACK(ip) || (IN6_IS_ADDR_V4MAPPED(ip) && ip->s6_addr[12] == 127);
+    }
+
+    return 0;
+}
+
+int metrics_internal_allowed(int local_peer) {
+    if (g_stats_access == STATS_ACCESS_ANY) {
+        return 1;
+    }
+
+    return g_stats_access == STATS_ACCESS_LOCAL && local_peer;
+}
+
+MetricsFormat metrics_format_from_request(const char* request_buffer) {
+    const char* line_end = strstr(request_buffer, "\r\n");
+    const char* json = strstr(request_buffer, "format=json");
+    const char* ext = strstr(request_buffer, "/__stats.json");
+
+    if ((json && (!line_end || json < line_end)) || (ext && (!line_end || ext < line_end))) {
+        return METRICS_FORMAT_JSON;
+    }
+
+    const char* accept = strcasestr(request_buffer, "\r\nAccept:");
+
+    if (accept) {
+        const char* accept_end = strstr(accept + 2, "\r\n");
+        const char* wants_json = strstr(accept, "application/json");
+
+        if (wants_json && (!accept_end || wants_json < accept_end)) {
+            return METRICS_FORMAT_JSON;
+        }
+    }
+
+    return METRICS_FORMAT_PROMETHEUS;
+}
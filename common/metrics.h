@@ -0,0 +1,210 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#define METRICS_MAX_SHARDS 256
+#define METRICS_RENDER_SIZE (256 * 1024)
+#define METRICS_MAX_SOURCES 16
+
+// Log-linear buckets: 8 sub-buckets per power of two, ~12% relative error.
+#define HIST_SUB_BITS 3
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+typedef enum {
+    METRIC_CONNECTIONS_ACCEPTED,
+    METRIC_CONNECTIONS_CLOSED,
+    METRIC_REQUESTS_STATIC,
+    METRIC_REQUESTS_CGI,
+    METRIC_REQUESTS_PROXY,
+    METRIC_REQUESTS_INTERNAL,
+    METRIC_REQUESTS_NOT_FOUND,
+    METRIC_BYTES_IN,
+    METRIC_BYTES_OUT,
+    METRIC_PROXY_BYTES_TO_UPSTREAM,
+    METRIC_PROXY_BYTES_TO_CLIENT,
+    METRIC_PROXY_STALLS,
+    METRIC_TLS_STATIC_KTLS,
+    METRIC_TLS_STATIC_USERSPACE,
+    METRIC_TLS_KTLS_BYTES,
+    METRIC_OUTPUT_PAUSES,
+    METRIC_TLS_RECORDS_SMALL,
+    METRIC_TLS_RECORDS_FULL,
+    METRIC_TLS_RECORD_BYTES_SMALL,
+    METRIC_TLS_RECORD_BYTES_FULL,
+    METRIC_TLS_RECORD_IDLE_RESETS,
+    METRIC_TLS_EARLY_ACCEPTED,
+    METRIC_TLS_EARLY_REJECTED,
+    METRIC_TLS_EARLY_REPLAYS,
+    METRIC_TLS_EARLY_BYTES,
+    METRIC_TLS_EARLY_REQUESTS,
+    METRIC_TLS_EARLY_DEFERRED,
+    METRIC_H2_CONNECTIONS,
+    METRIC_H2_STREAMS,
+    METRIC_H2_STREAMS_RESET,
+    METRIC_H2_FLOW_STALLS,
+    METRIC_REQUEST_BODY_BYTES,
+    METRIC_REQUEST_BODY_SPLICED,
+    METRIC_REQUEST_BODY_REJECTED,
+    METRIC_EXPECT_CONTINUE,
+    METRIC_RESPONSE_STREAMS,
+    METRIC_RESPONSE_STREAM_BYTES,
+    METRIC_REQUESTS_RADIO,
+    METRIC_COUNTER_COUNT
+} MetricCounter;
+
+typedef enum {
+    METRIC_HIST_STAGE_READ,
+    METRIC_HIST_STAGE_QUEUE,
+    METRIC_HIST_STAGE_HANDLE,
+    METRIC_HIST_STAGE_WRITE,
+    METRIC_HIST_ROUTE_STATIC,
+    METRIC_HIST_ROUTE_CGI,
+    METRIC_HIST_ROUTE_PROXY,
+    METRIC_HIST_COUNT
+} MetricHistogram;
+
+typedef enum {
+    METRICS_FORMAT_PROMETHEUS,
+    METRICS_FORMAT_JSON
+} MetricsFormat;
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+} Histogram;
+
+// One shard per thread. Only the owning thread writes, so updates are plain
+// relaxed load/store pairs; readers merge all shards when rendering. Threads past
+// METRICS_MAX_SHARDS share the overflow shard, marked shared, which takes atomic adds.
+typedef struct {
+    uint64_t counters[METRIC_COUNTER_COUNT];
+    Histogram histograms[METRIC_HIST_COUNT];
+    int shared;
+} MetricsShard;
+
+typedef struct {
+    char* buf;
+    size_t cap;
+    size_t len;
+    MetricsFormat format;
+    int first;
+} MetricsWriter;
+
+typedef void (*MetricsSource)(MetricsWriter* w);
+
+extern const char* g_metrics_server_name;
+extern int g_metrics_queue_depth;
+
+MetricsShard* metrics_shard_slow(void);
+
+extern __thread MetricsShard* t_metrics_shard;
+
+static inline MetricsShard* metrics_shard(void) {
+    MetricsShard* shard = t_metrics_shard;
+
+    if (__builtin_expect(shard == NULL, 0)) {
+        shard = metrics_shard_slow();
+    }
+
+    return shard;
+}
+
+static inline uint64_t metrics_now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline void metrics_store_add(uint64_t* slot, uint64_t n) {
+    __atomic_store_n(slot, __atomic_load_n(slot, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static inline void metrics_shard_add(const MetricsShard* shard, uint64_t* slot, uint64_t n) {
+    if (__builtin_expect(shard->shared, 0)) {
+        __atomic_fetch_add(slot, n, __ATOMIC_RELAXED);
+    }
+    else {
+        metrics_store_add(slot, n);
+    }
+}
+
+static inline void metrics_count(MetricCounter counter, uint64_t n) {
+    MetricsShard* shard = metrics_shard();
+
+    metrics_shard_add(shard, &shard->counters[counter], n);
+}
+
+static inline int metrics_bucket_index(uint64_t value) {
+    if (value < HIST_SUB_COUNT) {
+        return (int)value;
+    }
+
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - HIST_SUB_BITS;
+
+    return (shift + 1) * HIST_SUB_COUNT + (int)((value >> shift) & (HIST_SUB_COUNT - 1));
+}
+
+static inline void metrics_observe(MetricHistogram hist, uint64_t value_ns) {
+    MetricsShard* shard = metrics_shard();
+    Histogram* h = &shard->histograms[hist];
+
+    metrics_shard_add(shard, &h->buckets[metrics_bucket_index(value_ns)], 1);
+    metrics_shard_add(shard, &h->count, 1);
+    metrics_shard_add(shard, &h->sum, value_ns);
+
+    uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+
+    while (value_ns > max) {
+        if (!shard->shared) {
+            __atomic_store_n(&h->max, value_ns, __ATOMIC_RELAXED);
+
+            break;
+        }
+
+        if (__atomic_compare_exchange_n(&h->max, &max, value_ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+}
+
+static inline void metrics_observe_since(MetricHistogram hist, uint64_t start_ns) {
+    if (start_ns != 0) {
+        metrics_observe(hist, metrics_now_ns() - start_ns);
+    }
+}
+
+static inline void metrics_queue_depth_add(int delta) {
+    __atomic_add_fetch(&g_metrics_queue_depth, delta, __ATOMIC_RELAXED);
+}
+
+void metrics_register_source(MetricsSource source);
+
+size_t metrics_render(char* buf, size_t cap, MetricsFormat format);
+
+void metrics_write_value(MetricsWriter* w, const char* name, const char* help, uint64_t value);
+
+void metrics_write_labeled(MetricsWriter* w, const char* name, const char* label, const char* label_value, uint64_t value);
+
+int metrics_is_stats_path(const char* requested_path);
+
+int metrics_parse_config(const char* key, const char* value);
+
+// Whether an accepted peer address is on this host (loopback or a Unix socket).
+int metrics_peer_is_local(const struct sockaddr* addr);
+
+// STATS_ACCESS policy for /__stats and /__trace: local (default), any or off.
+int metrics_internal_allowed(int local_peer);
+
+MetricsFormat metrics_format_from_request(const char* request_buffer);
+
+#endif
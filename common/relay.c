@@ -0,0 +1,105 @@
+#define _GNU_SOURCE
+#include "relay.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+size_t g_relay_buffer_cap = RELAY_DEFAULT_BUFFER;
+
+static void relay_metrics_source(MetricsWriter* w) {
+    metrics_write_value(w, "proxy_buffer_cap_bytes", "Per-direction proxy buffer limit", (uint64_t)g_relay_buffer_cap);
+}
+
+void relay_init(void) {
+    metrics_register_source(relay_metrics_source);
+}
+
+int relay_parse_config(const char* key, const char* value) {
+    if (strcmp(key, "PROXY_BUFFER_SIZE") != 0) {
+        return -1;
+    }
+
+    long size = atol(value);
+
+    g_relay_buffer_cap = size < RELAY_MIN_BUFFER ? RELAY_MIN_BUFFER : (size_t)size;
+
+    printf("Config: Proxy buffer per direction = %zu bytes\n", g_relay_buffer_cap);
+
+    return 0;
+}
+
+void relay_pipe_init(RelayPipe* p) {
+    p->pipe_fds[0] = -1;
+    p->pipe_fds[1] = -1;
+    p->pending = 0;
+}
+
+void relay_pipe_close(RelayPipe* p) {
+    if (p->pipe_fds[0] >= 0) {
+        close(p->pipe_fds[0]);
+        close(p->pipe_fds[1]);
+    }
+
+    relay_pipe_init(p);
+}
+
+// Returns bytes moved into the pipe, 0 on EOF, -1 with errno set (EAGAIN once the source is drained).
+ssize_t relay_fill(RelayPipe* p, int src_fd, size_t max) {
+    if (p->pipe_fds[0] < 0) {
+        if (pipe2(p->pipe_fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+            perror("relay: pipe2");
+
+            return -1;
+        }
+
+        // Best effort: the kernel may round up or refuse sizes above pipe-max-size.
+        fcntl(p->pipe_fds[1], F_SETPIPE_SZ, (int)g_relay_buffer_cap);
+    }
+
+    size_t room = g_relay_buffer_cap - p->pending;
+
+    if (max > room) {
+        max = room;
+    }
+
+    if (max == 0) {
+        errno = EAGAIN;
+
+        return -1;
+    }
+
+    ssize_t n = splice(src_fd, NULL, p->pipe_fds[1], NULL, max, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+    if (n > 0) {
+        p->pending += n;
+    }
+
+    return n;
+}
+
+// Moves up to max bytes out of the pipe. Returns 0 once they (or the whole pipe) have gone,
+// 1 if the destination would block, -1 on error.
+int relay_drain(RelayPipe* p, int dst_fd, size_t max) {
+    while (p->pending > 0 && max > 0) {
+        ssize_t n = splice(p->pipe_fds[0], NULL, dst_fd, NULL, p->pending < max ? p->pending : max, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+        if (n > 0) {
+            p->pending -= n;
+            max -= n;
+
+            continue;
+        }
+
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 1;
+        }
+
+        return -1;
+    }
+
+    return 0;
+}
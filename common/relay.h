@@ -0,0 +1,31 @@
+#ifndef RELAY_H
+#define RELAY_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define RELAY_DEFAULT_BUFFER (64 * 1024)
+#define RELAY_MIN_BUFFER 4096
+
+// One direction of a proxied connection. Bytes spliced out of the source wait
+// in the pipe until the destination accepts them; nothing is copied to user space.
+typedef struct {
+    int pipe_fds[2];
+    size_t pending;
+} RelayPipe;
+
+extern size_t g_relay_buffer_cap;
+
+void relay_init(void);
+
+int relay_parse_config(const char* key, const char* value);
+
+void relay_pipe_init(RelayPipe* p);
+
+void relay_pipe_close(RelayPipe* p);
+
+ssize_t relay_fill(RelayPipe* p, int src_fd, size_t max);
+
+int relay_drain(RelayPipe* p, int dst_fd, size_t max);
+
+#endif
@@ -0,0 +1,483 @@
+#define _GNU_SOURCE
+#include "topology.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define DEFAULT_WORKERS_PER_CPU 2
+#define MIN_WORKER_THREADS 2
+#define MAX_WORKER_THREADS 64
+#define MAX_SENDER_THREADS 32
+#define MIN_EPOLL_EVENTS 64
+#define MAX_EPOLL_EVENTS_LIMIT 1024
+
+Topology g_topology;
+
+static int g_override_workers = 0;
+static int g_override_senders = 0;
+static int g_override_epoll_events = 0;
+static char g_override_irq_cpus[256] = "";
+static char g_override_slots[64] = "";
+
+static void parse_cpu_list(const char* list, unsigned char* out) {
+    const char* p = list;
+
+    while (*p) {
+        char* end;
+        long first = strtol(p, &end, 10);
+
+        if (end == p) {
+            p++;
+
+            continue;
+        }
+
+        long last = first;
+
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+        }
+
+        for (long cpu = first; cpu <= last && cpu < TOPOLOGY_MAX_CPUS; cpu++) {
+            if (cpu >= 0) {
+                out[cpu] = 1;
+            }
+        }
+
+        p = end;
+
+        if (*p == ',') {
+            p++;
+        }
+    }
+}
+
+static int read_first_line(const char* path, char* buf, size_t len) {
+    FILE* file = fopen(path, "r");
+
+    if (!file) {
+        return -1;
+    }
+
+    if (!fgets(buf, (int)len, file)) {
+        fclose(file);
+
+        return -1;
+    }
+
+    fclose(file);
+
+    buf[strcspn(buf, "\n")] = '\0';
+
+    return 0;
+}
+
+static int detect_cgroup_quota(void) {
+    char line[512];
+    char cgroup_path[256] = "";
+    FILE* file = fopen("/proc/self/cgroup", "r");
+
+    if (file) {
+        while (fgets(line, sizeof(line), file)) {
+            if (strncmp(line, "0::", 3) == 0) {
+                strncpy(cgroup_path, line + 3, sizeof(cgroup_path) - 1);
+
+                cgroup_path[strcspn(cgroup_path, "\n")] = '\0';
+
+                break;
+            }
+        }
+
+        fclose(file);
+    }
+
+    char path[512];
+    char quota[64];
+    long period = 0;
+
+    snprintf(path, sizeof(path), "/sys/fs/cgroup%s/cpu.max", strcmp(cgroup_path, "/") == 0 ? "" : cgroup_path);
+
+    if (read_first_line(path, line, sizeof(line)) == 0 || read_first_line("/sys/fs/cgroup/cpu.max", line, sizeof(line)) == 0) {
+        if (sscanf(line, "%63s %ld", quota, &period) == 2 && strcmp(quota, "max") != 0 && period > 0) {
+            long q = atol(quota);
+
+            return (int)((q + period - 1) / period);
+        }
+
+        return 0;
+    }
+
+    char period_line[64];
+
+    if (read_first_line("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", line, sizeof(line)) == 0 &&
+        read_first_line("/sys/fs/cgroup/cpu/cpu.cfs_period_us", period_line, sizeof(period_line)) == 0) {
+        long q = atol(line);
+
+        period = atol(period_line);
+
+        if (q > 0 && period > 0) {
+            return (int)((q + period - 1) / period);
+        }
+    }
+
+    return 0;
+}
+
+static void detect_nic_irq_cpus(const char* device, unsigned char* out) {
+    FILE* file = fopen("/proc/interrupts", "r");
+    char line[4096];
+
+    if (!file) {
+        return;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        if (!strstr(line, device)) {
+            continue;
+        }
+
+        int irq = atoi(line);
+        char path[128];
+        char list[1024];
+
+        snprintf(path, sizeof(path), "/proc/irq/%d/effective_affinity_list", irq);
+
+        if (read_first_line(path, list, sizeof(list)) < 0) {
+            snprintf(path, sizeof(path), "/proc/irq/%d/smp_affinity_list", irq);
+
+            if (read_first_line(path, list, sizeof(list)) < 0) {
+                continue;
+            }
+        }
+
+        parse_cpu_list(list, out);
+    }
+
+    fclose(file);
+}
+
+static void load_numa_nodes(int* node_of) {
+    char path[128];
+    char list[4096];
+
+    for (int cpu = 0; cpu < TOPOLOGY_MAX_CPUS; cpu++) {
+        node_of[cpu] = 0;
+    }
+
+    for (int node = 0; node < 64; node++) {
+        unsigned char cpus[TOPOLOGY_MAX_CPUS] = {0};
+
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+
+        if (read_first_line(path, list, sizeof(list)) < 0) {
+            continue;
+        }
+
+        parse_cpu_list(list, cpus);
+
+        for (int cpu = 0; cpu < TOPOLOGY_MAX_CPUS; cpu++) {
+            if (cpus[cpu]) {
+                node_of[cpu] = node;
+            }
+        }
+    }
+}
+
+void topology_init(const char* process) {
+    cpu_set_t set;
+
+    memset(&g_topology, 0, sizeof(g_topology));
+
+    strncpy(g_topology.process, process, sizeof(g_topology.process) - 1);
+
+    CPU_ZERO(&set);
+
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        g_topology.available_cpus = CPU_COUNT(&set);
+    }
+    else {
+        g_topology.available_cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+
+    if (g_topology.available_cpus < 1) {
+        g_topology.available_cpus = 1;
+    }
+
+    g_topology.quota_cpus = detect_cgroup_quota();
+    g_topology.effective_cpus = g_topology.available_cpus;
+
+    if (g_topology.quota_cpus > 0 && g_topology.quota_cpus < g_topology.effective_cpus) {
+        g_topology.effective_cpus = g_topology.quota_cpus;
+    }
+}
+
+int topology_parse_config(const char* key, const char* value) {
+    size_t key_len = strlen(key);
+    size_t suffix_len = strlen("_CPU_SLOTS");
+
+    if (key_len > suffix_len && strcmp(key + key_len - suffix_len, "_CPU_SLOTS") == 0) {
+        // Both processes read server.conf; only the slice named after this one applies here.
+        if (key_len - suffix_len != strlen(g_topology.process) || strncmp(key, g_topology.process, key_len - suffix_len) != 0) {
+            return 0;
+        }
+
+        strncpy(g_override_slots, value, sizeof(g_override_slots) - 1);
+    }
+    else if (strcmp(key, "WORKER_THREADS") == 0) {
+        g_override_workers = atoi(value);
+    }
+    else if (strcmp(key, "SENDER_THREADS") == 0) {
+        g_override_senders = atoi(value);
+    }
+    else if (strcmp(key, "EPOLL_EVENTS") == 0) {
+        g_override_epoll_events = atoi(value);
+    }
+    else if (strcmp(key, "CPU_AFFINITY") == 0) {
+        g_topology.pin_threads = (strcasecmp(value, "on") == 0 || strcmp(value, "1") == 0);
+    }
+    else if (strcmp(key, "NIC_DEVICE") == 0) {
+        strncpy(g_topology.nic_device, value, sizeof(g_topology.nic_device) - 1);
+    }
+    else if (strcmp(key, "IRQ_CPUS") == 0) {
+        strncpy(g_override_irq_cpus, value, sizeof(g_override_irq_cpus) - 1);
+    }
+    else {
+        return -1;
+    }
+
+    printf("Config: Topology %s = %s\n", key, value);
+
+    return 0;
+}
+
+void topology_load_config_file(const char* filename) {
+    FILE* file = fopen(filename, "r");
+
+    if (!file) {
+        return;
+    }
+
+    char line[512];
+
+    while (fgets(line, sizeof(line), file)) {
+        char key[64], value[256];
+
+        if (line[0] != '#' && sscanf(line, "%63s %255s", key, value) == 2) {
+            topology_parse_config(key, value);
+        }
+    }
+
+    fclose(file);
+}
+
+static int clamp(int value, int low, int high) {
+    if (value < low) {
+        return low;
+    }
+
+    if (value > high) {
+        return high;
+    }
+
+    return value;
+}
+
+static void build_placement(void) {
+    cpu_set_t set;
+    unsigned char allowed[TOPOLOGY_MAX_CPUS] = {0};
+    unsigned char irq[TOPOLOGY_MAX_CPUS] = {0};
+    unsigned char placed[TOPOLOGY_MAX_CPUS] = {0};
+    int node_of[TOPOLOGY_MAX_CPUS];
+    int count = 0;
+
+    CPU_ZERO(&set);
+
+    if (sched_getaffinity(0, sizeof(set), &set) < 0) {
+        return;
+    }
+
+    load_numa_nodes(node_of);
+
+    for (int cpu = 0; cpu < TOPOLOGY_MAX_CPUS && cpu < CPU_SETSIZE; cpu++) {
+        allowed[cpu] = CPU_ISSET(cpu, &set) ? 1 : 0;
+    }
+
+    if (g_override_irq_cpus[0]) {
+        parse_cpu_list(g_override_irq_cpus, irq);
+    }
+    else if (g_topology.nic_device[0]) {
+        detect_nic_irq_cpus(g_topology.nic_device, irq);
+    }
+
+    int home_node = -1;
+
+    for (int cpu = 0; cpu < TOPOLOGY_MAX_CPUS; cpu++) {
+        if (allowed[cpu] && irq[cpu]) {
+            g_topology.placement[count++] = cpu;
+            placed[cpu] = 1;
+
+            if (home_node < 0) {
+                home_node = node_of[cpu];
+            }
+        }
+    }
+
+    g_topology.irq_cpu_count = count;
+
+    for (int pass = 0; pass < 2; pass++) {
+        for (int cpu = 0; cpu < TOPOLOGY_MAX_CPUS; cpu++) {
+            if (!allowed[cpu] || placed[cpu]) {
+                continue;
+            }
+
+            if (home_node < 0) {
+                home_node = node_of[cpu];
+            }
+
+            if (pass == 0 && node_of[cpu] != home_node) {
+                continue;
+            }
+
+            g_topology.placement[count++] = cpu;
+            placed[cpu] = 1;
+        }
+    }
+
+    // Stay inside the cgroup quota's worth of cores so pinned threads share caches.
+    if (count > g_topology.effective_cpus && g_topology.effective_cpus > g_topology.irq_cpu_count) {
+        count = g_topology.effective_cpus;
+    }
+
+    g_topology.placement_count = count;
+}
+
+static void assign_slots(unsigned roles) {
+    int n = g_topology.placement_count;
+    int radio_tail = 2 + g_topology.sender_threads;
+
+    g_topology.slot_first = 0;
+    g_topology.slot_count = n;
+
+    if (g_override_slots[0]) {
+        int first = 0, last = 0;
+        int fields = sscanf(g_override_slots, "%d-%d", &first, &last);
+
+        if (fields == 1) {
+            last = first;
+        }
+
+        if (fields >= 1 && first >= 0 && last >= first && first < n) {
+            g_topology.slot_first = first;
+            g_topology.slot_count = (last < n ? last : n - 1) - first + 1;
+        }
+        else {
+            fprintf(stderr, "topology: ignoring %s_CPU_SLOTS %s (placement has %d slots)\n", g_topology.process, g_override_slots, n);
+        }
+    }
+    else if (n >= radio_tail + 2) {
+        // Default split: radio_server (event loop, broadcaster, senders) takes the tail, server the rest.
+        if (strcmp(g_topology.process, "RADIO") == 0) {
+            g_topology.slot_first = n - radio_tail;
+            g_topology.slot_count = radio_tail;
+        }
+        else {
+            g_topology.slot_count = n - radio_tail;
+        }
+    }
+
+    // Ranges in order event loop, broadcaster, senders, workers; the last role gets what is left.
+    static const ThreadRole order[] = { THREAD_ROLE_EVENT_LOOP, THREAD_ROLE_BROADCAST, THREAD_ROLE_SENDER, THREAD_ROLE_WORKER };
+    int m = g_topology.slot_count;
+    int cursor = 0;
+    int last_role = -1;
+
+    for (int i = 0; i < THREAD_ROLE_COUNT; i++) {
+        if (roles & TOPOLOGY_ROLE(order[i])) {
+            last_role = (int)order[i];
+        }
+    }
+
+    for (int i = 0; i < THREAD_ROLE_COUNT; i++) {
+        ThreadRole role = order[i];
+
+        if (!(roles & TOPOLOGY_ROLE(role))) {
+            continue;
+        }
+
+        int want = 1;
+
+        if (role == THREAD_ROLE_SENDER) {
+            want = g_topology.sender_threads;
+        }
+        else if (role == THREAD_ROLE_WORKER) {
+            want = g_topology.worker_threads;
+        }
+
+        int left = m - cursor;
+
+        if (left <= 0) {
+            // Slice too small: share everything but the event loop's slot.
+            g_topology.role_first[role] = m > 1 ? 1 : 0;
+            g_topology.role_count[role] = m > 1 ? m - 1 : 1;
+
+            continue;
+        }
+
+        int count = ((int)role == last_role || want > left) ? left : want;
+
+        g_topology.role_first[role] = cursor;
+        g_topology.role_count[role] = count;
+        cursor += count;
+    }
+}
+
+void topology_finalize(unsigned roles) {
+    int cpus = g_topology.effective_cpus;
+
+    g_topology.worker_threads = g_override_workers > 0 ? g_override_workers : clamp(cpus * DEFAULT_WORKERS_PER_CPU, MIN_WORKER_THREADS, MAX_WORKER_THREADS);
+    g_topology.sender_threads = g_override_senders > 0 ? g_override_senders : clamp(cpus, 1, MAX_SENDER_THREADS);
+    g_topology.max_epoll_events = g_override_epoll_events > 0 ? g_override_epoll_events : clamp(cpus * MIN_EPOLL_EVENTS, MIN_EPOLL_EVENTS, MAX_EPOLL_EVENTS_LIMIT);
+
+    if (g_topology.pin_threads) {
+        build_placement();
+        assign_slots(roles);
+    }
+
+    printf("Topology: %d CPUs available, cgroup quota %d, using %d (workers=%d senders=%d epoll_events=%d pinning=%s)\n",
+           g_topology.available_cpus, g_topology.quota_cpus, cpus,
+           g_topology.worker_threads, g_topology.sender_threads, g_topology.max_epoll_events,
+           g_topology.pin_threads ? "on" : "off");
+
+    if (g_topology.pin_threads && g_topology.slot_count > 0) {
+        printf("Topology: %s pins to placement slots %d-%d\n", g_topology.process,
+               g_topology.slot_first, g_topology.slot_first + g_topology.slot_count - 1);
+    }
+}
+
+int topology_pin_current_thread(ThreadRole role, int index) {
+    if (!g_topology.pin_threads || g_topology.slot_count == 0 || g_topology.role_count[role] == 0) {
+        return 0;
+    }
+
+    int slot = g_topology.slot_first + g_topology.role_first[role] + index % g_topology.role_count[role];
+
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(g_topology.placement[slot], &set);
+
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+    if (rc != 0) {
+        fprintf(stderr, "topology: pthread_setaffinity_np(cpu %d) failed: %s\n", g_topology.placement[slot], strerror(rc));
+
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,53 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#define TOPOLOGY_MAX_CPUS 1024
+
+typedef enum {
+    THREAD_ROLE_EVENT_LOOP,
+    THREAD_ROLE_WORKER,
+    THREAD_ROLE_SENDER,
+    THREAD_ROLE_BROADCAST,
+    THREAD_ROLE_COUNT
+} ThreadRole;
+
+#define TOPOLOGY_ROLE(role) (1u << (role))
+
+typedef struct {
+    int available_cpus;
+    int quota_cpus;
+    int effective_cpus;
+
+    int worker_threads;
+    int sender_threads;
+    int max_epoll_events;
+
+    int pin_threads;
+    char nic_device[32];
+
+    // Placement order: IRQ CPUs first, then the rest of their NUMA node, then other nodes.
+    int placement[TOPOLOGY_MAX_CPUS];
+    int placement_count;
+    int irq_cpu_count;
+
+    // This process' slice of the placement (<PROCESS>_CPU_SLOTS), split into one range per role.
+    char process[16];
+    int slot_first;
+    int slot_count;
+    int role_first[THREAD_ROLE_COUNT];
+    int role_count[THREAD_ROLE_COUNT];
+} Topology;
+
+extern Topology g_topology;
+
+void topology_init(const char* process);
+
+int topology_parse_config(const char* key, const char* value);
+
+void topology_load_config_file(const char* filename);
+
+void topology_finalize(unsigned roles);
+
+int topology_pin_current_thread(ThreadRole role, int index);
+
+#endif
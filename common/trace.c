@@ -0,0 +1,292 @@
+#define _GNU_SOURCE
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <pthread.h>
+
+typedef struct {
+    uint64_t seq;
+    TraceRecord rec;
+} TraceSlot;
+
+typedef struct {
+    const char* name;
+    TracePoint from;
+    TracePoint to;
+    int backend;
+} TraceSpan;
+
+typedef struct {
+    char* data;
+    size_t len;
+    size_t cap;
+} TraceBuffer;
+
+volatile sig_atomic_t g_trace_dump_requested = 0;
+
+static int g_sample_rate = 0;
+static uint64_t g_sample_counter = 0;
+static uint64_t g_next_id = 0;
+static uint64_t g_ring_head = 0;
+static TraceSlot g_ring[TRACE_RING_SIZE];
+
+static const char* g_route_names[] = { "NONE", "STATIC", "CGI", "PROXY", "INTERNAL" };
+
+static const TraceSpan g_spans[] = {
+    { "read", TRACE_ACCEPT, TRACE_HEADER_COMPLETE, 0 },
+    { "queue", TRACE_ENQUEUE, TRACE_DEQUEUE, 0 },
+    { "route", TRACE_DEQUEUE, TRACE_ROUTE, 0 },
+    { "handle", TRACE_ROUTE, TRACE_FIRST_WRITE, 0 },
+    { "write", TRACE_FIRST_WRITE, TRACE_CLOSE, 0 },
+    { "cgi_spawn", TRACE_CGI_FORK, TRACE_CGI_EXEC, 1 },
+    { "cgi_run", TRACE_CGI_EXEC, TRACE_CGI_EXIT, 1 },
+    { "proxy_connect", TRACE_PROXY_CONNECT_START, TRACE_PROXY_CONNECT, 1 },
+    { "upstream_first_byte", TRACE_PROXY_CONNECT, TRACE_PROXY_FIRST_BYTE, 1 }
+};
+
+void trace_set_sample_rate(int one_in) {
+    __atomic_store_n(&g_sample_rate, one_in < 0 ? 0 : one_in, __ATOMIC_RELAXED);
+
+    printf("Config: Tracing %s (1 in %d requests)\n", one_in > 0 ? "enabled" : "disabled", one_in);
+}
+
+TraceRecord* trace_maybe_start(int fd, uint64_t accept_ns, uint64_t header_ns) {
+    int rate = __atomic_load_n(&g_sample_rate, __ATOMIC_RELAXED);
+
+    if (rate <= 0) {
+        return NULL;
+    }
+
+    if (__atomic_fetch_add(&g_sample_counter, 1, __ATOMIC_RELAXED) % (uint64_t)rate != 0) {
+        return NULL;
+    }
+
+    TraceRecord* rec = (TraceRecord*)calloc(1, sizeof(TraceRecord));
+
+    if (!rec) {
+        return NULL;
+    }
+
+    rec->id = __atomic_add_fetch(&g_next_id, 1, __ATOMIC_RELAXED);
+    rec->fd = fd;
+    rec->ts[TRACE_ACCEPT] = accept_ns;
+    rec->ts[TRACE_HEADER_COMPLETE] = header_ns;
+
+    return rec;
+}
+
+void trace_set_route(TraceRecord* rec, TraceRoute route, const char* path) {
+    if (!rec) {
+        return;
+    }
+
+    trace_point(rec, TRACE_ROUTE);
+
+    rec->route = route;
+
+    size_t i = 0;
+
+    for (; path[i] && i < sizeof(rec->path) - 1; i++) {
+        unsigned char c = (unsigned char)path[i];
+
+        rec->path[i] = (c < 0x20 || c == '"' || c == '\\') ? '_' : (char)c;
+    }
+
+    rec->path[i] = '\0';
+}
+
+void trace_commit(TraceRecord* rec) {
+    if (!rec) {
+        return;
+    }
+
+    trace_point(rec, TRACE_CLOSE);
+
+    uint64_t ticket = __atomic_fetch_add(&g_ring_head, 1, __ATOMIC_RELAXED);
+    TraceSlot* slot = &g_ring[ticket % TRACE_RING_SIZE];
+
+    __atomic_store_n(&slot->seq, ticket * 2 + 1, __ATOMIC_RELEASE);
+
+    memcpy(&slot->rec, rec, sizeof(TraceRecord));
+
+    __atomic_store_n(&slot->seq, ticket * 2 + 2, __ATOMIC_RELEASE);
+
+    free(rec);
+}
+
+static int buffer_append(TraceBuffer* b, const char* fmt, ...) {
+    while (1) {
+        va_list args;
+
+        va_start(args, fmt);
+
+        int n = vsnprintf(b->data + b->len, b->cap - b->len, fmt, args);
+
+        va_end(args);
+
+        if (n < 0) {
+            return -1;
+        }
+
+        if ((size_t)n < b->cap - b->len) {
+            b->len += (size_t)n;
+
+            return 0;
+        }
+
+        size_t new_cap = b->cap * 2 + (size_t)n;
+        char* grown = (char*)realloc(b->data, new_cap);
+
+        if (!grown) {
+            return -1;
+        }
+
+        b->data = grown;
+        b->cap = new_cap;
+    }
+}
+
+static void render_record(TraceBuffer* b, const TraceRecord* rec, int* first) {
+    int pid = (int)getpid();
+    uint64_t track = rec->id * 2;
+
+    buffer_append(b, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %llu, \"args\": {\"name\": \"req %llu %s %s\"}}",
+                  *first ? "" : ",\n", pid, (unsigned long long)track, (unsigned long long)rec->id,
+                  g_route_names[rec->route], rec->path);
+
+    *first = 0;
+
+    if (rec->ts[TRACE_ACCEPT] && rec->ts[TRACE_CLOSE]) {
+        buffer_append(b, ",\n{\"name\": \"request\", \"cat\": \"request\", \"ph\": \"X\", \"pid\": %d, \"tid\": %llu, \"ts\": %.3f, \"dur\": %.3f, "
+                         "\"args\": {\"fd\": %d, \"route\": \"%s\", \"path\": \"%s\"}}",
+                      pid, (unsigned long long)track,
+                      rec->ts[TRACE_ACCEPT] / 1000.0,
+                      (rec->ts[TRACE_CLOSE] - rec->ts[TRACE_ACCEPT]) / 1000.0,
+                      rec->fd, g_route_names[rec->route], rec->path);
+    }
+
+    for (size_t i = 0; i < sizeof(g_spans) / sizeof(g_spans[0]); i++) {
+        const TraceSpan* span = &g_spans[i];
+        uint64_t start = rec->ts[span->from];
+        uint64_t end = rec->ts[span->to];
+
+        if (start == 0 || end == 0 || end < start) {
+            continue;
+        }
+
+        buffer_append(b, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %llu, \"ts\": %.3f, \"dur\": %.3f}",
+                      span->name, span->backend ? "backend" : "stage", pid,
+                      (unsigned long long)(track + span->backend),
+                      start / 1000.0, (end - start) / 1000.0);
+    }
+}
+
+char* trace_render_chrome(size_t* out_len) {
+    TraceBuffer b;
+    b.cap = 64 * 1024;
+    b.len = 0;
+    b.data = (char*)malloc(b.cap);
+
+    if (!b.data) {
+        return NULL;
+    }
+
+    buffer_append(&b, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+
+    uint64_t head = __atomic_load_n(&g_ring_head, __ATOMIC_ACQUIRE);
+    uint64_t oldest = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+    int first = 1;
+    TraceRecord copy;
+
+    for (uint64_t ticket = oldest; ticket < head; ticket++) {
+        TraceSlot* slot = &g_ring[ticket % TRACE_RING_SIZE];
+        uint64_t before = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+        if (before != ticket * 2 + 2) {
+            continue;
+        }
+
+        memcpy(&copy, &slot->rec, sizeof(copy));
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != before) {
+            continue;
+        }
+
+        render_record(&b, &copy, &first);
+    }
+
+    buffer_append(&b, "\n]}\n");
+
+    *out_len = b.len;
+
+    return b.data;
+}
+
+int trace_dump_file(void) {
+    char filename[128];
+    size_t len = 0;
+
+    snprintf(filename, sizeof(filename), "trace-%d-%ld.json", (int)getpid(), (long)time(NULL));
+
+    char* json = trace_render_chrome(&len);
+
+    if (!json) {
+        return -1;
+    }
+
+    FILE* file = fopen(filename, "w");
+
+    if (!file) {
+        perror("trace: fopen");
+
+        free(json);
+
+        return -1;
+    }
+
+    fwrite(json, 1, len, file);
+    fclose(file);
+    free(json);
+
+    printf("Trace: Dumped %zu bytes to %s\n", len, filename);
+
+    return 0;
+}
+
+static void trace_signal_handler(int signo) {
+    (void)signo;
+
+    g_trace_dump_requested = 1;
+}
+
+void trace_install_signal(void) {
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+
+    sa.sa_handler = trace_signal_handler;
+
+    sigemptyset(&sa.sa_mask);
+
+    if (sigaction(SIGUSR2, &sa, NULL) < 0) {
+        perror("trace: sigaction");
+    }
+}
+
+void trace_signal_mask(int how) {
+    sigset_t set;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR2);
+
+    pthread_sigmask(how, &set, NULL);
+}
+
+int trace_is_trace_path(const char* requested_path) {
+    return strcmp(requested_path, "/__trace") == 0;
+}
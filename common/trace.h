@@ -0,0 +1,71 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <signal.h>
+#include "metrics.h"
+
+#define TRACE_RING_SIZE 4096
+#define TRACE_PATH_LEN 64
+
+typedef enum {
+    TRACE_ACCEPT,
+    TRACE_HEADER_COMPLETE,
+    TRACE_ENQUEUE,
+    TRACE_DEQUEUE,
+    TRACE_ROUTE,
+    TRACE_FIRST_WRITE,
+    TRACE_CLOSE,
+    TRACE_CGI_FORK,
+    TRACE_CGI_EXEC,
+    TRACE_CGI_EXIT,
+    TRACE_PROXY_CONNECT_START,
+    TRACE_PROXY_CONNECT,
+    TRACE_PROXY_FIRST_BYTE,
+    TRACE_POINT_COUNT
+} TracePoint;
+
+typedef enum {
+    TRACE_ROUTE_NONE,
+    TRACE_ROUTE_STATIC,
+    TRACE_ROUTE_CGI,
+    TRACE_ROUTE_PROXY,
+    TRACE_ROUTE_INTERNAL
+} TraceRoute;
+
+typedef struct {
+    uint64_t id;
+    int fd;
+    TraceRoute route;
+    char path[TRACE_PATH_LEN];
+    uint64_t ts[TRACE_POINT_COUNT];
+} TraceRecord;
+
+extern volatile sig_atomic_t g_trace_dump_requested;
+
+void trace_set_sample_rate(int one_in);
+
+TraceRecord* trace_maybe_start(int fd, uint64_t accept_ns, uint64_t header_ns);
+
+static inline void trace_point(TraceRecord* rec, TracePoint point) {
+    if (rec && rec->ts[point] == 0) {
+        rec->ts[point] = metrics_now_ns();
+    }
+}
+
+void trace_set_route(TraceRecord* rec, TraceRoute route, const char* path);
+
+void trace_commit(TraceRecord* rec);
+
+char* trace_render_chrome(size_t* out_len);
+
+int trace_dump_file(void);
+
+void trace_install_signal(void);
+
+void trace_signal_mask(int how);
+
+int trace_is_trace_path(const char* requested_path);
+
+#endif
@@ -0,0 +1,108 @@
+#define _GNU_SOURCE
+#include "unixsock.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+
+// Returns the filesystem path of a "unix:/path" target, or NULL for anything else.
+const char* unixsock_path(const char* target) {
+    if (strncmp(target, UNIXSOCK_PREFIX, strlen(UNIXSOCK_PREFIX)) != 0) {
+        return NULL;
+    }
+
+    return target + strlen(UNIXSOCK_PREFIX);
+}
+
+int unixsock_fill_addr(const char* path, struct sockaddr_storage* addr, socklen_t* addr_len) {
+    struct sockaddr_un* un = (struct sockaddr_un*)addr;
+
+    if (strlen(path) >= sizeof(un->sun_path)) {
+        fprintf(stderr, "unixsock: path too long: %s\n", path);
+
+        return -1;
+    }
+
+    memset(un, 0, sizeof(*un));
+
+    un->sun_family = AF_UNIX;
+
+    strcpy(un->sun_path, path);
+
+    *addr_len = (socklen_t)sizeof(*un);
+
+    return 0;
+}
+
+int unixsock_listen(const char* path, int backlog) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+
+    if (unixsock_fill_addr(path, &addr, &addr_len) < 0) {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (fd < 0) {
+        perror("unixsock: socket");
+
+        return -1;
+    }
+
+    // A socket file left behind by a previous run would make bind fail with EADDRINUSE.
+    struct stat st;
+
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+
+    if (bind(fd, (struct sockaddr*)&addr, addr_len) < 0) {
+        perror("unixsock: bind");
+
+        close(fd);
+
+        return -1;
+    }
+
+    if (listen(fd, backlog) < 0) {
+        perror("unixsock: listen");
+
+        close(fd);
+
+        return -1;
+    }
+
+    return fd;
+}
+
+int unixsock_connect(const char* path) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+
+    if (unixsock_fill_addr(path, &addr, &addr_len) < 0) {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd < 0) {
+        perror("unixsock: socket");
+
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr*)&addr, addr_len) < 0) {
+        int saved = errno;
+
+        close(fd);
+
+        errno = saved;
+
+        return -1;
+    }
+
+    return fd;
+}
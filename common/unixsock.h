@@ -0,0 +1,16 @@
+#ifndef UNIXSOCK_H
+#define UNIXSOCK_H
+
+#include <sys/socket.h>
+
+#define UNIXSOCK_PREFIX "unix:"
+
+const char* unixsock_path(const char* target);
+
+int unixsock_fill_addr(const char* path, struct sockaddr_storage* addr, socklen_t* addr_len);
+
+int unixsock_listen(const char* path, int backlog);
+
+int unixsock_connect(const char* path);
+
+#endif
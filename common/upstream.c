@@ -0,0 +1,864 @@
+#define _GNU_SOURCE
+#include "upstream.h"
+#include "metrics.h"
+#include "unixsock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+
+#define DEFAULT_MAX_IDLE 32
+#define DEFAULT_IDLE_TIMEOUT_SEC 30
+#define DEFAULT_MAX_CONNECTING 64
+#define RESPONSE_HEAD_MAX 4096
+#define DEFAULT_HEALTH_INTERVAL_SEC 5
+#define DEFAULT_HEALTH_MAX_FAILS 3
+#define DEFAULT_HEALTH_EJECT_SEC 30
+#define UNIX_BACKLOG_RETRIES 3
+#define UNIX_BACKLOG_RETRY_NS 1000000L
+
+static Upstream g_upstreams[MAX_UPSTREAMS];
+static int g_upstream_count = 0;
+static pthread_mutex_t g_registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int g_max_idle = DEFAULT_MAX_IDLE;
+static int g_idle_timeout_sec = DEFAULT_IDLE_TIMEOUT_SEC;
+static int g_max_connecting = DEFAULT_MAX_CONNECTING;
+
+static int g_health_interval_sec = DEFAULT_HEALTH_INTERVAL_SEC;
+static int g_health_max_fails = DEFAULT_HEALTH_MAX_FAILS;
+static int g_health_eject_sec = DEFAULT_HEALTH_EJECT_SEC;
+static int g_health_epfd = -1;
+
+static void upstream_metrics_source(MetricsWriter* w) {
+    metrics_write_value(w, "upstream_pool_max_idle", "Idle upstream connections kept per upstream", (uint64_t)g_max_idle);
+    metrics_write_value(w, "upstream_pool_idle_timeout_seconds", "Idle upstream connection lifetime", (uint64_t)g_idle_timeout_sec);
+
+    int count = __atomic_load_n(&g_upstream_count, __ATOMIC_ACQUIRE);
+
+    for (int i = 0; i < count; i++) {
+        Upstream* up = &g_upstreams[i];
+
+        pthread_mutex_lock(&up->mutex);
+
+        metrics_write_labeled(w, "upstream_idle", "upstream", up->name, (uint64_t)up->idle_count);
+        metrics_write_labeled(w, "upstream_active", "upstream", up->name, (uint64_t)up->active);
+        metrics_write_labeled(w, "upstream_connecting", "upstream", up->name, (uint64_t)up->connecting);
+        metrics_write_labeled(w, "upstream_connects_started_total", "upstream", up->name, up->connects_started);
+        metrics_write_labeled(w, "upstream_connects_ok_total", "upstream", up->name, up->connects_ok);
+        metrics_write_labeled(w, "upstream_connects_failed_total", "upstream", up->name, up->connects_failed);
+        metrics_write_labeled(w, "upstream_connects_rejected_total", "upstream", up->name, up->connects_rejected);
+        metrics_write_labeled(w, "upstream_connects_backlog_full_total", "upstream", up->name, up->connects_backlog_full);
+        metrics_write_labeled(w, "upstream_reuses_total", "upstream", up->name, up->reuses);
+        metrics_write_labeled(w, "upstream_released_idle_total", "upstream", up->name, up->released_idle);
+        metrics_write_labeled(w, "upstream_closed_stale_total", "upstream", up->name, up->closed_stale);
+        metrics_write_labeled(w, "upstream_closed_expired_total", "upstream", up->name, up->closed_expired);
+        metrics_write_labeled(w, "upstream_healthy", "upstream", up->name, up->ejected_until <= metrics_now_ns() ? 1 : 0);
+        metrics_write_labeled(w, "upstream_ejections_total", "upstream", up->name, up->ejections);
+        metrics_write_labeled(w, "upstream_probes_failed_total", "upstream", up->name, up->probes_failed);
+
+        pthread_mutex_unlock(&up->mutex);
+    }
+}
+
+int upstream_parse_config(const char* key, const char* value) {
+    if (strcmp(key, "UPSTREAM_MAX_IDLE") == 0) {
+        g_max_idle = atoi(value);
+
+        if (g_max_idle > UPSTREAM_IDLE_SLOTS) {
+            g_max_idle = UPSTREAM_IDLE_SLOTS;
+        }
+    }
+    else if (strcmp(key, "UPSTREAM_IDLE_TIMEOUT") == 0) {
+        g_idle_timeout_sec = atoi(value);
+    }
+    else if (strcmp(key, "UPSTREAM_MAX_CONNECTING") == 0) {
+        g_max_connecting = atoi(value);
+    }
+    else if (strcmp(key, "HEALTH_CHECK_INTERVAL") == 0) {
+        g_health_interval_sec = atoi(value);
+    }
+    else if (strcmp(key, "HEALTH_MAX_FAILS") == 0) {
+        g_health_max_fails = atoi(value);
+    }
+    else if (strcmp(key, "HEALTH_EJECT_TIME") == 0) {
+        g_health_eject_sec = atoi(value);
+    }
+    else {
+        return -1;
+    }
+
+    printf("Config: Upstream %s = %s\n", key, value);
+
+    return 0;
+}
+
+static int resolve_target(Upstream* up, const char* target) {
+    const char* path = unixsock_path(target);
+
+    if (path) {
+        return unixsock_fill_addr(path, &up->addr, &up->addr_len);
+    }
+
+    char host[128] = "127.0.0.1";
+    char port[16] = "80";
+    const char* scheme = strstr(target, "://");
+    const char* host_start = scheme ? scheme + 3 : target;
+    const char* colon = strrchr(host_start, ':');
+    size_t host_len = colon ? (size_t)(colon - host_start) : strcspn(host_start, "/");
+
+    if (host_len > 0 && host_len < sizeof(host)) {
+        memcpy(host, host_start, host_len);
+
+        host[host_len] = '\0';
+    }
+
+    if (colon) {
+        snprintf(port, sizeof(port), "%d", atoi(colon + 1));
+    }
+
+    struct addrinfo hints;
+    struct addrinfo* result = NULL;
+
+    memset(&hints, 0, sizeof(hints));
+
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int rc = getaddrinfo(host, port, &hints, &result);
+
+    if (rc != 0 || !result) {
+        fprintf(stderr, "upstream: cannot resolve %s:%s (%s)\n", host, port, gai_strerror(rc));
+
+        return -1;
+    }
+
+    memcpy(&up->addr, result->ai_addr, result->ai_addrlen);
+
+    up->addr_len = result->ai_addrlen;
+
+    freeaddrinfo(result);
+
+    return 0;
+}
+
+Upstream* upstream_get(const char* target) {
+    pthread_mutex_lock(&g_registry_mutex);
+
+    for (int i = 0; i < g_upstream_count; i++) {
+        if (strcmp(g_upstreams[i].name, target) == 0) {
+            pthread_mutex_unlock(&g_registry_mutex);
+
+            return &g_upstreams[i];
+        }
+    }
+
+    if (g_upstream_count >= MAX_UPSTREAMS) {
+        pthread_mutex_unlock(&g_registry_mutex);
+
+        fprintf(stderr, "upstream: Exceeded MAX_UPSTREAMS\n");
+
+        return NULL;
+    }
+
+    Upstream* up = &g_upstreams[g_upstream_count];
+
+    memset(up, 0, sizeof(*up));
+    strncpy(up->name, target, sizeof(up->name) - 1);
+    pthread_mutex_init(&up->mutex, NULL);
+
+    up->probe_fd = -1;
+
+    if (resolve_target(up, target) < 0) {
+        pthread_mutex_destroy(&up->mutex);
+        pthread_mutex_unlock(&g_registry_mutex);
+
+        return NULL;
+    }
+
+    if (g_upstream_count == 0) {
+        metrics_register_source(upstream_metrics_source);
+    }
+
+    __atomic_store_n(&g_upstream_count, g_upstream_count + 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&g_registry_mutex);
+
+    return up;
+}
+
+int upstream_acquire(Upstream* up, int* reused) {
+    *reused = 0;
+
+    pthread_mutex_lock(&up->mutex);
+
+    while (up->idle_count > 0) {
+        int fd = up->idle_fds[--up->idle_count];
+        char probe;
+        ssize_t n = recv(fd, &probe, 1, MSG_PEEK | MSG_DONTWAIT);
+
+        // An idle keep-alive connection must be silent; EOF or stray bytes mean it is unusable.
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            up->reuses++;
+            up->active++;
+
+            pthread_mutex_unlock(&up->mutex);
+
+            *reused = 1;
+
+            return fd;
+        }
+
+        close(fd);
+
+        up->closed_stale++;
+    }
+
+    if (g_max_connecting > 0 && up->connecting >= g_max_connecting) {
+        up->connects_rejected++;
+
+        pthread_mutex_unlock(&up->mutex);
+
+        errno = EAGAIN;
+
+        return -1;
+    }
+
+    up->connecting++;
+    up->connects_started++;
+
+    pthread_mutex_unlock(&up->mutex);
+
+    int fd;
+
+    for (int attempt = 0; ; attempt++) {
+        fd = socket(up->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+        if (fd < 0) {
+            perror("upstream: socket");
+
+            upstream_connect_done(up, 0);
+
+            return -1;
+        }
+
+        if (connect(fd, (struct sockaddr*)&up->addr, up->addr_len) == 0 || errno == EINPROGRESS) {
+            return fd;
+        }
+
+        // A Unix socket listener with a full backlog fails with EAGAIN instead of EINPROGRESS:
+        // the backend is alive but behind, so retry briefly and never count it as a failure.
+        if (up->addr.ss_family != AF_UNIX || errno != EAGAIN) {
+            break;
+        }
+
+        close(fd);
+
+        if (attempt == UNIX_BACKLOG_RETRIES) {
+            pthread_mutex_lock(&up->mutex);
+
+            up->connecting--;
+            up->connects_backlog_full++;
+
+            pthread_mutex_unlock(&up->mutex);
+
+            errno = EBUSY;
+
+            return -1;
+        }
+
+        struct timespec pause = { 0, UNIX_BACKLOG_RETRY_NS * (attempt + 1) };
+
+        nanosleep(&pause, NULL);
+    }
+
+    int saved = errno;
+
+    perror("upstream: connect");
+
+    close(fd);
+
+    upstream_connect_done(up, 0);
+
+    errno = saved;
+
+    return -1;
+}
+
+// Caller holds up->mutex.
+static void record_health(Upstream* up, int ok) {
+    if (ok) {
+        up->consecutive_failures = 0;
+
+        return;
+    }
+
+    up->consecutive_failures++;
+
+    if (g_health_max_fails <= 0 || up->consecutive_failures < g_health_max_fails) {
+        return;
+    }
+
+    uint64_t now = metrics_now_ns();
+
+    if (up->ejected_until <= now) {
+        up->ejections++;
+
+        printf("Upstream: Ejecting %s for %d s after %d failures\n", up->name, g_health_eject_sec, up->consecutive_failures);
+    }
+
+    __atomic_store_n(&up->ejected_until, now + (uint64_t)g_health_eject_sec * 1000000000ull, __ATOMIC_RELAXED);
+
+    up->consecutive_failures = 0;
+}
+
+void upstream_connect_done(Upstream* up, int ok) {
+    pthread_mutex_lock(&up->mutex);
+
+    up->connecting--;
+
+    if (ok) {
+        up->connects_ok++;
+        up->active++;
+    }
+    else {
+        up->connects_failed++;
+    }
+
+    record_health(up, ok);
+
+    pthread_mutex_unlock(&up->mutex);
+}
+
+void upstream_release(Upstream* up, int fd, int reusable) {
+    pthread_mutex_lock(&up->mutex);
+
+    up->active--;
+
+    if (reusable && up->idle_count < g_max_idle && up->idle_count < UPSTREAM_IDLE_SLOTS) {
+        up->idle_fds[up->idle_count] = fd;
+        up->idle_since[up->idle_count] = metrics_now_ns();
+        up->idle_count++;
+        up->released_idle++;
+
+        pthread_mutex_unlock(&up->mutex);
+
+        return;
+    }
+
+    pthread_mutex_unlock(&up->mutex);
+
+    close(fd);
+}
+
+void upstream_expire_idle(void) {
+    uint64_t now = metrics_now_ns();
+    uint64_t timeout = (uint64_t)g_idle_timeout_sec * 1000000000ull;
+    int count = __atomic_load_n(&g_upstream_count, __ATOMIC_ACQUIRE);
+
+    for (int i = 0; i < count; i++) {
+        Upstream* up = &g_upstreams[i];
+        int kept = 0;
+
+        pthread_mutex_lock(&up->mutex);
+
+        for (int j = 0; j < up->idle_count; j++) {
+            if (now - up->idle_since[j] > timeout) {
+                close(up->idle_fds[j]);
+
+                up->closed_expired++;
+
+                continue;
+            }
+
+            up->idle_fds[kept] = up->idle_fds[j];
+            up->idle_since[kept] = up->idle_since[j];
+            kept++;
+        }
+
+        up->idle_count = kept;
+
+        pthread_mutex_unlock(&up->mutex);
+    }
+}
+
+static uint32_t fnv1a(const void* data, size_t len, uint32_t hash) {
+    const unsigned char* p = (const unsigned char*)data;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static int compare_points(const void* a, const void* b) {
+    uint32_t ha = ((const HashPoint*)a)->hash;
+    uint32_t hb = ((const HashPoint*)b)->hash;
+
+    return (ha > hb) - (ha < hb);
+}
+
+static void build_hash_ring(UpstreamGroup* group) {
+    int total = 0;
+
+    for (int i = 0; i < group->count; i++) {
+        total += group->weights[i] * HASH_POINTS_PER_WEIGHT;
+    }
+
+    free(group->ring);
+
+    group->ring = (HashPoint*)malloc(sizeof(HashPoint) * total);
+    group->ring_size = 0;
+
+    if (!group->ring) {
+        return;
+    }
+
+    for (int i = 0; i < group->count; i++) {
+        for (int v = 0; v < group->weights[i] * HASH_POINTS_PER_WEIGHT; v++) {
+            char key[300];
+            int len = snprintf(key, sizeof(key), "%s#%d", group->backends[i]->name, v);
+
+            group->ring[group->ring_size].hash = fnv1a(key, (size_t)len, 2166136261u);
+            group->ring[group->ring_size].backend = i;
+            group->ring_size++;
+        }
+    }
+
+    qsort(group->ring, group->ring_size, sizeof(HashPoint), compare_points);
+}
+
+// spec is a comma-separated backend list, each optionally suffixed with =weight.
+UpstreamGroup* upstream_group_create(const char* spec) {
+    UpstreamGroup* group = (UpstreamGroup*)calloc(1, sizeof(UpstreamGroup));
+    char list[256];
+    char* save = NULL;
+
+    if (!group) {
+        return NULL;
+    }
+
+    strncpy(list, spec, sizeof(list) - 1);
+
+    list[sizeof(list) - 1] = '\0';
+
+    for (char* item = strtok_r(list, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+        int weight = 1;
+        char* eq = strrchr(item, '=');
+
+        if (eq) {
+            *eq = '\0';
+            weight = atoi(eq + 1);
+
+            if (weight < 1) {
+                weight = 1;
+            }
+        }
+
+        if (group->count >= MAX_GROUP_BACKENDS) {
+            fprintf(stderr, "upstream: Exceeded MAX_GROUP_BACKENDS in %s\n", spec);
+
+            break;
+        }
+
+        Upstream* up = upstream_get(item);
+
+        if (!up) {
+            continue;
+        }
+
+        group->backends[group->count] = up;
+        group->weights[group->count] = weight;
+        group->count++;
+
+        printf("Config: Backend %s (weight %d)\n", up->name, weight);
+    }
+
+    if (group->count == 0) {
+        free(group);
+
+        return NULL;
+    }
+
+    return group;
+}
+
+int upstream_group_set_balance(UpstreamGroup* group, const char* mode) {
+    if (strcmp(mode, "least_conn") == 0) {
+        group->mode = BALANCE_LEAST_CONN;
+    }
+    else if (strcmp(mode, "ip_hash") == 0) {
+        group->mode = BALANCE_IP_HASH;
+
+        build_hash_ring(group);
+    }
+    else {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int backend_available(Upstream* up, uint64_t now) {
+    return __atomic_load_n(&up->ejected_until, __ATOMIC_RELAXED) <= now;
+}
+
+uint32_t upstream_client_hash(const struct sockaddr* addr) {
+    if (addr->sa_family == AF_INET6) {
+        const struct in6_addr* ip = &((const struct sockaddr_in6*)addr)->sin6_addr;
+
+        // The dual-stack listener sees IPv4 clients as ::ffff:a.b.c.d.
+        if (IN6_IS_ADDR_V4MAPPED(ip)) {
+            return fnv1a(&ip->s6_addr[12], 4, 2166136261u);
+        }
+
+        return fnv1a(ip, sizeof(*ip), 2166136261u);
+    }
+
+    if (addr->sa_family == AF_INET) {
+        const struct in_addr* ip = &((const struct sockaddr_in*)addr)->sin_addr;
+
+        return fnv1a(ip, sizeof(*ip), 2166136261u);
+    }
+
+    return 0;
+}
+
+Upstream* upstream_group_pick(UpstreamGroup* group, uint32_t client_hash) {
+    uint64_t now = metrics_now_ns();
+    int healthy = 0;
+
+    for (int i = 0; i < group->count; i++) {
+        healthy += backend_available(group->backends[i], now);
+    }
+
+    // With every backend ejected, trying one beats failing every request outright.
+    int ignore_health = (healthy == 0);
+
+    if (group->mode == BALANCE_IP_HASH && group->ring_size > 0) {
+        uint32_t hash = client_hash;
+        int low = 0;
+        int high = group->ring_size;
+
+        while (low < high) {
+            int mid = (low + high) / 2;
+
+            if (group->ring[mid].hash < hash) {
+                low = mid + 1;
+            }
+            else {
+                high = mid;
+            }
+        }
+
+        for (int k = 0; k < group->ring_size; k++) {
+            Upstream* up = group->backends[group->ring[(low + k) % group->ring_size].backend];
+
+            if (ignore_health || backend_available(up, now)) {
+                return up;
+            }
+        }
+    }
+
+    // Weighted least connections; the rotating start spreads ties across backends.
+    Upstream* best = NULL;
+    uint64_t best_load = 0;
+    uint64_t best_weight = 1;
+    unsigned int start = __atomic_fetch_add(&group->next, 1, __ATOMIC_RELAXED);
+
+    for (int k = 0; k < group->count; k++) {
+        int i = (int)((start + k) % group->count);
+        Upstream* up = group->backends[i];
+
+        if (!ignore_health && !backend_available(up, now)) {
+            continue;
+        }
+
+        uint64_t load = (uint64_t)__atomic_load_n(&up->active, __ATOMIC_RELAXED) + (uint64_t)__atomic_load_n(&up->connecting, __ATOMIC_RELAXED);
+
+        if (!best || load * best_weight < best_load * (uint64_t)group->weights[i]) {
+            best = up;
+            best_load = load;
+            best_weight = (uint64_t)group->weights[i];
+        }
+    }
+
+    return best;
+}
+
+static void finish_probe(Upstream* up, int ok) {
+    epoll_ctl(g_health_epfd, EPOLL_CTL_DEL, up->probe_fd, NULL);
+
+    close(up->probe_fd);
+
+    up->probe_fd = -1;
+
+    pthread_mutex_lock(&up->mutex);
+
+    if (!ok) {
+        up->probes_failed++;
+    }
+
+    record_health(up, ok);
+
+    pthread_mutex_unlock(&up->mutex);
+}
+
+static void start_probe(Upstream* up, uint64_t now) {
+    int fd = socket(up->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    up->probe_started = now;
+
+    if (fd < 0) {
+        return;
+    }
+
+    up->probe_fd = fd;
+
+    if (connect(fd, (struct sockaddr*)&up->addr, up->addr_len) == 0) {
+        finish_probe(up, 1);
+
+        return;
+    }
+
+    if (up->addr.ss_family == AF_UNIX && errno == EAGAIN) {
+        // Full accept backlog: busy, not down. Drop the probe without touching the health state.
+        close(fd);
+
+        up->probe_fd = -1;
+
+        return;
+    }
+
+    if (errno != EINPROGRESS) {
+        finish_probe(up, 0);
+
+        return;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLOUT;
+    ev.data.ptr = up;
+
+    if (epoll_ctl(g_health_epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        finish_probe(up, 0);
+    }
+}
+
+// Runs from the event loop about once a second. Probes are plain connects (TCP or Unix socket),
+// so they work for every backend type; results are collected on the next tick without blocking.
+void upstream_health_tick(void) {
+    if (g_health_interval_sec <= 0) {
+        return;
+    }
+
+    if (g_health_epfd < 0) {
+        g_health_epfd = epoll_create1(EPOLL_CLOEXEC);
+
+        if (g_health_epfd < 0) {
+            perror("upstream: epoll_create1");
+
+            g_health_interval_sec = 0;
+
+            return;
+        }
+    }
+
+    struct epoll_event events[MAX_UPSTREAMS];
+    int n = epoll_wait(g_health_epfd, events, MAX_UPSTREAMS, 0);
+
+    for (int i = 0; i < n; i++) {
+        Upstream* up = (Upstream*)events[i].data.ptr;
+
+        finish_probe(up, upstream_finish_connect(up->probe_fd) == 0);
+    }
+
+    uint64_t now = metrics_now_ns();
+    uint64_t interval = (uint64_t)g_health_interval_sec * 1000000000ull;
+    int count = __atomic_load_n(&g_upstream_count, __ATOMIC_ACQUIRE);
+
+    for (int i = 0; i < count; i++) {
+        Upstream* up = &g_upstreams[i];
+
+        if (up->probe_fd >= 0) {
+            if (now - up->probe_started > interval) {
+                finish_probe(up, 0);
+            }
+
+            continue;
+        }
+
+        if (up->probe_started == 0 || now - up->probe_started >= interval) {
+            start_probe(up, now);
+        }
+    }
+}
+
+int upstream_finish_connect(int fd) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) {
+        return -1;
+    }
+
+    if (err != 0) {
+        errno = err;
+
+        return -1;
+    }
+
+    return 0;
+}
+
+void upstream_response_begin(UpstreamResponse* resp) {
+    resp->state = UPSTREAM_RESPONSE_HEADERS;
+    resp->remaining = 0;
+    resp->request_done = 1;
+    resp->head_request = 0;
+}
+
+static const char* find_header_line(const char* headers, const char* name) {
+    const char* p = headers;
+    size_t name_len = strlen(name);
+
+    while ((p = strstr(p, "\r\n")) != NULL) {
+        p += 2;
+
+        if (strncasecmp(p, name, name_len) == 0) {
+            p += name_len;
+
+            while (*p == ' ') {
+                p++;
+            }
+
+            return p;
+        }
+    }
+
+    return NULL;
+}
+
+void upstream_request_sent(UpstreamResponse* resp, const char* data, size_t len) {
+    const char* end = memmem(data, len, "\r\n\r\n", 4);
+    char head[RESPONSE_HEAD_MAX];
+
+    resp->request_done = 0;
+    resp->head_request = (len >= 5 && strncmp(data, "HEAD ", 5) == 0);
+
+    if (!end || (size_t)(end - data) + 4 > sizeof(head) - 1) {
+        return;
+    }
+
+    size_t head_len = (size_t)(end - data) + 4;
+
+    memcpy(head, data, head_len);
+
+    head[head_len] = '\0';
+
+    if (find_header_line(head, "Transfer-Encoding:")) {
+        return;
+    }
+
+    uint64_t content_length = 0;
+    const char* cl = find_header_line(head, "Content-Length:");
+
+    if (cl) {
+        content_length = strtoull(cl, NULL, 10);
+    }
+
+    // A body still on its way, or a pipelined request behind this one, would be read by the
+    // upstream as part of whatever the next pooled exchange sends.
+    resp->request_done = (len - head_len == content_length);
+}
+
+static int parse_response_head(UpstreamResponse* resp, const char* data, size_t len) {
+    const char* end = memmem(data, len, "\r\n\r\n", 4);
+    char head[RESPONSE_HEAD_MAX];
+
+    if (!end || (size_t)(end - data) + 4 > sizeof(head) - 1) {
+        resp->state = UPSTREAM_RESPONSE_UNFRAMED;
+
+        return 0;
+    }
+
+    size_t head_len = (size_t)(end - data) + 4;
+
+    memcpy(head, data, head_len);
+
+    head[head_len] = '\0';
+
+    int status = 0;
+    int minor = 0;
+
+    if (sscanf(head, "HTTP/1.%d %d", &minor, &status) != 2 || status < 200 || status == 101) {
+        resp->state = UPSTREAM_RESPONSE_UNFRAMED;
+
+        return 0;
+    }
+
+    const char* connection = find_header_line(head, "Connection:");
+
+    if ((connection && strncasecmp(connection, "close", 5) == 0) ||
+        (minor == 0 && !(connection && strncasecmp(connection, "keep-alive", 10) == 0))) {
+        resp->state = UPSTREAM_RESPONSE_UNFRAMED;
+
+        return 0;
+    }
+
+    uint64_t content_length = 0;
+
+    // These end at the header block whatever Content-Length or Transfer-Encoding they advertise.
+    if (!resp->head_request && status != 204 && status != 304) {
+        const char* cl = find_header_line(head, "Content-Length:");
+
+        if (find_header_line(head, "Transfer-Encoding:") || !cl) {
+            resp->state = UPSTREAM_RESPONSE_UNFRAMED;
+
+            return 0;
+        }
+
+        content_length = strtoull(cl, NULL, 10);
+    }
+
+    size_t body_in_chunk = len - head_len;
+
+    if (body_in_chunk > content_length) {
+        resp->state = UPSTREAM_RESPONSE_UNFRAMED;
+
+        return 0;
+    }
+
+    resp->state = UPSTREAM_RESPONSE_BODY;
+    resp->remaining = content_length - body_in_chunk;
+
+    return resp->remaining == 0 && resp->request_done;
+}
+
+int upstream_response_feed(UpstreamResponse* resp, const char* data, size_t len) {
+    if (resp->state == UPSTREAM_RESPONSE_UNFRAMED) {
+        return 0;
+    }
+
+    if (resp->state == UPSTREAM_RESPONSE_HEADERS) {
+        return parse_response_head(resp, data, len);
+    }
+
+    if (len > resp->remaining) {
+        resp->state = UPSTREAM_RESPONSE_UNFRAMED;
+
+        return 0;
+    }
+
+    resp->remaining -= len;
+
+    return resp->remaining == 0 && resp->request_done;
+}
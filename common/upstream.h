@@ -0,0 +1,116 @@
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#define MAX_UPSTREAMS 32
+#define UPSTREAM_IDLE_SLOTS 256
+#define MAX_GROUP_BACKENDS 16
+#define HASH_POINTS_PER_WEIGHT 40
+
+typedef struct Upstream {
+    char name[256];
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+
+    pthread_mutex_t mutex;
+    int idle_fds[UPSTREAM_IDLE_SLOTS];
+    uint64_t idle_since[UPSTREAM_IDLE_SLOTS];
+    int idle_count;
+    int connecting;
+    int active;
+
+    uint64_t connects_started;
+    uint64_t connects_ok;
+    uint64_t connects_failed;
+    uint64_t connects_rejected;
+    uint64_t connects_backlog_full;
+    uint64_t reuses;
+    uint64_t released_idle;
+    uint64_t closed_stale;
+    uint64_t closed_expired;
+
+    // Health: written by whichever thread sees a connect result, read lock-free by pickers.
+    int consecutive_failures;
+    uint64_t ejected_until;
+    uint64_t ejections;
+    uint64_t probes_failed;
+    int probe_fd;
+    uint64_t probe_started;
+} Upstream;
+
+typedef enum {
+    BALANCE_LEAST_CONN,
+    BALANCE_IP_HASH
+} BalanceMode;
+
+typedef struct {
+    uint32_t hash;
+    int backend;
+} HashPoint;
+
+typedef struct {
+    Upstream* backends[MAX_GROUP_BACKENDS];
+    int weights[MAX_GROUP_BACKENDS];
+    int count;
+    BalanceMode mode;
+    HashPoint* ring;
+    int ring_size;
+    unsigned int next;
+} UpstreamGroup;
+
+typedef enum {
+    UPSTREAM_RESPONSE_HEADERS,
+    UPSTREAM_RESPONSE_BODY,
+    UPSTREAM_RESPONSE_UNFRAMED
+} UpstreamResponseState;
+
+// Tracks framing of a relayed upstream response so the connection can go back to the pool.
+typedef struct {
+    UpstreamResponseState state;
+    uint64_t remaining;
+    int request_done;
+    int head_request;
+} UpstreamResponse;
+
+int upstream_parse_config(const char* key, const char* value);
+
+Upstream* upstream_get(const char* target);
+
+UpstreamGroup* upstream_group_create(const char* spec);
+
+int upstream_group_set_balance(UpstreamGroup* group, const char* mode);
+
+// Identity of a client for ip_hash: its address, with IPv4-mapped IPv6 folded to plain IPv4.
+uint32_t upstream_client_hash(const struct sockaddr* addr);
+
+Upstream* upstream_group_pick(UpstreamGroup* group, uint32_t client_hash);
+
+void upstream_health_tick(void);
+
+// Returns -1 with errno EAGAIN when the connect limit is hit, or EBUSY when a Unix socket
+// backend's accept backlog stays full; neither counts against the backend's health.
+int upstream_acquire(Upstream* up, int* reused);
+
+void upstream_connect_done(Upstream* up, int ok);
+
+void upstream_release(Upstream* up, int fd, int reusable);
+
+void upstream_expire_idle(void);
+
+int upstream_finish_connect(int fd);
+
+void upstream_response_begin(UpstreamResponse* resp);
+
+// Called with the bytes forwarded as the request. The exchange only counts as complete (and the
+// connection as poolable) if those bytes hold the whole request: no Transfer-Encoding, and any
+// Content-Length body entirely after the head.
+void upstream_request_sent(UpstreamResponse* resp, const char* data, size_t len);
+
+// data is only inspected while the response head is pending; after that only len is used.
+int upstream_response_feed(UpstreamResponse* resp, const char* data, size_t len);
+
+#endif
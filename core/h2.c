@@ -0,0 +1,1593 @@
+#include "server.h"
+#include <ctype.h>
+
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LEN 24
+
+#define H2_DATA 0x0
+#define H2_HEADERS 0x1
+#define H2_PRIORITY 0x2
+#define H2_RST_STREAM 0x3
+#define H2_SETTINGS 0x4
+#define H2_PUSH_PROMISE 0x5
+#define H2_PING 0x6
+#define H2_GOAWAY 0x7
+#define H2_WINDOW_UPDATE 0x8
+#define H2_CONTINUATION 0x9
+
+#define H2_FLAG_END_STREAM 0x1
+#define H2_FLAG_ACK 0x1
+#define H2_FLAG_END_HEADERS 0x4
+#define H2_FLAG_PADDED 0x8
+#define H2_FLAG_PRIORITY 0x20
+
+#define H2_NO_ERROR 0x0
+#define H2_PROTOCOL_ERROR 0x1
+#define H2_INTERNAL_ERROR 0x2
+#define H2_FLOW_CONTROL_ERROR 0x3
+#define H2_STREAM_CLOSED 0x5
+#define H2_FRAME_SIZE_ERROR 0x6
+#define H2_REFUSED_STREAM 0x7
+#define H2_COMPRESSION_ERROR 0x9
+
+#define H2_SETTINGS_HEADER_TABLE_SIZE 0x1
+#define H2_SETTINGS_ENABLE_PUSH 0x2
+#define H2_SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define H2_SETTINGS_INITIAL_WINDOW_SIZE 0x4
+#define H2_SETTINGS_MAX_FRAME_SIZE 0x5
+#define H2_SETTINGS_MAX_HEADER_LIST_SIZE 0x6
+
+typedef enum {
+    H2_STREAM_RECEIVING,
+    H2_STREAM_DISPATCHED,
+    H2_STREAM_PARKED
+} H2StreamPhase;
+
+// One request/response exchange. The stream's ClientState carries the request through the
+// ordinary handlers; the event loop owns it while RECEIVING or PARKED, a worker or the proxy
+// relay while DISPATCHED.
+typedef struct H2Stream {
+    uint32_t id;
+    struct H2Session* session;
+    ClientState* client;
+    struct H2Stream* next;
+    H2StreamPhase phase;
+
+    // Request: regular fields go straight into client->buffer, the request line is put in front once the block is decoded.
+    char method[16];
+    char path[1024];
+    char authority[256];
+    char cookie[1024];
+    size_t fields_len;
+    int seen_regular;
+    int malformed;
+    int too_large;
+    BufChain body;
+    size_t body_len;
+    uint64_t declared_len;
+    uint32_t recv_unacked;
+    int remote_closed;
+
+    // Response: the handler's HTTP/1.1 head is collected here and re-sent as a HEADERS frame.
+    char response_head[BUFFER_SIZE];
+    size_t response_head_len;
+    int head_sent;
+    int is_head;
+    int discard_body;
+    int chunked;
+    ChunkedDecoder chunk;
+
+    int64_t send_window;
+    size_t quota;
+    int woken;
+    int stalled;
+    int reset;
+    int ended;
+
+    uint32_t parent;
+    int weight;
+    uint64_t vtime;
+} H2Stream;
+
+typedef struct H2Session {
+    // Recursive: closing a stream from inside frame handling re-enters through the transport.
+    pthread_mutex_t mutex;
+    ClientState* conn;
+    int refs;
+    int dead;
+    int goaway;
+
+    uint8_t in[H2_FRAME_HEADER + H2_DEFAULT_FRAME_SIZE];
+    size_t in_len;
+    int preface_done;
+
+    HpackTable decoder;
+    HpackTable encoder;
+
+    // Header block being reassembled from HEADERS and CONTINUATION frames.
+    uint8_t header_block[H2_MAX_HEADER_BLOCK];
+    size_t header_block_len;
+    uint32_t header_stream;
+    int header_end_stream;
+    int header_trailers;
+    int header_refused;
+
+    H2Stream* streams;
+    int stream_count;
+    uint32_t last_stream_id;
+
+    int64_t send_window;
+    uint32_t recv_unacked;
+    uint32_t peer_initial_window;
+    uint32_t peer_max_frame;
+    uint64_t vtime;
+} H2Session;
+
+static int g_h2_enabled = 1;
+static int g_max_streams = H2_DEFAULT_MAX_STREAMS;
+static size_t g_max_body = H2_DEFAULT_MAX_BODY;
+static int g_streams_active = 0;
+
+int h2_parse_config(const char* key, const char* value) {
+    if (strcmp(key, "HTTP2") == 0) {
+        g_h2_enabled = (strcasecmp(value, "on") == 0 || strcmp(value, "1") == 0);
+    }
+    else if (strcmp(key, "HTTP2_MAX_STREAMS") == 0) {
+        g_max_streams = atoi(value) > 0 ? atoi(value) : H2_DEFAULT_MAX_STREAMS;
+    }
+    else if (strcmp(key, "HTTP2_MAX_REQUEST_BODY") == 0) {
+        g_max_body = atol(value) > 0 ? (size_t)atol(value) : H2_DEFAULT_MAX_BODY;
+    }
+    else {
+        return -1;
+    }
+
+    printf("Config: HTTP/2 %s = %s\n", key, value);
+
+    return 0;
+}
+
+static void h2_metrics_source(MetricsWriter* w) {
+    metrics_write_value(w, "h2_enabled", "Whether h2 is offered through ALPN", (uint64_t)g_h2_enabled);
+    metrics_write_value(w, "h2_streams_active", "HTTP/2 streams open across all connections", (uint64_t)__atomic_load_n(&g_streams_active, __ATOMIC_RELAXED));
+}
+
+void h2_init(void) {
+    metrics_register_source(h2_metrics_source);
+}
+
+int h2_enabled(void) {
+    return g_h2_enabled;
+}
+
+int h2_negotiated(SSL* ssl) {
+    const unsigned char* proto = NULL;
+    unsigned int len = 0;
+
+    SSL_get0_alpn_selected(ssl, &proto, &len);
+
+    return len == 2 && memcmp(proto, "h2", 2) == 0;
+}
+
+static uint32_t read32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void write32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+// Frames are queued on the connection's output chain; callers hold the session lock.
+static int send_frame(H2Session* s, uint8_t type, uint8_t flags, uint32_t id, const void* payload, size_t len) {
+    uint8_t header[H2_FRAME_HEADER];
+
+    header[0] = (uint8_t)(len >> 16);
+    header[1] = (uint8_t)(len >> 8);
+    header[2] = (uint8_t)len;
+    header[3] = type;
+    header[4] = flags;
+
+    write32(header + 5, id & 0x7fffffff);
+
+    if (bufchain_append(&s->conn->output, header, sizeof(header)) < 0) {
+        return -1;
+    }
+
+    if (len > 0 && bufchain_append(&s->conn->output, payload, len) < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static void send_rst(H2Session* s, uint32_t id, uint32_t code) {
+    uint8_t payload[4];
+
+    write32(payload, code);
+
+    send_frame(s, H2_RST_STREAM, 0, id, payload, sizeof(payload));
+}
+
+static void send_window_update(H2Session* s, uint32_t id, uint32_t increment) {
+    uint8_t payload[4];
+
+    write32(payload, increment);
+
+    send_frame(s, H2_WINDOW_UPDATE, 0, id, payload, sizeof(payload));
+}
+
+static int connection_error(H2Session* s, uint32_t code) {
+    uint8_t payload[8];
+
+    write32(payload, s->last_stream_id);
+    write32(payload + 4, code);
+
+    send_frame(s, H2_GOAWAY, 0, 0, payload, sizeof(payload));
+
+    return -1;
+}
+
+// Re-arming the connection makes the event loop run the scheduler even when no bytes arrive.
+static void session_wake(H2Session* s) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.ptr = s->conn;
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, s->conn->fd, &ev);
+}
+
+static H2Stream* find_stream(H2Session* s, uint32_t id) {
+    for (H2Stream* st = s->streams; st; st = st->next) {
+        if (st->id == id) {
+            return st;
+        }
+    }
+
+    return NULL;
+}
+
+static H2Stream* stream_open(H2Session* s, uint32_t id) {
+    H2Stream* st = (H2Stream*)calloc(1, sizeof(H2Stream));
+
+    if (!st) {
+        return NULL;
+    }
+
+    ClientState* client = create_client_state(-1);
+
+    client->transport = &g_transport_h2;
+    client->stream = st;
+    client->addr_hash = s->conn->addr_hash;
+    client->local_peer = s->conn->local_peer;
+    client->t_read_start = metrics_now_ns();
+
+    st->id = id;
+    st->session = s;
+    st->client = client;
+    st->phase = H2_STREAM_RECEIVING;
+    st->send_window = s->peer_initial_window;
+    st->weight = H2_DEFAULT_WEIGHT;
+    st->vtime = s->vtime;
+
+    bufchain_init(&st->body);
+
+    st->next = s->streams;
+    s->streams = st;
+    s->stream_count++;
+    s->refs++;
+
+    __atomic_add_fetch(&g_streams_active, 1, __ATOMIC_RELAXED);
+
+    return st;
+}
+
+static void session_free(H2Session* s) {
+    hpack_table_free(&s->decoder);
+    hpack_table_free(&s->encoder);
+
+    pthread_mutex_destroy(&s->mutex);
+
+    free(s);
+}
+
+// Runs from cleanup_client, on whichever thread owns the stream. A response that got its head
+// out ends cleanly; anything else is reset so the client does not wait for it.
+static void h2_stream_close(ClientState* client) {
+    H2Stream* st = client->stream;
+
+    if (!st) {
+        return;
+    }
+
+    H2Session* s = st->session;
+
+    pthread_mutex_lock(&s->mutex);
+
+    if (!s->dead && !st->ended) {
+        if (st->head_sent) {
+            send_frame(s, H2_DATA, H2_FLAG_END_STREAM, st->id, NULL, 0);
+
+            // We answered before the request body finished; tell the client to stop sending it.
+            if (!st->remote_closed) {
+                send_rst(s, st->id, H2_NO_ERROR);
+            }
+        }
+        else {
+            send_rst(s, st->id, H2_INTERNAL_ERROR);
+        }
+
+        st->ended = 1;
+
+        client_write_pending(s->conn);
+    }
+
+    for (H2Stream** link = &s->streams; *link; link = &(*link)->next) {
+        if (*link == st) {
+            *link = st->next;
+
+            break;
+        }
+    }
+
+    s->stream_count--;
+
+    bufchain_free(&st->body);
+    free(st);
+
+    client->stream = NULL;
+
+    __atomic_sub_fetch(&g_streams_active, 1, __ATOMIC_RELAXED);
+
+    int gone = --s->refs == 0;
+
+    pthread_mutex_unlock(&s->mutex);
+
+    if (gone) {
+        session_free(s);
+    }
+}
+
+// The stream is over from the client's point of view (RST_STREAM, or the connection is going away).
+static void stream_abort(H2Stream* st) {
+    st->reset = 1;
+    st->ended = 1;
+
+    if (st->phase != H2_STREAM_DISPATCHED) {
+        cleanup_client(st->client);
+    }
+    else if (st->client->peer) {
+        // The relay notices on its next event and closes the pair.
+        shutdown(st->client->peer->fd, SHUT_RDWR);
+    }
+}
+
+static int field_is(const char* name, size_t name_len, const char* literal) {
+    return strlen(literal) == name_len && memcmp(name, literal, name_len) == 0;
+}
+
+static void copy_field(char* dst, size_t cap, const char* value, size_t value_len, H2Stream* st) {
+    if (value_len >= cap) {
+        st->too_large = 1;
+
+        return;
+    }
+
+    memcpy(dst, value, value_len);
+
+    dst[value_len] = '\0';
+}
+
+static void on_request_field(void* arg, const char* name, size_t name_len, const char* value, size_t value_len) {
+    H2Stream* st = (H2Stream*)arg;
+    ClientState* client = st->client;
+
+    // CR, LF or NUL in a field would smuggle extra lines into the HTTP/1.1 request the handlers see.
+    if (name_len == 0 || memchr(name, '\r', name_len) || memchr(name, '\n', name_len) || memchr(name, '\0', name_len) ||
+        memchr(value, '\r', value_len) || memchr(value, '\n', value_len) || memchr(value, '\0', value_len)) {
+        st->malformed = 1;
+
+        return;
+    }
+
+    if (name[0] == ':') {
+        if (st->seen_regular) {
+            st->malformed = 1;
+        }
+        else if (field_is(name, name_len, ":method")) {
+            copy_field(st->method, sizeof(st->method), value, value_len, st);
+        }
+        else if (field_is(name, name_len, ":path")) {
+            copy_field(st->path, sizeof(st->path), value, value_len, st);
+        }
+        else if (field_is(name, name_len, ":authority")) {
+            copy_field(st->authority, sizeof(st->authority), value, value_len, st);
+        }
+        else if (!field_is(name, name_len, ":scheme")) {
+            st->malformed = 1;
+        }
+
+        return;
+    }
+
+    st->seen_regular = 1;
+
+    for (size_t i = 0; i < name_len; i++) {
+        if (isupper((unsigned char)name[i])) {
+            st->malformed = 1;
+
+            return;
+        }
+    }
+
+    if (field_is(name, name_len, "connection") || field_is(name, name_len, "keep-alive") || field_is(name, name_len, "proxy-connection") ||
+        field_is(name, name_len, "transfer-encoding") || field_is(name, name_len, "upgrade")) {
+        st->malformed = 1;
+
+        return;
+    }
+
+    // The body length is known once END_STREAM arrives and is written then; a declared length
+    // only serves to turn away an oversized body before it is sent.
+    if (field_is(name, name_len, "content-length")) {
+        st->declared_len = strtoull(value, NULL, 10);
+
+        return;
+    }
+
+    if (field_is(name, name_len, "te")) {
+        return;
+    }
+
+    if (field_is(name, name_len, "host")) {
+        if (st->authority[0] == '\0') {
+            copy_field(st->authority, sizeof(st->authority), value, value_len, st);
+        }
+
+        return;
+    }
+
+    // Cookie crumbs are joined back into one header (RFC 9113 section 8.2.3).
+    if (field_is(name, name_len, "cookie")) {
+        size_t used = strlen(st->cookie);
+
+        if (used + value_len + 3 > sizeof(st->cookie)) {
+            st->too_large = 1;
+
+            return;
+        }
+
+        if (used > 0) {
+            memcpy(st->cookie + used, "; ", 2);
+
+            used += 2;
+        }
+
+        memcpy(st->cookie + used, value, value_len);
+
+        st->cookie[used + value_len] = '\0';
+
+        return;
+    }
+
+    if (st->fields_len + name_len + value_len + 4 >= BUFFER_SIZE) {
+        st->too_large = 1;
+
+        return;
+    }
+
+    char* dst = client->buffer + st->fields_len;
+
+    memcpy(dst, name, name_len);
+    memcpy(dst + name_len, ": ", 2);
+    memcpy(dst + name_len + 2, value, value_len);
+    memcpy(dst + name_len + 2 + value_len, "\r\n", 2);
+
+    st->fields_len += name_len + value_len + 4;
+}
+
+static void on_ignored_field(void* arg, const char* name, size_t name_len, const char* value, size_t value_len) {
+    (void)arg;
+    (void)name;
+    (void)name_len;
+    (void)value;
+    (void)value_len;
+}
+
+// Answers on a stream that never reached a handler, then releases it.
+static void stream_reject(H2Session* s, H2Stream* st, int status) {
+    uint8_t block[64];
+    char status_str[8];
+    int n = hpack_encode_begin(&s->encoder, block, sizeof(block));
+
+    snprintf(status_str, sizeof(status_str), "%d", status);
+
+    n += hpack_encode(&s->encoder, block + n, sizeof(block) - n, ":status", 7, status_str, strlen(status_str), 0);
+    n += hpack_encode(&s->encoder, block + n, sizeof(block) - n, "content-length", 14, "0", 1, 0);
+
+    send_frame(s, H2_HEADERS, H2_FLAG_END_HEADERS | H2_FLAG_END_STREAM, st->id, block, n);
+
+    if (!st->remote_closed) {
+        send_rst(s, st->id, H2_NO_ERROR);
+    }
+
+    stream_abort(st);
+}
+
+static void stream_dispatch(H2Session* s, H2Stream* st) {
+    ClientState* client = st->client;
+    size_t len = client->bytes_read;
+
+    if (st->body_len > 0 || strcmp(st->method, "POST") == 0 || strcmp(st->method, "PUT") == 0) {
+        len += snprintf(client->buffer + len, BUFFER_SIZE - len, "Content-Length: %zu\r\n", st->body_len);
+    }
+
+    len += snprintf(client->buffer + len, BUFFER_SIZE - len, "\r\n");
+
+    client->bytes_read = len;
+
+    st->phase = H2_STREAM_DISPATCHED;
+    st->quota = H2_QUANTUM;
+
+    if (st->vtime < s->vtime) {
+        st->vtime = s->vtime;
+    }
+
+    metrics_count(METRIC_H2_STREAMS, 1);
+
+    enqueue_request(client);
+}
+
+// Turns the decoded fields into the HTTP/1.1 request text the route handlers parse.
+// Returns -1 when the stream was rejected instead.
+static int stream_build_request(H2Session* s, H2Stream* st) {
+    ClientState* client = st->client;
+
+    if (st->malformed || st->method[0] == '\0' || st->path[0] != '/') {
+        send_rst(s, st->id, H2_PROTOCOL_ERROR);
+
+        stream_abort(st);
+
+        return -1;
+    }
+
+    char line[BUFFER_SIZE];
+    int n = snprintf(line, sizeof(line), "%s %s HTTP/1.1\r\nHost: %s\r\n", st->method, st->path, st->authority);
+    size_t cookie_len = st->cookie[0] ? strlen(st->cookie) + 10 : 0;
+
+    // Leave room for the Content-Length line and the blank line added at dispatch.
+    if (st->too_large || n + st->fields_len + cookie_len + 48 >= BUFFER_SIZE) {
+        stream_reject(s, st, 431);
+
+        return -1;
+    }
+
+    memmove(client->buffer + n, client->buffer, st->fields_len);
+    memcpy(client->buffer, line, n);
+
+    size_t len = n + st->fields_len;
+
+    if (cookie_len > 0) {
+        len += snprintf(client->buffer + len, BUFFER_SIZE - len, "Cookie: %s\r\n", st->cookie);
+    }
+
+    client->buffer[len] = '\0';
+    client->bytes_read = len;
+
+    st->is_head = strcmp(st->method, "HEAD") == 0;
+
+    return 0;
+}
+
+static void apply_priority(H2Session* s, H2Stream* st, uint32_t parent, int weight, int exclusive) {
+    if (parent == st->id) {
+        parent = 0;
+    }
+
+    // An exclusive dependency adopts the new parent's other children (RFC 7540 section 5.3.3).
+    if (exclusive) {
+        for (H2Stream* other = s->streams; other; other = other->next) {
+            if (other != st && other->parent == parent) {
+                other->parent = st->id;
+            }
+        }
+    }
+
+    st->parent = parent;
+    st->weight = weight;
+}
+
+static int headers_complete(H2Session* s) {
+    uint32_t id = s->header_stream;
+    H2Stream* st = s->header_refused ? NULL : find_stream(s, id);
+    int trailers = s->header_trailers;
+
+    s->header_stream = 0;
+
+    // Every block is decoded, even for refused streams, to keep the dynamic table in step.
+    if (hpack_decode(&s->decoder, s->header_block, s->header_block_len, (st && !trailers) ? on_request_field : on_ignored_field, st) < 0) {
+        return connection_error(s, H2_COMPRESSION_ERROR);
+    }
+
+    s->header_block_len = 0;
+
+    if (!st) {
+        send_rst(s, id, H2_REFUSED_STREAM);
+
+        return 0;
+    }
+
+    if (trailers) {
+        st->remote_closed = 1;
+
+        if (st->phase == H2_STREAM_RECEIVING) {
+            stream_dispatch(s, st);
+        }
+
+        return 0;
+    }
+
+    st->remote_closed = s->header_end_stream;
+
+    if (stream_build_request(s, st) < 0) {
+        return 0;
+    }
+
+    if (st->declared_len > g_max_body) {
+        stream_reject(s, st, 413);
+
+        return 0;
+    }
+
+    if (st->remote_closed) {
+        stream_dispatch(s, st);
+    }
+
+    return 0;
+}
+
+static int append_header_block(H2Session* s, const uint8_t* p, size_t len) {
+    if (s->header_block_len + len > sizeof(s->header_block)) {
+        return connection_error(s, H2_PROTOCOL_ERROR);
+    }
+
+    memcpy(s->header_block + s->header_block_len, p, len);
+
+    s->header_block_len += len;
+
+    return 0;
+}
+
+static int on_headers(H2Session* s, uint8_t flags, uint32_t id, const uint8_t* p, size_t len) {
+    if (id == 0 || (id & 1) == 0) {
+        return connection_error(s, H2_PROTOCOL_ERROR);
+    }
+
+    size_t pad = 0;
+
+    if (flags & H2_FLAG_PADDED) {
+        if (len < 1) {
+            return connection_error(s, H2_PROTOCOL_ERROR);
+        }
+
+        pad = p[0];
+        p++;
+        len--;
+    }
+
+    uint32_t parent = 0;
+    int weight = H2_DEFAULT_WEIGHT;
+    int exclusive = 0;
+
+    if (flags & H2_FLAG_PRIORITY) {
+        if (len < 5) {
+            return connection_error(s, H2_PROTOCOL_ERROR);
+        }
+
+        exclusive = p[0] >> 7;
+        parent = read32(p) & 0x7fffffff;
+        weight = p[4] + 1;
+        p += 5;
+        len -= 5;
+    }
+
+    if (pad > len) {
+        return connection_error(s, H2_PROTOCOL_ERROR);
+    }
+
+    len -= pad;
+
+    H2Stream* st = find_stream(s, id);
+
+    s->header_refused = 0;
+    s->header_trailers = 0;
+
+    if (st) {
+        // Trailers: only after the request headers, and they must end the stream.
+        if (st->remote_closed || !(flags & H2_FLAG_END_STREAM)) {
+            return connection_error(s, H2_PROTOCOL_ERROR);
+        }
+
+        s->header_trailers = 1;
+    }
+    else {
+        if (id <= s->last_stream_id) {
+            return connection_error(s, H2_STREAM_CLOSED);
+        }
+
+        s->last_stream_id = id;
+
+        st = (s->goaway || s->stream_count >= g_max_streams) ? NULL : stream_open(s, id);
+
+        if (st) {
+            if (flags & H2_FLAG_PRIORITY) {
+                apply_priority(s, st, parent, weight, exclusive);
+            }
+        }
+        else {
+            s->header_refused = 1;
+        }
+    }
+
+    s->header_stream = id;
+    s->header_end_stream = flags & H2_FLAG_END_STREAM;
+    s->header_block_len = 0;
+
+    if (append_header_block(s, p, len) < 0) {
+        return -1;
+    }
+
+    return (flags & H2_FLAG_END_HEADERS) ? headers_complete(s) : 0;
+}
+
+static int on_data(H2Session* s, uint8_t flags, uint32_t id, const uint8_t* p, size_t len) {
+    if (id == 0) {
+        return connection_error(s, H2_PROTOCOL_ERROR);
+    }
+
+    // Flow control counts the whole payload, padding included.
+    uint32_t flow = (uint32_t)len;
+
+    if (flags & H2_FLAG_PADDED) {
+        if (len < 1 || p[0] >= len) {
+            return connection_error(s, H2_PROTOCOL_ERROR);
+        }
+
+        len -= 1 + p[0];
+        p++;
+    }
+
+    s->recv_unacked += flow;
+
+    if (s->recv_unacked >= H2_CONNECTION_WINDOW / 2) {
+        send_window_update(s, 0, s->recv_unacked);
+
+        s->recv_unacked = 0;
+    }
+
+    H2Stream* st = find_stream(s, id);
+
+    if (!st) {
+        // Late frames for a stream we already closed are dropped.
+        return id > s->last_stream_id ? connection_error(s, H2_PROTOCOL_ERROR) : 0;
+    }
+
+    if (st->remote_closed) {
+        send_rst(s, id, H2_STREAM_CLOSED);
+
+        stream_abort(st);
+
+        return 0;
+    }
+
+    if (st->body_len + len > g_max_body) {
+        stream_reject(s, st, 413);
+
+        return 0;
+    }
+
+    if (len > 0 && bufchain_append(&st->body, p, len) < 0) {
+        send_rst(s, id, H2_INTERNAL_ERROR);
+
+        stream_abort(st);
+
+        return 0;
+    }
+
+    st->body_len += len;
+
+    if (flags & H2_FLAG_END_STREAM) {
+        st->remote_closed = 1;
+
+        stream_dispatch(s, st);
+
+        return 0;
+    }
+
+    st->recv_unacked += flow;
+
+    if (st->recv_unacked >= H2_DEFAULT_WINDOW / 2) {
+        send_window_update(s, id, st->recv_unacked);
+
+        st->recv_unacked = 0;
+    }
+
+    return 0;
+}
+
+static int on_settings(H2Session* s, uint8_t flags, uint32_t id, const uint8_t* p, size_t len) {
+    if (id != 0) {
+        return connection_error(s, H2_PROTOCOL_ERROR);
+    }
+
+    if (flags & H2_FLAG_ACK) {
+        return len == 0 ? 0 : connection_error(s, H2_FRAME_SIZE_ERROR);
+    }
+
+    if (len % 6 != 0) {
+        return connection_error(s, H2_FRAME_SIZE_ERROR);
+    }
+
+    for (size_t i = 0; i < len; i += 6) {
+        uint16_t key = (uint16_t)((p[i] << 8) | p[i + 1]);
+        uint32_t value = read32(p + i + 2);
+
+        if (key == H2_SETTINGS_HEADER_TABLE_SIZE) {
+            hpack_encoder_set_max(&s->encoder, value);
+        }
+        else if (key == H2_SETTINGS_ENABLE_PUSH && value > 1) {
+            return connection_error(s, H2_PROTOCOL_ERROR);
+        }
+        else if (key == H2_SETTINGS_INITIAL_WINDOW_SIZE) {
+            if (value > H2_MAX_WINDOW) {
+                return connection_error(s, H2_FLOW_CONTROL_ERROR);
+            }
+
+            int64_t delta = (int64_t)value - (int64_t)s->peer_initial_window;
+
+            for (H2Stream* st = s->streams; st; st = st->next) {
+                st->send_window += delta;
+            }
+
+            s->peer_initial_window = value;
+        }
+        else if (key == H2_SETTINGS_MAX_FRAME_SIZE) {
+            if (value < H2_DEFAULT_FRAME_SIZE || value > 0xffffff) {
+                return connection_error(s, H2_PROTOCOL_ERROR);
+            }
+
+            s->peer_max_frame = value;
+        }
+    }
+
+    return send_frame(s, H2_SETTINGS, H2_FLAG_ACK, 0, NULL, 0);
+}
+
+static int on_window_update(H2Session* s, uint32_t id, const uint8_t* p, size_t len) {
+    if (len != 4) {
+        return connection_error(s, H2_FRAME_SIZE_ERROR);
+    }
+
+    uint32_t increment = read32(p) & 0x7fffffff;
+
+    if (id == 0) {
+        if (increment == 0) {
+            return connection_error(s, H2_PROTOCOL_ERROR);
+        }
+
+        s->send_window += increment;
+
+        return s->send_window > H2_MAX_WINDOW ? connection_error(s, H2_FLOW_CONTROL_ERROR) : 0;
+    }
+
+    H2Stream* st = find_stream(s, id);
+
+    if (!st) {
+        return 0;
+    }
+
+    st->send_window += increment;
+
+    if (increment == 0 || st->send_window > H2_MAX_WINDOW) {
+        send_rst(s, id, increment == 0 ? H2_PROTOCOL_ERROR : H2_FLOW_CONTROL_ERROR);
+
+        stream_abort(st);
+    }
+
+    return 0;
+}
+
+static int handle_frame(H2Session* s, uint8_t type, uint8_t flags, uint32_t id, const uint8_t* p, size_t len) {
+    // Nothing may interleave with a header block that is still being continued.
+    if (s->header_stream != 0 && (type != H2_CONTINUATION || id != s->header_stream)) {
+        return connection_error(s, H2_PROTOCOL_ERROR);
+    }
+
+    switch (type) {
+        case H2_DATA:
+            return on_data(s, flags, id, p, len);
+
+        case H2_HEADERS:
+            return on_headers(s, flags, id, p, len);
+
+        case H2_CONTINUATION:
+            if (s->header_stream == 0) {
+                return connection_error(s, H2_PROTOCOL_ERROR);
+            }
+
+            if (append_header_block(s, p, len) < 0) {
+                return -1;
+            }
+
+            return (flags & H2_FLAG_END_HEADERS) ? headers_complete(s) : 0;
+
+        case H2_PRIORITY: {
+            if (id == 0 || len != 5) {
+                return connection_error(s, id == 0 ? H2_PROTOCOL_ERROR : H2_FRAME_SIZE_ERROR);
+            }
+
+            H2Stream* st = find_stream(s, id);
+
+            if (st) {
+                apply_priority(s, st, read32(p) & 0x7fffffff, p[4] + 1, p[0] >> 7);
+            }
+
+            return 0;
+        }
+
+        case H2_RST_STREAM: {
+            if (id == 0 || len != 4) {
+                return connection_error(s, id == 0 ? H2_PROTOCOL_ERROR : H2_FRAME_SIZE_ERROR);
+            }
+
+            H2Stream* st = find_stream(s, id);
+
+            if (!st) {
+                return id > s->last_stream_id ? connection_error(s, H2_PROTOCOL_ERROR) : 0;
+            }
+
+            metrics_count(METRIC_H2_STREAMS_RESET, 1);
+
+            stream_abort(st);
+
+            return 0;
+        }
+
+        case H2_SETTINGS:
+            return on_settings(s, flags, id, p, len);
+
+        case H2_PUSH_PROMISE:
+            return connection_error(s, H2_PROTOCOL_ERROR);
+
+        case H2_PING:
+            if (id != 0 || len != 8) {
+                return connection_error(s, id != 0 ? H2_PROTOCOL_ERROR : H2_FRAME_SIZE_ERROR);
+            }
+
+            return (flags & H2_FLAG_ACK) ? 0 : send_frame(s, H2_PING, H2_FLAG_ACK, 0, p, len);
+
+        case H2_GOAWAY:
+            s->goaway = 1;
+
+            return 0;
+
+        case H2_WINDOW_UPDATE:
+            return on_window_update(s, id, p, len);
+
+        default:
+            // Unknown frame types are ignored (RFC 9113 section 4.1).
+            return 0;
+    }
+}
+
+static int process_input(H2Session* s) {
+    size_t pos = 0;
+
+    if (!s->preface_done) {
+        size_t n = s->in_len < H2_PREFACE_LEN ? s->in_len : H2_PREFACE_LEN;
+
+        if (memcmp(s->in, H2_PREFACE, n) != 0) {
+            return -1;
+        }
+
+        if (s->in_len < H2_PREFACE_LEN) {
+            return 0;
+        }
+
+        s->preface_done = 1;
+
+        pos = H2_PREFACE_LEN;
+    }
+
+    while (s->in_len - pos >= H2_FRAME_HEADER) {
+        const uint8_t* h = s->in + pos;
+        size_t len = ((size_t)h[0] << 16) | ((size_t)h[1] << 8) | h[2];
+
+        if (len > H2_DEFAULT_FRAME_SIZE) {
+            return connection_error(s, H2_FRAME_SIZE_ERROR);
+        }
+
+        if (s->in_len - pos < H2_FRAME_HEADER + len) {
+            break;
+        }
+
+        if (handle_frame(s, h[3], h[4], read32(h + 5) & 0x7fffffff, h + H2_FRAME_HEADER, len) < 0) {
+            return -1;
+        }
+
+        pos += H2_FRAME_HEADER + len;
+    }
+
+    memmove(s->in, s->in + pos, s->in_len - pos);
+
+    s->in_len -= pos;
+
+    return 0;
+}
+
+// Re-encodes the handler's HTTP/1.1 status line and headers as a HEADERS frame.
+// Returns 0 when sent (or when it was an interim 1xx head, which is dropped), -1 if unusable.
+static int send_response_head(H2Session* s, H2Stream* st) {
+    char* head = st->response_head;
+
+    if (strncmp(head, "HTTP/", 5) != 0 || !strchr(head, ' ')) {
+        return -1;
+    }
+
+    int status = atoi(strchr(head, ' ') + 1);
+
+    if (status < 100 || status > 999) {
+        return -1;
+    }
+
+    if (status < 200) {
+        st->response_head_len = 0;
+
+        return 0;
+    }
+
+    uint8_t block[BUFFER_SIZE * 2];
+    char status_str[4];
+    int n = hpack_encode_begin(&s->encoder, block, sizeof(block));
+
+    snprintf(status_str, sizeof(status_str), "%d", status);
+
+    n += hpack_encode(&s->encoder, block + n, sizeof(block) - n, ":status", 7, status_str, 3, 0);
+
+    for (char* line = strstr(head, "\r\n") + 2; *line != '\r'; line = strstr(line, "\r\n") + 2) {
+        char* colon = strchr(line, ':');
+        char* end = strstr(line, "\r\n");
+        char name[128];
+        size_t name_len = colon ? (size_t)(colon - line) : 0;
+
+        if (!colon || colon > end || name_len == 0 || name_len >= sizeof(name)) {
+            continue;
+        }
+
+        for (size_t i = 0; i < name_len; i++) {
+            name[i] = (char)tolower((unsigned char)line[i]);
+        }
+
+        char* value = colon + 1;
+        char* value_end = end;
+
+        while (value < value_end && (*value == ' ' || *value == '\t')) {
+            value++;
+        }
+
+        while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t')) {
+            value_end--;
+        }
+
+        // Connection-specific fields have no meaning in HTTP/2; the stream carries the framing.
+        if (field_is(name, name_len, "connection") || field_is(name, name_len, "keep-alive") ||
+            field_is(name, name_len, "proxy-connection") || field_is(name, name_len, "upgrade")) {
+            continue;
+        }
+
+        if (field_is(name, name_len, "transfer-encoding")) {
+            st->chunked = memmem(value, value_end - value, "chunked", 7) != NULL;
+
+            chunked_init(&st->chunk);
+
+            continue;
+        }
+
+        // Values that change per response would only churn the dynamic table.
+        int index = !(field_is(name, name_len, "content-length") || field_is(name, name_len, "content-range") ||
+                      field_is(name, name_len, "date") || field_is(name, name_len, "etag") ||
+                      field_is(name, name_len, "last-modified") || field_is(name, name_len, "set-cookie"));
+        int written = hpack_encode(&s->encoder, block + n, sizeof(block) - n, name, name_len, value, value_end - value, index);
+
+        if (written < 0) {
+            return -1;
+        }
+
+        n += written;
+    }
+
+    if (send_frame(s, H2_HEADERS, H2_FLAG_END_HEADERS, st->id, block, n) < 0) {
+        return -1;
+    }
+
+    st->head_sent = 1;
+    st->discard_body = st->is_head || status == 204 || status == 304;
+
+    return 0;
+}
+
+static size_t data_allowance(H2Session* s, H2Stream* st) {
+    if (s->conn->output.len >= g_output_buffer_cap) {
+        return 0;
+    }
+
+    int64_t window = st->send_window < s->send_window ? st->send_window : s->send_window;
+
+    if (window <= 0) {
+        if (!st->stalled) {
+            metrics_count(METRIC_H2_FLOW_STALLS, 1);
+
+            st->stalled = 1;
+        }
+
+        return 0;
+    }
+
+    st->stalled = 0;
+
+    size_t allowed = (size_t)window;
+
+    if (allowed > st->quota) {
+        allowed = st->quota;
+    }
+
+    if (allowed > s->peer_max_frame) {
+        allowed = s->peer_max_frame;
+    }
+
+    return allowed;
+}
+
+// Frames body bytes as DATA until flow control, the stream's quota or the connection buffer
+// runs out. Returns how many input bytes were taken.
+static size_t send_body(H2Session* s, H2Stream* st, const char* data, size_t len) {
+    size_t used = 0;
+
+    if (st->discard_body) {
+        return len;
+    }
+
+    while (used < len) {
+        if (st->chunked && st->chunk.state != CHUNKED_DATA) {
+            used += chunked_skip_framing(&st->chunk, data + used, len - used);
+
+            // Whatever follows the last chunk (or a malformed size) is not part of the body.
+            if (st->chunk.state == CHUNKED_DONE || st->chunk.state == CHUNKED_ERROR) {
+                used = len;
+            }
+
+            continue;
+        }
+
+        size_t n = len - used;
+
+        if (st->chunked && n > st->chunk.left) {
+            n = (size_t)st->chunk.left;
+        }
+
+        size_t allowed = data_allowance(s, st);
+
+        if (allowed == 0) {
+            break;
+        }
+
+        if (n > allowed) {
+            n = allowed;
+        }
+
+        if (send_frame(s, H2_DATA, 0, st->id, data + used, n) < 0) {
+            break;
+        }
+
+        st->send_window -= n;
+        s->send_window -= n;
+        st->quota -= n;
+        st->vtime += ((uint64_t)n << 8) / st->weight;
+
+        if (st->chunked) {
+            chunked_consume(&st->chunk, n);
+        }
+
+        used += n;
+    }
+
+    return used;
+}
+
+static ssize_t h2_stream_write(ClientState* client, const char* buf, size_t len) {
+    H2Stream* st = client->stream;
+    H2Session* s = st->session;
+    size_t used = 0;
+
+    pthread_mutex_lock(&s->mutex);
+
+    if (s->dead || st->reset) {
+        pthread_mutex_unlock(&s->mutex);
+
+        return TRANSPORT_ERROR;
+    }
+
+    st->woken = 0;
+
+    while (!st->head_sent && used < len) {
+        size_t old = st->response_head_len;
+        size_t room = sizeof(st->response_head) - 1 - old;
+        size_t take = len - used < room ? len - used : room;
+
+        memcpy(st->response_head + old, buf + used, take);
+
+        st->response_head_len += take;
+        st->response_head[st->response_head_len] = '\0';
+
+        char* end = strstr(st->response_head + (old > 3 ? old - 3 : 0), "\r\n\r\n");
+
+        if (!end) {
+            if (st->response_head_len == sizeof(st->response_head) - 1) {
+                break;
+            }
+
+            used += take;
+
+            continue;
+        }
+
+        size_t head_len = (size_t)(end + 4 - st->response_head);
+
+        used += take - (st->response_head_len - head_len);
+
+        st->response_head_len = head_len;
+        st->response_head[head_len] = '\0';
+
+        if (send_response_head(s, st) < 0) {
+            break;
+        }
+    }
+
+    if (!st->head_sent && used < len) {
+        send_rst(s, st->id, H2_INTERNAL_ERROR);
+
+        st->reset = 1;
+        st->ended = 1;
+
+        client_write_pending(s->conn);
+
+        pthread_mutex_unlock(&s->mutex);
+
+        return TRANSPORT_ERROR;
+    }
+
+    if (used < len) {
+        used += send_body(s, st, buf + used, len - used);
+    }
+
+    int flushed = client_write_pending(s->conn);
+
+    // Out of quota or buffer space rather than window: the scheduler picks this stream up again.
+    if (used < len && st->send_window > 0 && s->send_window > 0) {
+        session_wake(s);
+    }
+
+    pthread_mutex_unlock(&s->mutex);
+
+    if (flushed < 0) {
+        return TRANSPORT_ERROR;
+    }
+
+    return used > 0 ? (ssize_t)used : TRANSPORT_AGAIN;
+}
+
+// The request body is complete before dispatch, so an empty buffer means the body was read.
+static ssize_t h2_stream_read(ClientState* client, char* buf, size_t len) {
+    H2Stream* st = client->stream;
+    H2Session* s = st->session;
+    size_t avail;
+
+    pthread_mutex_lock(&s->mutex);
+
+    const char* data = bufchain_peek(&st->body, &avail);
+
+    if (!data || avail == 0) {
+        pthread_mutex_unlock(&s->mutex);
+
+        return TRANSPORT_AGAIN;
+    }
+
+    size_t n = avail < len ? avail : len;
+
+    memcpy(buf, data, n);
+
+    bufchain_consume(&st->body, n);
+
+    pthread_mutex_unlock(&s->mutex);
+
+    return (ssize_t)n;
+}
+
+static int h2_stream_can_sendfile(ClientState* client) {
+    (void)client;
+
+    return 0;
+}
+
+static ssize_t h2_stream_sendfile(ClientState* client, int file_fd, off_t offset, size_t len) {
+    (void)client;
+    (void)file_fd;
+    (void)offset;
+    (void)len;
+
+    return TRANSPORT_ERROR;
+}
+
+const Transport g_transport_h2 = {
+    .name = "h2",
+    .attach = NULL,
+    .handshake = NULL,
+    .read = h2_stream_read,
+    .write = h2_stream_write,
+    .writev = NULL,
+    .can_sendfile = h2_stream_can_sendfile,
+    .sendfile = h2_stream_sendfile,
+    .close = h2_stream_close,
+    .splice_relay = 0
+};
+
+H2Session* h2_session_create(ClientState* conn) {
+    H2Session* s = (H2Session*)calloc(1, sizeof(H2Session));
+
+    if (!s) {
+        return NULL;
+    }
+
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&s->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    hpack_table_init(&s->decoder);
+    hpack_table_init(&s->encoder);
+
+    s->conn = conn;
+    s->refs = 1;
+    s->send_window = H2_DEFAULT_WINDOW;
+    s->peer_initial_window = H2_DEFAULT_WINDOW;
+    s->peer_max_frame = H2_DEFAULT_FRAME_SIZE;
+
+    // Anything read with the handshake (0-RTT) is the start of the connection's input.
+    memcpy(s->in, conn->buffer, conn->bytes_read);
+
+    s->in_len = conn->bytes_read;
+    conn->bytes_read = 0;
+
+    uint8_t settings[12];
+
+    settings[0] = 0;
+    settings[1] = H2_SETTINGS_MAX_CONCURRENT_STREAMS;
+    write32(settings + 2, (uint32_t)g_max_streams);
+    settings[6] = 0;
+    settings[7] = H2_SETTINGS_MAX_HEADER_LIST_SIZE;
+    write32(settings + 8, BUFFER_SIZE);
+
+    send_frame(s, H2_SETTINGS, 0, 0, settings, sizeof(settings));
+    send_window_update(s, 0, H2_CONNECTION_WINDOW - H2_DEFAULT_WINDOW);
+
+    conn->h2 = s;
+
+    metrics_count(METRIC_H2_CONNECTIONS, 1);
+
+    return s;
+}
+
+static int stream_ready(H2Stream* st) {
+    ClientState* client = st->client;
+
+    if (st->reset || (st->head_sent && st->send_window <= 0)) {
+        return 0;
+    }
+
+    if (st->phase == H2_STREAM_PARKED) {
+        return 1;
+    }
+
+    // A relayed response that ran out of quota or window waits with its bytes in the stream's output chain.
+    return st->phase == H2_STREAM_DISPATCHED && client->state == STATE_PROXYING && client->peer && client->output.len > 0 && !st->woken;
+}
+
+// A stream only gets bandwidth when nothing it depends on can use it (RFC 7540 section 5.3).
+static int ancestor_ready(H2Session* s, H2Stream* st) {
+    uint32_t parent = st->parent;
+
+    for (int depth = 0; parent != 0 && depth < s->stream_count; depth++) {
+        H2Stream* p = find_stream(s, parent);
+
+        if (!p) {
+            return 0;
+        }
+
+        if (stream_ready(p)) {
+            return 1;
+        }
+
+        parent = p->parent;
+    }
+
+    return 0;
+}
+
+// Hands out H2_QUANTUM-byte turns to waiting streams, lowest virtual time first; a stream's
+// virtual time advances by bytes sent scaled by 256/weight, so siblings share by weight.
+static void schedule(H2Session* s) {
+    while (s->send_window > 0 && s->conn->output.len < g_output_buffer_cap) {
+        H2Stream* best = NULL;
+
+        for (H2Stream* st = s->streams; st; st = st->next) {
+            if (stream_ready(st) && (!best || st->vtime < best->vtime) && !ancestor_ready(s, st)) {
+                best = st;
+            }
+        }
+
+        if (!best) {
+            break;
+        }
+
+        ClientState* client = best->client;
+
+        s->vtime = best->vtime;
+        best->quota = H2_QUANTUM;
+
+        if (best->phase != H2_STREAM_PARKED) {
+            // The relay resumes from the upstream side; re-arming it raises an event there.
+            best->woken = 1;
+
+            struct epoll_event ev;
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+            ev.data.ptr = client->peer;
+
+            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->peer->fd, &ev);
+
+            continue;
+        }
+
+        int ret = client_pump_output(client);
+
+        if (ret == 0) {
+            request_write_end(client);
+
+            cleanup_client(client);
+        }
+        else if (ret < 0) {
+            cleanup_client(client);
+        }
+        else if (best->quota == H2_QUANTUM) {
+            break;
+        }
+    }
+}
+
+ClientState* h2_stream_connection(ClientState* client) {
+    return client->stream->session->conn;
+}
+
+void h2_stream_response_done(ClientState* client) {
+    H2Stream* st = client->stream;
+    H2Session* s = st->session;
+
+    pthread_mutex_lock(&s->mutex);
+
+    if (!s->dead && !st->reset && (client->output.len > 0 || client->file_stream != NULL)) {
+        st->phase = H2_STREAM_PARKED;
+
+        if (st->vtime < s->vtime) {
+            st->vtime = s->vtime;
+        }
+
+        session_wake(s);
+
+        pthread_mutex_unlock(&s->mutex);
+
+        return;
+    }
+
+    pthread_mutex_unlock(&s->mutex);
+
+    request_write_end(client);
+
+    cleanup_client(client);
+}
+
+static void session_close(H2Session* s) {
+    ClientState* conn = s->conn;
+
+    pthread_mutex_lock(&s->mutex);
+
+    s->dead = 1;
+
+    // Streams the event loop owns go now; the others end when their worker or relay finds the session dead.
+    H2Stream* st = s->streams;
+
+    while (st) {
+        H2Stream* next = st->next;
+
+        if (!st->reset) {
+            stream_abort(st);
+
+            next = s->streams;
+        }
+
+        st = next;
+    }
+
+    s->conn = NULL;
+
+    int gone = --s->refs == 0;
+
+    pthread_mutex_unlock(&s->mutex);
+
+    conn->h2 = NULL;
+
+    cleanup_client(conn);
+
+    if (gone) {
+        session_free(s);
+    }
+}
+
+void h2_connection_event(ClientState* conn) {
+    H2Session* s = conn->h2;
+    int closing = 0;
+
+    pthread_mutex_lock(&s->mutex);
+
+    if (process_input(s) < 0) {
+        closing = 1;
+    }
+
+    while (!closing) {
+        ssize_t n = conn->transport->read(conn, (char*)s->in + s->in_len, sizeof(s->in) - s->in_len);
+
+        if (n == TRANSPORT_AGAIN) {
+            break;
+        }
+
+        if (n <= 0) {
+            closing = 1;
+
+            break;
+        }
+
+        metrics_count(METRIC_BYTES_IN, n);
+
+        s->in_len += n;
+
+        if (process_input(s) < 0) {
+            closing = 1;
+        }
+    }
+
+    if (!closing) {
+        schedule(s);
+    }
+
+    if (client_write_pending(conn) < 0 || (s->goaway && s->stream_count == 0)) {
+        closing = 1;
+    }
+
+    pthread_mutex_unlock(&s->mutex);
+
+    if (closing) {
+        session_close(s);
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef H2_H
+#define H2_H
+
+#include <stdint.h>
+#include <openssl/ssl.h>
+
+#define H2_FRAME_HEADER 9
+#define H2_DEFAULT_FRAME_SIZE 16384
+#define H2_DEFAULT_WINDOW 65535
+#define H2_CONNECTION_WINDOW (1024 * 1024)
+#define H2_MAX_WINDOW 0x7fffffff
+#define H2_MAX_HEADER_BLOCK (16 * 1024)
+#define H2_DEFAULT_MAX_STREAMS 100
+#define H2_DEFAULT_MAX_BODY (1024 * 1024)
+#define H2_DEFAULT_WEIGHT 16
+#define H2_QUANTUM (16 * 1024)
+
+struct ClientState;
+struct H2Session;
+struct H2Stream;
+
+int h2_parse_config(const char* key, const char* value);
+
+void h2_init(void);
+
+int h2_enabled(void);
+
+// Whether ALPN settled on "h2" for this connection.
+int h2_negotiated(SSL* ssl);
+
+// Called once the TLS handshake is done; bytes already read (0-RTT) are replayed as connection input.
+struct H2Session* h2_session_create(struct ClientState* conn);
+
+// Event loop only: reads and answers frames, dispatches finished requests, then feeds waiting streams.
+void h2_connection_event(struct ClientState* conn);
+
+// A worker finished handle_work on a stream; the stream ends now or waits for the scheduler.
+void h2_stream_response_done(struct ClientState* client);
+
+// The connection a stream's frames are written through.
+struct ClientState* h2_stream_connection(struct ClientState* client);
+
+#endif
@@ -0,0 +1,625 @@
+#include "hpack.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define HPACK_HUFFMAN_EOS 256
+#define HPACK_HUFFMAN_NODES 512
+
+typedef struct {
+    uint32_t code;
+    uint8_t bits;
+} HpackHuffmanCode;
+
+typedef struct {
+    const char* name;
+    const char* value;
+} HpackStaticEntry;
+
+static const HpackHuffmanCode g_huffman_codes[257] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28}, {0xfffffe4, 28}, {0xfffffe5, 28},
+    {0xfffffe6, 28}, {0xfffffe7, 28}, {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28}, {0xfffffed, 28}, {0xfffffee, 28},
+    {0xfffffef, 28}, {0xffffff0, 28}, {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28}, {0xffffff8, 28}, {0xffffff9, 28},
+    {0xffffffa, 28}, {0xffffffb, 28}, {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+    {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11}, {0x3fa, 10}, {0x3fb, 10},
+    {0xf9, 8}, {0x7fb, 11}, {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+    {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6}, {0x1a, 6}, {0x1b, 6},
+    {0x1c, 6}, {0x1d, 6}, {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+    {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10}, {0x1ffa, 13}, {0x21, 6},
+    {0x5d, 7}, {0x5e, 7}, {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+    {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7}, {0x67, 7}, {0x68, 7},
+    {0x69, 7}, {0x6a, 7}, {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7}, {0xfc, 8}, {0x73, 7},
+    {0xfd, 8}, {0x1ffb, 13}, {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5}, {0x24, 6}, {0x5, 5},
+    {0x25, 6}, {0x26, 6}, {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+    {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5}, {0x2b, 6}, {0x76, 7},
+    {0x2c, 6}, {0x8, 5}, {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+    {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15}, {0x7fc, 11}, {0x3ffd, 14},
+    {0x1ffd, 13}, {0xffffffc, 28}, {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+    {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23}, {0x3fffd6, 22}, {0x7fffda, 23},
+    {0x7fffdb, 23}, {0x7fffdc, 23}, {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+    {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23}, {0xffffee, 24}, {0x7fffe1, 23},
+    {0x7fffe2, 23}, {0x7fffe3, 23}, {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+    {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24}, {0x3fffda, 22}, {0x1fffdd, 21},
+    {0xfffe9, 20}, {0x3fffdb, 22}, {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+    {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24}, {0x1fffdf, 21}, {0x3fffdf, 22},
+    {0x7fffeb, 23}, {0x7fffec, 23}, {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+    {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23}, {0xfffea, 20}, {0x3fffe2, 22},
+    {0x3fffe3, 22}, {0x3fffe4, 22}, {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+    {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19}, {0x3fffe7, 22}, {0x7ffff2, 23},
+    {0x3fffe8, 22}, {0x1ffffec, 25}, {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+    {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25}, {0x7fff2, 19}, {0x1fffe3, 21},
+    {0x3ffffe6, 26}, {0x7ffffe0, 27}, {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+    {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26}, {0xffffffd, 28}, {0x7ffffe3, 27},
+    {0x7ffffe4, 27}, {0x7ffffe5, 27}, {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+    {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23}, {0x3fffea, 22}, {0x3fffeb, 22},
+    {0x1ffffee, 25}, {0x1ffffef, 25}, {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+    {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26}, {0x7ffffe7, 27}, {0x7ffffe8, 27},
+    {0x7ffffe9, 27}, {0x7ffffea, 27}, {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+    {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26}, {0x3fffffff, 30}
+};
+
+static const HpackStaticEntry g_static_table[HPACK_STATIC_ENTRIES] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""}
+};
+
+// Decoding walks a binary tree built once from the code table; a negative child is a leaf.
+static int16_t g_huffman_tree[HPACK_HUFFMAN_NODES][2];
+static pthread_once_t g_huffman_once = PTHREAD_ONCE_INIT;
+
+static void build_huffman_tree(void) {
+    int nodes = 1;
+
+    for (int sym = 0; sym <= HPACK_HUFFMAN_EOS; sym++) {
+        int node = 0;
+
+        for (int b = g_huffman_codes[sym].bits - 1; b >= 0; b--) {
+            int bit = (g_huffman_codes[sym].code >> b) & 1;
+
+            if (b == 0) {
+                g_huffman_tree[node][bit] = (int16_t)-(sym + 1);
+            }
+            else {
+                if (g_huffman_tree[node][bit] == 0) {
+                    g_huffman_tree[node][bit] = (int16_t)nodes++;
+                }
+
+                node = g_huffman_tree[node][bit];
+            }
+        }
+    }
+}
+
+static int huffman_decode(const uint8_t* in, size_t len, char* out, size_t* out_len) {
+    int node = 0;
+    int depth = 0;
+    int ones = 1;
+    size_t n = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        for (int b = 7; b >= 0; b--) {
+            int bit = (in[i] >> b) & 1;
+            int next = g_huffman_tree[node][bit];
+
+            if (next == 0) {
+                return -1;
+            }
+
+            if (next < 0) {
+                if (-next - 1 == HPACK_HUFFMAN_EOS) {
+                    return -1;
+                }
+
+                out[n++] = (char)(-next - 1);
+                node = 0;
+                depth = 0;
+                ones = 1;
+
+                continue;
+            }
+
+            node = next;
+            depth++;
+            ones &= bit;
+        }
+    }
+
+    // Padding is the most significant bits of EOS: all ones and shorter than a byte.
+    if (depth > 7 || !ones) {
+        return -1;
+    }
+
+    *out_len = n;
+
+    return 0;
+}
+
+static size_t huffman_length(const char* s, size_t len) {
+    uint64_t bits = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        bits += g_huffman_codes[(uint8_t)s[i]].bits;
+    }
+
+    return (size_t)((bits + 7) / 8);
+}
+
+static void huffman_encode(const char* s, size_t len, uint8_t* out) {
+    uint64_t acc = 0;
+    int acc_bits = 0;
+    size_t n = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        const HpackHuffmanCode* c = &g_huffman_codes[(uint8_t)s[i]];
+
+        acc = (acc << c->bits) | c->code;
+        acc_bits += c->bits;
+
+        while (acc_bits >= 8) {
+            acc_bits -= 8;
+            out[n++] = (uint8_t)(acc >> acc_bits);
+        }
+    }
+
+    if (acc_bits > 0) {
+        out[n] = (uint8_t)((acc << (8 - acc_bits)) | (0xff >> acc_bits));
+    }
+}
+
+void hpack_table_init(HpackTable* t) {
+    memset(t, 0, sizeof(*t));
+
+    t->max_size = HPACK_DEFAULT_TABLE_SIZE;
+
+    pthread_once(&g_huffman_once, build_huffman_tree);
+}
+
+static void table_evict(HpackTable* t, size_t limit) {
+    while (t->count > 0 && t->size > limit) {
+        HpackEntry* e = &t->entries[(t->first + t->count - 1) % HPACK_MAX_ENTRIES];
+
+        t->size -= e->name_len + e->value_len + HPACK_ENTRY_OVERHEAD;
+        t->count--;
+
+        free(e->name);
+
+        e->name = NULL;
+    }
+}
+
+void hpack_table_free(HpackTable* t) {
+    table_evict(t, 0);
+}
+
+static void table_add(HpackTable* t, const char* name, size_t name_len, const char* value, size_t value_len) {
+    size_t size = name_len + value_len + HPACK_ENTRY_OVERHEAD;
+
+    // An entry larger than the table empties it and is not added (RFC 7541 section 4.4).
+    if (size > t->max_size) {
+        table_evict(t, 0);
+
+        return;
+    }
+
+    table_evict(t, t->max_size - size);
+
+    char* data = (char*)malloc(name_len + value_len + 2);
+
+    if (!data) {
+        table_evict(t, 0);
+
+        return;
+    }
+
+    memcpy(data, name, name_len);
+    data[name_len] = '\0';
+    memcpy(data + name_len + 1, value, value_len);
+    data[name_len + 1 + value_len] = '\0';
+
+    t->first = (t->first + HPACK_MAX_ENTRIES - 1) % HPACK_MAX_ENTRIES;
+    t->count++;
+    t->size += size;
+
+    HpackEntry* e = &t->entries[t->first];
+
+    e->name = data;
+    e->name_len = name_len;
+    e->value = data + name_len + 1;
+    e->value_len = value_len;
+}
+
+// Index space: 1..61 is the static table, then the dynamic table from newest to oldest.
+static int table_get(const HpackTable* t, uint64_t index, const char** name, size_t* name_len, const char** value, size_t* value_len) {
+    if (index == 0) {
+        return -1;
+    }
+
+    if (index <= HPACK_STATIC_ENTRIES) {
+        *name = g_static_table[index - 1].name;
+        *name_len = strlen(*name);
+        *value = g_static_table[index - 1].value;
+        *value_len = strlen(*value);
+
+        return 0;
+    }
+
+    index -= HPACK_STATIC_ENTRIES + 1;
+
+    if (index >= (uint64_t)t->count) {
+        return -1;
+    }
+
+    const HpackEntry* e = &t->entries[(t->first + index) % HPACK_MAX_ENTRIES];
+
+    *name = e->name;
+    *name_len = e->name_len;
+    *value = e->value;
+    *value_len = e->value_len;
+
+    return 0;
+}
+
+static int decode_int(const uint8_t* in, size_t len, size_t* pos, int prefix, uint64_t* out) {
+    uint64_t mask = (1u << prefix) - 1;
+    uint64_t v = in[*pos] & mask;
+
+    (*pos)++;
+
+    if (v < mask) {
+        *out = v;
+
+        return 0;
+    }
+
+    for (int shift = 0; shift <= 28; shift += 7) {
+        if (*pos >= len) {
+            return -1;
+        }
+
+        uint8_t b = in[(*pos)++];
+
+        v += (uint64_t)(b & 0x7f) << shift;
+
+        if (!(b & 0x80)) {
+            *out = v;
+
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+// Huffman strings are decoded into scratch; raw strings point into the block.
+static int decode_string(const uint8_t* in, size_t len, size_t* pos, char* scratch, const char** out, size_t* out_len) {
+    if (*pos >= len) {
+        return -1;
+    }
+
+    int huffman = in[*pos] & 0x80;
+    uint64_t n;
+
+    if (decode_int(in, len, pos, 7, &n) < 0 || n > len - *pos) {
+        return -1;
+    }
+
+    if (huffman) {
+        if (huffman_decode(in + *pos, (size_t)n, scratch, out_len) < 0) {
+            return -1;
+        }
+
+        *out = scratch;
+    }
+    else {
+        *out = (const char*)in + *pos;
+        *out_len = (size_t)n;
+    }
+
+    *pos += (size_t)n;
+
+    return 0;
+}
+
+int hpack_decode(HpackTable* t, const uint8_t* in, size_t len, HpackHeaderCallback cb, void* arg) {
+    // The shortest Huffman code is 5 bits, so no string decodes to more than 8/5 of the block;
+    // an indexed name is at most the whole table.
+    size_t name_room = len * 2 + HPACK_DEFAULT_TABLE_SIZE;
+    char* scratch = (char*)malloc(name_room + len * 2 + 16);
+    size_t pos = 0;
+    int ret = 0;
+
+    if (!scratch) {
+        return -1;
+    }
+
+    while (pos < len && ret == 0) {
+        uint8_t b = in[pos];
+        uint64_t index;
+        const char* name;
+        const char* value;
+        size_t name_len;
+        size_t value_len;
+
+        if (b & 0x80) {
+            if (decode_int(in, len, &pos, 7, &index) < 0 || table_get(t, index, &name, &name_len, &value, &value_len) < 0) {
+                ret = -1;
+
+                break;
+            }
+
+            cb(arg, name, name_len, value, value_len);
+
+            continue;
+        }
+
+        if ((b & 0xe0) == 0x20) {
+            if (decode_int(in, len, &pos, 5, &index) < 0 || index > HPACK_DEFAULT_TABLE_SIZE) {
+                ret = -1;
+
+                break;
+            }
+
+            t->max_size = (size_t)index;
+
+            table_evict(t, t->max_size);
+
+            continue;
+        }
+
+        // Literal: with incremental indexing (01), without (0000) or never indexed (0001).
+        int incremental = (b & 0xc0) == 0x40;
+
+        if (decode_int(in, len, &pos, incremental ? 6 : 4, &index) < 0) {
+            ret = -1;
+
+            break;
+        }
+
+        char* name_scratch = scratch;
+        char* value_scratch = scratch + name_room;
+
+        if (index > 0) {
+            const char* unused;
+            size_t unused_len;
+
+            if (table_get(t, index, &name, &name_len, &unused, &unused_len) < 0) {
+                ret = -1;
+
+                break;
+            }
+
+            // The name may belong to the entry the add below evicts.
+            memcpy(name_scratch, name, name_len);
+
+            name = name_scratch;
+        }
+        else if (decode_string(in, len, &pos, name_scratch, &name, &name_len) < 0) {
+            ret = -1;
+
+            break;
+        }
+
+        if (decode_string(in, len, &pos, value_scratch, &value, &value_len) < 0) {
+            ret = -1;
+
+            break;
+        }
+
+        cb(arg, name, name_len, value, value_len);
+
+        if (incremental) {
+            table_add(t, name, name_len, value, value_len);
+        }
+    }
+
+    free(scratch);
+
+    return ret;
+}
+
+void hpack_encoder_set_max(HpackTable* t, size_t max_size) {
+    if (max_size > HPACK_DEFAULT_TABLE_SIZE) {
+        max_size = HPACK_DEFAULT_TABLE_SIZE;
+    }
+
+    if (max_size != t->max_size) {
+        t->max_size = max_size;
+        t->size_update_pending = 1;
+
+        table_evict(t, max_size);
+    }
+}
+
+static int encode_int(uint8_t* out, size_t cap, uint8_t flags, int prefix, uint64_t v) {
+    uint64_t mask = (1u << prefix) - 1;
+    size_t n = 0;
+
+    if (cap == 0) {
+        return -1;
+    }
+
+    if (v < mask) {
+        out[n++] = (uint8_t)(flags | v);
+
+        return (int)n;
+    }
+
+    out[n++] = (uint8_t)(flags | mask);
+    v -= mask;
+
+    while (v >= 0x80) {
+        if (n >= cap) {
+            return -1;
+        }
+
+        out[n++] = (uint8_t)((v & 0x7f) | 0x80);
+        v >>= 7;
+    }
+
+    if (n >= cap) {
+        return -1;
+    }
+
+    out[n++] = (uint8_t)v;
+
+    return (int)n;
+}
+
+static int encode_string(uint8_t* out, size_t cap, const char* s, size_t len) {
+    size_t huffman = huffman_length(s, len);
+    int use_huffman = huffman < len;
+    size_t body = use_huffman ? huffman : len;
+    int n = encode_int(out, cap, use_huffman ? 0x80 : 0, 7, body);
+
+    if (n < 0 || (size_t)n + body > cap) {
+        return -1;
+    }
+
+    if (use_huffman) {
+        huffman_encode(s, len, out + n);
+    }
+    else {
+        memcpy(out + n, s, len);
+    }
+
+    return n + (int)body;
+}
+
+int hpack_encode_begin(HpackTable* t, uint8_t* out, size_t cap) {
+    if (!t->size_update_pending) {
+        return 0;
+    }
+
+    t->size_update_pending = 0;
+
+    return encode_int(out, cap, 0x20, 5, t->max_size);
+}
+
+int hpack_encode(HpackTable* t, uint8_t* out, size_t cap, const char* name, size_t name_len, const char* value, size_t value_len, int index) {
+    uint64_t name_index = 0;
+
+    for (int i = 0; i < HPACK_STATIC_ENTRIES; i++) {
+        const HpackStaticEntry* e = &g_static_table[i];
+
+        if (strlen(e->name) != name_len || memcmp(e->name, name, name_len) != 0) {
+            continue;
+        }
+
+        if (strlen(e->value) == value_len && memcmp(e->value, value, value_len) == 0) {
+            return encode_int(out, cap, 0x80, 7, (uint64_t)i + 1);
+        }
+
+        if (name_index == 0) {
+            name_index = (uint64_t)i + 1;
+        }
+    }
+
+    for (int i = 0; i < t->count; i++) {
+        const HpackEntry* e = &t->entries[(t->first + i) % HPACK_MAX_ENTRIES];
+
+        if (e->name_len != name_len || memcmp(e->name, name, name_len) != 0) {
+            continue;
+        }
+
+        if (e->value_len == value_len && memcmp(e->value, value, value_len) == 0) {
+            return encode_int(out, cap, 0x80, 7, (uint64_t)(HPACK_STATIC_ENTRIES + 1 + i));
+        }
+
+        if (name_index == 0) {
+            name_index = (uint64_t)(HPACK_STATIC_ENTRIES + 1 + i);
+        }
+    }
+
+    index = index && name_len + value_len + HPACK_ENTRY_OVERHEAD <= t->max_size;
+
+    int n = encode_int(out, cap, index ? 0x40 : 0x00, index ? 6 : 4, name_index);
+
+    if (n < 0) {
+        return -1;
+    }
+
+    if (name_index == 0) {
+        int s = encode_string(out + n, cap - n, name, name_len);
+
+        if (s < 0) {
+            return -1;
+        }
+
+        n += s;
+    }
+
+    int s = encode_string(out + n, cap - n, value, value_len);
+
+    if (s < 0) {
+        return -1;
+    }
+
+    if (index) {
+        table_add(t, name, name_len, value, value_len);
+    }
+
+    return n + s;
+}
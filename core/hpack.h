@@ -0,0 +1,51 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HPACK_DEFAULT_TABLE_SIZE 4096
+#define HPACK_STATIC_ENTRIES 61
+#define HPACK_ENTRY_OVERHEAD 32
+#define HPACK_MAX_ENTRIES (HPACK_DEFAULT_TABLE_SIZE / HPACK_ENTRY_OVERHEAD)
+
+typedef struct {
+    char* name;
+    char* value;
+    size_t name_len;
+    size_t value_len;
+} HpackEntry;
+
+// One direction's dynamic table (RFC 7541 section 2.3). Entries live in a ring, newest at first.
+typedef struct {
+    HpackEntry entries[HPACK_MAX_ENTRIES];
+    int first;
+    int count;
+    size_t size;
+    size_t max_size;
+
+    // Encoder only: the peer lowered the table size and the next block must say so.
+    int size_update_pending;
+} HpackTable;
+
+typedef void (*HpackHeaderCallback)(void* arg, const char* name, size_t name_len, const char* value, size_t value_len);
+
+void hpack_table_init(HpackTable* t);
+
+void hpack_table_free(HpackTable* t);
+
+// Decodes one complete header block, calling cb per field. Returns 0, or -1 on a compression
+// error, after which the table is out of sync and the connection must be closed.
+int hpack_decode(HpackTable* t, const uint8_t* in, size_t len, HpackHeaderCallback cb, void* arg);
+
+// Encoder side of SETTINGS_HEADER_TABLE_SIZE; sizes above the default are not used.
+void hpack_encoder_set_max(HpackTable* t, size_t max_size);
+
+// Starts a header block (a pending table size update goes first). Returns bytes written or -1.
+int hpack_encode_begin(HpackTable* t, uint8_t* out, size_t cap);
+
+// Appends one field. index adds it to the dynamic table, so a repeat costs one byte.
+// Returns bytes written, or -1 when out is too small.
+int hpack_encode(HpackTable* t, uint8_t* out, size_t cap, const char* name, size_t name_len, const char* value, size_t value_len, int index);
+
+#endif
@@ -0,0 +1,465 @@
+#include "server.h"
+#include <limits.h>
+
+typedef struct {
+    const char* name;
+    TokenBucket bucket;
+    uint64_t conn_rate;
+    int weight;
+    int64_t deficit;
+    ClientState* head;
+    ClientState* tail;
+    uint64_t bytes;
+    uint64_t parks;
+    int waiting;
+} QosClassState;
+
+#define PARKED_RATE 1
+#define PARKED_LINK 2
+
+static QosClassState g_classes[QOS_CLASS_COUNT] = {
+    [QOS_CLASS_NONE] = { .name = "none" },
+    [QOS_CLASS_LIVE] = { .name = "live", .weight = 8 },
+    [QOS_CLASS_INTERACTIVE] = { .name = "interactive", .weight = 4 },
+    [QOS_CLASS_BULK] = { .name = "bulk", .weight = 1 }
+};
+
+static TokenBucket g_link;
+static int g_pacing = 1;
+static int g_parked = 0;
+static int g_link_waiters = 0;
+static int g_rr = 0;
+static pthread_mutex_t g_qos_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void bucket_set_rate(TokenBucket* b, uint64_t rate) {
+    b->rate = rate;
+    b->burst = rate / 10 > QOS_MIN_BURST ? (double)(rate / 10) : QOS_MIN_BURST;
+    b->tokens = b->burst;
+    b->last_ns = 0;
+}
+
+static void bucket_refill(TokenBucket* b, uint64_t now) {
+    if (b->rate == 0) {
+        return;
+    }
+
+    if (b->last_ns != 0) {
+        b->tokens += (double)b->rate * (double)(now - b->last_ns) / 1e9;
+
+        if (b->tokens > b->burst) {
+            b->tokens = b->burst;
+        }
+    }
+
+    b->last_ns = now;
+}
+
+int qos_class_from_name(const char* name) {
+    for (int i = QOS_CLASS_LIVE; i < QOS_CLASS_COUNT; i++) {
+        if (strcasecmp(name, g_classes[i].name) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+int qos_parse_config(const char* key, const char* value) {
+    if (strcmp(key, "QOS_LINK_RATE") == 0) {
+        bucket_set_rate(&g_link, strtoull(value, NULL, 10));
+
+        printf("Config: QoS link rate = %llu bytes/s\n", (unsigned long long)g_link.rate);
+    }
+    else if (strcmp(key, "QOS_PACING") == 0) {
+        g_pacing = (strcasecmp(value, "on") == 0 || strcmp(value, "1") == 0);
+
+        printf("Config: QoS socket pacing %s\n", g_pacing ? "on" : "off");
+    }
+    else {
+        return -1;
+    }
+
+    return 0;
+}
+
+int qos_parse_class_config(const char* key, const char* class_name, const char* value) {
+    if (strcmp(key, "QOS_RATE") != 0 && strcmp(key, "QOS_CONN_RATE") != 0 && strcmp(key, "QOS_WEIGHT") != 0) {
+        return -1;
+    }
+
+    int cls = qos_class_from_name(class_name);
+
+    if (cls < 0) {
+        fprintf(stderr, "Config: Unknown QoS class %s\n", class_name);
+
+        return 0;
+    }
+
+    QosClassState* c = &g_classes[cls];
+
+    if (strcmp(key, "QOS_RATE") == 0) {
+        bucket_set_rate(&c->bucket, strtoull(value, NULL, 10));
+    }
+    else if (strcmp(key, "QOS_CONN_RATE") == 0) {
+        c->conn_rate = strtoull(value, NULL, 10);
+    }
+    else {
+        c->weight = atoi(value) > 0 ? atoi(value) : 1;
+    }
+
+    printf("Config: QoS %s %s = %s\n", c->name, key, value);
+
+    return 0;
+}
+
+static void qos_metrics_source(MetricsWriter* w) {
+    metrics_write_value(w, "qos_link_rate_bytes", "Egress link rate shared between classes (0 = unlimited)", g_link.rate);
+
+    pthread_mutex_lock(&g_qos_mutex);
+
+    for (int i = QOS_CLASS_LIVE; i < QOS_CLASS_COUNT; i++) {
+        metrics_write_labeled(w, "qos_class_bytes_total", "class", g_classes[i].name, g_classes[i].bytes);
+        metrics_write_labeled(w, "qos_class_parks_total", "class", g_classes[i].name, g_classes[i].parks);
+        metrics_write_labeled(w, "qos_class_waiting", "class", g_classes[i].name, (uint64_t)g_classes[i].waiting);
+    }
+
+    pthread_mutex_unlock(&g_qos_mutex);
+}
+
+void qos_init(void) {
+    metrics_register_source(qos_metrics_source);
+}
+
+static void park(ClientState* client, int reason) {
+    QosState* q = &client->qos;
+    QosClassState* c = &g_classes[q->cls];
+
+    if (q->parked) {
+        return;
+    }
+
+    q->parked = reason;
+    q->next = NULL;
+
+    if (c->tail) {
+        c->tail->qos.next = client;
+    }
+    else {
+        c->head = client;
+    }
+
+    c->tail = client;
+    c->parks++;
+    c->waiting++;
+
+    g_parked++;
+
+    if (reason == PARKED_LINK) {
+        g_link_waiters++;
+    }
+}
+
+static void unlink_parked(QosClassState* c, ClientState* client, ClientState* prev) {
+    if (prev) {
+        prev->qos.next = client->qos.next;
+    }
+    else {
+        c->head = client->qos.next;
+    }
+
+    if (c->tail == client) {
+        c->tail = prev;
+    }
+
+    if (client->qos.parked == PARKED_LINK) {
+        g_link_waiters--;
+    }
+
+    client->qos.next = NULL;
+    client->qos.parked = 0;
+
+    c->waiting--;
+
+    g_parked--;
+}
+
+// Caller holds g_qos_mutex. A parked client moves to the new class's queue.
+static void set_class(ClientState* client, QosClass cls) {
+    QosState* q = &client->qos;
+    int parked = q->parked;
+
+    if (parked) {
+        QosClassState* c = &g_classes[q->cls];
+        ClientState* prev = NULL;
+
+        for (ClientState* it = c->head; it && it != client; it = it->qos.next) {
+            prev = it;
+        }
+
+        unlink_parked(c, client, prev);
+    }
+
+    __atomic_store_n(&q->cls, cls, __ATOMIC_RELAXED);
+
+    bucket_set_rate(&q->bucket, g_classes[cls].conn_rate);
+
+    if (parked) {
+        park(client, parked);
+    }
+}
+
+void qos_classify(ClientState* client, QosClass cls) {
+    // An h2 stream has no socket; its bytes are paced on the session's connection, which keeps
+    // the most urgent class any of its streams asked for.
+    int upgrade_only = (client->stream != NULL);
+
+    if (upgrade_only) {
+        client = h2_stream_connection(client);
+    }
+
+    QosState* q = &client->qos;
+
+    if (client->fd < 0 || __atomic_load_n(&q->cls, __ATOMIC_RELAXED) == cls) {
+        return;
+    }
+
+    pthread_mutex_lock(&g_qos_mutex);
+
+    if (upgrade_only && q->cls != QOS_CLASS_NONE && q->cls <= cls) {
+        pthread_mutex_unlock(&g_qos_mutex);
+
+        return;
+    }
+
+    set_class(client, cls);
+
+    pthread_mutex_unlock(&g_qos_mutex);
+
+    uint64_t conn_rate = g_classes[cls].conn_rate;
+
+    // Lets the kernel spread a capped connection's packets out instead of bursting to the cap.
+    if (g_pacing) {
+        unsigned int pacing = (conn_rate == 0 || conn_rate > UINT_MAX) ? ~0U : (unsigned int)conn_rate;
+
+        setsockopt(client->fd, SOL_SOCKET, SO_MAX_PACING_RATE, &pacing, sizeof(pacing));
+    }
+}
+
+size_t qos_admit(ClientState* client, size_t want) {
+    QosState* q = &client->qos;
+
+    if (q->cls == QOS_CLASS_NONE || want == 0) {
+        return want;
+    }
+
+    pthread_mutex_lock(&g_qos_mutex);
+
+    if (q->parked) {
+        pthread_mutex_unlock(&g_qos_mutex);
+
+        return 0;
+    }
+
+    QosClassState* c = &g_classes[q->cls];
+    uint64_t now = metrics_now_ns();
+    double allowed = (double)want;
+    int reason = PARKED_RATE;
+
+    bucket_refill(&q->bucket, now);
+    bucket_refill(&c->bucket, now);
+
+    if (q->bucket.rate && q->bucket.tokens < allowed) {
+        allowed = q->bucket.tokens;
+    }
+
+    if (c->bucket.rate && c->bucket.tokens < allowed) {
+        allowed = c->bucket.tokens;
+    }
+
+    // Spare link capacity is free for the taking only while nobody queues for it; otherwise the
+    // tick's round-robin decides who goes next.
+    if (g_link.rate) {
+        bucket_refill(&g_link, now);
+
+        double room = (double)q->credit + ((g_link_waiters == 0 && g_link.tokens > 0) ? g_link.tokens : 0);
+
+        if (room < allowed) {
+            allowed = room;
+            reason = PARKED_LINK;
+        }
+    }
+
+    // A sliver of a write is not worth a syscall; wait for the tick to hand out a real grant.
+    if (allowed < QOS_MIN_WRITE && allowed < (double)want) {
+        allowed = 0;
+    }
+
+    if ((size_t)allowed < want) {
+        park(client, reason);
+    }
+
+    pthread_mutex_unlock(&g_qos_mutex);
+
+    return (size_t)allowed;
+}
+
+void qos_charge(ClientState* client, size_t sent) {
+    QosState* q = &client->qos;
+
+    if (sent == 0 || (q->cls == QOS_CLASS_NONE && g_link.rate == 0)) {
+        return;
+    }
+
+    pthread_mutex_lock(&g_qos_mutex);
+
+    if (q->cls != QOS_CLASS_NONE) {
+        QosClassState* c = &g_classes[q->cls];
+
+        q->bucket.tokens -= (double)sent;
+        c->bucket.tokens -= (double)sent;
+        c->bytes += sent;
+    }
+
+    if (g_link.rate) {
+        size_t from_credit = sent < q->credit ? sent : q->credit;
+
+        q->credit -= from_credit;
+        g_link.tokens -= (double)(sent - from_credit);
+    }
+
+    pthread_mutex_unlock(&g_qos_mutex);
+}
+
+void qos_forget(ClientState* client) {
+    if (!client->qos.parked) {
+        return;
+    }
+
+    pthread_mutex_lock(&g_qos_mutex);
+
+    QosClassState* c = &g_classes[client->qos.cls];
+    ClientState* prev = NULL;
+
+    for (ClientState* it = c->head; it; prev = it, it = it->qos.next) {
+        if (it == client) {
+            unlink_parked(c, client, prev);
+
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&g_qos_mutex);
+}
+
+// A parked client may go again once its own and its class's rate caps allow a useful write.
+static int eligible(QosClassState* c, ClientState* client, uint64_t now) {
+    TokenBucket* b = &client->qos.bucket;
+
+    bucket_refill(b, now);
+
+    if (b->rate && b->tokens < QOS_MIN_WRITE) {
+        return 0;
+    }
+
+    return c->bucket.rate == 0 || c->bucket.tokens >= QOS_MIN_WRITE;
+}
+
+static void wake(ClientState* client) {
+    struct epoll_event ev;
+    ev.data.ptr = client;
+
+    // Same interest set the client was waiting with, so the re-arm raises an EPOLLOUT for it.
+    if (client->state == STATE_PROXYING || client->h2) {
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    }
+    else if (client->state == STATE_STREAMING) {
+        ev.events = EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    }
+    else {
+        ev.events = EPOLLOUT | EPOLLET | EPOLLONESHOT;
+    }
+
+    // ENOENT means a worker still owns the client; its own re-arm picks up the credit.
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->fd, &ev);
+}
+
+int qos_tick(void) {
+    if (__atomic_load_n(&g_parked, __ATOMIC_RELAXED) == 0) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_qos_mutex);
+
+    uint64_t now = metrics_now_ns();
+
+    bucket_refill(&g_link, now);
+
+    for (int i = QOS_CLASS_LIVE; i < QOS_CLASS_COUNT; i++) {
+        bucket_refill(&g_classes[i].bucket, now);
+    }
+
+    // Deficit round-robin: every backlogged class earns QOS_GRANT * weight per round and spends
+    // it in QOS_GRANT-sized link grants, so under contention classes share the link by weight.
+    int served = 1;
+
+    while (served && g_parked > 0 && (g_link.rate == 0 || g_link.tokens >= QOS_MIN_WRITE)) {
+        served = 0;
+
+        for (int k = 0; k < QOS_CLASS_COUNT - 1; k++) {
+            QosClassState* c = &g_classes[QOS_CLASS_LIVE + (g_rr + k) % (QOS_CLASS_COUNT - 1)];
+            ClientState* prev = NULL;
+            ClientState* client = c->head;
+
+            if (!client) {
+                c->deficit = 0;
+
+                continue;
+            }
+
+            c->deficit += (int64_t)QOS_GRANT * c->weight;
+
+            while (client && c->deficit > 0 && (g_link.rate == 0 || g_link.tokens >= QOS_MIN_WRITE)) {
+                ClientState* next = client->qos.next;
+
+                if (!eligible(c, client, now)) {
+                    prev = client;
+                    client = next;
+
+                    continue;
+                }
+
+                unlink_parked(c, client, prev);
+
+                size_t grant = QOS_GRANT;
+
+                if (g_link.rate) {
+                    if ((double)grant > g_link.tokens) {
+                        grant = (size_t)g_link.tokens;
+                    }
+
+                    client->qos.credit += grant;
+                    g_link.tokens -= (double)grant;
+                }
+
+                c->deficit -= (int64_t)grant;
+
+                wake(client);
+
+                served++;
+                client = next;
+            }
+
+            if (!c->head) {
+                c->deficit = 0;
+            }
+        }
+
+        g_rr = (g_rr + 1) % (QOS_CLASS_COUNT - 1);
+    }
+
+    int waiting = g_parked > 0;
+
+    pthread_mutex_unlock(&g_qos_mutex);
+
+    return waiting ? QOS_TICK_MS : -1;
+}
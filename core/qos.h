@@ -0,0 +1,67 @@
+#ifndef QOS_H
+#define QOS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Returned by the output paths when QoS, not the socket, stopped a write; qos_tick re-arms the client.
+#define QOS_PARKED 2
+
+#define QOS_TICK_MS 2
+#define QOS_GRANT (16 * 1024)
+#define QOS_MIN_WRITE 4096
+#define QOS_MIN_BURST (64 * 1024)
+
+typedef enum {
+    QOS_CLASS_NONE,
+    QOS_CLASS_LIVE,
+    QOS_CLASS_INTERACTIVE,
+    QOS_CLASS_BULK,
+    QOS_CLASS_COUNT
+} QosClass;
+
+// Rate in bytes per second; 0 means unlimited.
+typedef struct {
+    uint64_t rate;
+    double tokens;
+    double burst;
+    uint64_t last_ns;
+} TokenBucket;
+
+struct ClientState;
+
+// Per-connection egress state. Link credit is handed out by the deficit round-robin in qos_tick.
+typedef struct {
+    QosClass cls;
+    TokenBucket bucket;
+    size_t credit;
+    int parked;
+    struct ClientState* next;
+} QosState;
+
+int qos_parse_config(const char* key, const char* value);
+
+// QOS_RATE / QOS_CONN_RATE / QOS_WEIGHT <class> <value>.
+int qos_parse_class_config(const char* key, const char* class_name, const char* value);
+
+int qos_class_from_name(const char* name);
+
+void qos_init(void);
+
+// Puts the connection in a class for its current response; also sets the socket's pacing rate.
+void qos_classify(struct ClientState* client, QosClass cls);
+
+// How many of want bytes may go out now. Anything less than want parks the client until
+// qos_tick has room for it again.
+size_t qos_admit(struct ClientState* client, size_t want);
+
+// Accounts bytes that actually left, including those of unclassified connections.
+void qos_charge(struct ClientState* client, size_t sent);
+
+void qos_forget(struct ClientState* client);
+
+// Event loop only: refills buckets, shares link capacity between classes and wakes parked
+// clients. Returns the epoll timeout to use, or -1 when nothing is waiting.
+int qos_tick(void);
+
+#endif
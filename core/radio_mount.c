@@ -0,0 +1,255 @@
+#include "server.h"
+#include "broadcast.h"
+#include <sys/eventfd.h>
+
+// One listener reading the ring behind the broadcaster. The list is only touched by the event
+// loop: a listener links itself on its first read and unlinks when its stream closes.
+typedef struct RadioListener {
+    ClientState* client;
+    uint64_t cursor;
+    size_t offset;
+    int linked;
+    struct RadioListener* prev;
+    struct RadioListener* next;
+} RadioListener;
+
+static char g_mount_path[256] = "";
+static char g_playlist[256] = BROADCAST_PLAYLIST;
+static int g_tick_fd = -1;
+static ClientState g_tick_cookie;
+static RadioListener* g_listeners = NULL;
+static int g_listener_count = 0;
+static uint64_t g_skipped_chunks = 0;
+static uint64_t g_burst_chunks = 0;
+
+static const char* RADIO_HEAD = "HTTP/1.1 200 OK\r\n"
+                                "Content-Type: audio/mpeg\r\n"
+                                "Transfer-Encoding: chunked\r\n"
+                                "Connection: keep-alive\r\n"
+                                "Cache-Control: no-cache, no-store\r\n"
+                                "Access-Control-Allow-Origin: *\r\n\r\n";
+
+int radio_mount_parse_config(const char* key, const char* value) {
+    if (strcmp(key, "RADIO_MOUNT") == 0) {
+        snprintf(g_mount_path, sizeof(g_mount_path), "%s", value);
+
+        printf("Config: Radio ring mounted in-process at %s\n", g_mount_path);
+    }
+    else if (strcmp(key, "RADIO_PLAYLIST") == 0) {
+        snprintf(g_playlist, sizeof(g_playlist), "%s", value);
+
+        printf("Config: Radio playlist %s\n", g_playlist);
+    }
+    else {
+        return broadcast_parse_config(key, value);
+    }
+
+    return 0;
+}
+
+int radio_mount_enabled(void) {
+    return g_mount_path[0] != '\0';
+}
+
+static void radio_metrics_source(MetricsWriter* w) {
+    metrics_write_value(w, "radio_mount_listeners", "Listeners attached to the in-process radio ring", (uint64_t)__atomic_load_n(&g_listener_count, __ATOMIC_RELAXED));
+    metrics_write_value(w, "radio_mount_skipped_chunks_total", "Ring chunks skipped by listeners that fell a full ring behind", g_skipped_chunks);
+    metrics_write_value(w, "radio_mount_burst_chunks_total", "Ring chunks sent to new listeners ahead of the live edge", __atomic_load_n(&g_burst_chunks, __ATOMIC_RELAXED));
+
+    BroadcastPacing* pacing = &g_broadcast_pacing;
+
+    metrics_write_value(w, "radio_pacing_ticks_total", "Broadcaster chunk deadlines waited on", __atomic_load_n(&pacing->ticks, __ATOMIC_RELAXED));
+    metrics_write_value(w, "radio_pacing_late_ticks_total", "Broadcaster wakes more than 1 ms past their deadline", __atomic_load_n(&pacing->late_ticks, __ATOMIC_RELAXED));
+    metrics_write_value(w, "radio_pacing_lateness_ns_total", "Summed broadcaster wake lateness; divide by ticks for mean jitter", __atomic_load_n(&pacing->lateness_ns_total, __ATOMIC_RELAXED));
+    metrics_write_value(w, "radio_pacing_lateness_max_ns", "Worst broadcaster wake lateness", __atomic_load_n(&pacing->lateness_ns_max, __ATOMIC_RELAXED));
+    metrics_write_value(w, "radio_pacing_drift_ns", "Broadcaster lag behind the stream clock at its last wake", __atomic_load_n(&pacing->drift_ns, __ATOMIC_RELAXED));
+    metrics_write_value(w, "radio_pacing_resyncs_total", "Stream clock re-anchors after a broadcaster stall", __atomic_load_n(&pacing->resyncs, __ATOMIC_RELAXED));
+}
+
+int radio_mount_init(void) {
+    struct epoll_event ev;
+
+    g_tick_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (g_tick_fd == -1) {
+        perror("eventfd");
+
+        return -1;
+    }
+
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = &g_tick_cookie;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, g_tick_fd, &ev) == -1) {
+        perror("epoll_ctl: add radio tick");
+
+        return -1;
+    }
+
+    metrics_register_source(radio_metrics_source);
+
+    if (broadcast_add_waiter(g_tick_fd, &g_listener_count) < 0) {
+        return -1;
+    }
+
+    return broadcast_start(g_playlist);
+}
+
+int radio_mount_matches(const char* path) {
+    return radio_mount_enabled() && strncmp(path, g_mount_path, strlen(g_mount_path)) == 0;
+}
+
+int radio_mount_is_tick(const ClientState* cookie) {
+    return cookie == &g_tick_cookie;
+}
+
+// Copies pre-framed chunks from just past the listener's cursor; offset is how much of the next
+// one already went. A listener a full ring behind has lost its place and resumes at the newest.
+static ssize_t radio_read(void* arg, int fd, char* buf, size_t cap) {
+    RadioListener* listener = (RadioListener*)arg;
+    size_t total = 0;
+
+    (void)fd;
+
+    if (!listener->linked) {
+        listener->next = g_listeners;
+
+        if (g_listeners) {
+            g_listeners->prev = listener;
+        }
+
+        g_listeners = listener;
+
+        __atomic_add_fetch(&g_listener_count, 1, __ATOMIC_RELAXED);
+
+        listener->linked = 1;
+    }
+
+    uint64_t newest = broadcast_newest();
+
+    while (listener->cursor < newest && total < cap) {
+        size_t framed;
+        ssize_t len = broadcast_read_slot(listener->cursor + 1, listener->offset, buf + total, cap - total, &framed);
+
+        if (len < 0) {
+            // The half-sent chunk has been overwritten; there is no way to finish its framing.
+            if (listener->offset > 0 || total > 0) {
+                errno = ECONNABORTED;
+
+                return -1;
+            }
+
+            newest = broadcast_newest();
+
+            g_skipped_chunks += newest - 1 - listener->cursor;
+
+            listener->cursor = newest - 1;
+
+            continue;
+        }
+
+        total += (size_t)len;
+        listener->offset += (size_t)len;
+
+        if (listener->offset == framed) {
+            listener->cursor++;
+            listener->offset = 0;
+        }
+    }
+
+    if (total == 0) {
+        errno = EAGAIN;
+
+        return -1;
+    }
+
+    return (ssize_t)total;
+}
+
+static void radio_close(void* arg, int fd) {
+    RadioListener* listener = (RadioListener*)arg;
+
+    (void)fd;
+
+    if (listener->linked) {
+        if (listener->prev) {
+            listener->prev->next = listener->next;
+        }
+        else {
+            g_listeners = listener->next;
+        }
+
+        if (listener->next) {
+            listener->next->prev = listener->prev;
+        }
+
+        __atomic_sub_fetch(&g_listener_count, 1, __ATOMIC_RELAXED);
+    }
+
+    free(listener);
+}
+
+static const ResponseProducer g_radio_producer = {
+    .read = radio_read,
+    .close = radio_close
+};
+
+void radio_mount_attach(ClientState* client) {
+    RadioListener* listener = (RadioListener*)calloc(1, sizeof(RadioListener));
+    char lead[BROADCAST_SLOT_SIZE];
+    size_t lead_len;
+
+    if (!listener || bufchain_append(&client->output, RADIO_HEAD, strlen(RADIO_HEAD)) < 0) {
+        free(listener);
+
+        cleanup_client(client);
+
+        return;
+    }
+
+    // The burst starts on a frame boundary partway into a chunk; that partial chunk is queued
+    // behind the head and the ring takes over from the next whole slot.
+    uint64_t first = broadcast_burst_start(lead, &lead_len);
+
+    if (lead_len > 0 && bufchain_append(&client->output, lead, lead_len) < 0) {
+        free(listener);
+
+        cleanup_client(client);
+
+        return;
+    }
+
+    listener->client = client;
+    listener->cursor = first - 1;
+
+    __atomic_add_fetch(&g_burst_chunks, broadcast_newest() - listener->cursor, __ATOMIC_RELAXED);
+
+    qos_classify(client, QOS_CLASS_LIVE);
+
+    // Slots are already framed as chunks, so they go out as they are.
+    if (response_stream_start(client, -1, &g_radio_producer, listener, 0) < 0) {
+        free(listener);
+
+        cleanup_client(client);
+    }
+}
+
+void radio_mount_event(void) {
+    uint64_t ticks;
+
+    while (read(g_tick_fd, &ticks, sizeof(ticks)) > 0) {
+    }
+
+    RadioListener* listener = g_listeners;
+
+    while (listener) {
+        // A failed pump frees the listener, so step past it first.
+        RadioListener* next = listener->next;
+
+        if (response_stream_pump(listener->client) < 0) {
+            cleanup_client(listener->client);
+        }
+
+        listener = next;
+    }
+}
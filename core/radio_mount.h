@@ -0,0 +1,26 @@
+#ifndef RADIO_MOUNT_H
+#define RADIO_MOUNT_H
+
+struct ClientState;
+
+// RADIO_MOUNT <path> runs the broadcast ring in-process and serves it at path; RADIO_PLAYLIST
+// overrides the looped file. Other RADIO_* keys go to broadcast_parse_config.
+int radio_mount_parse_config(const char* key, const char* value);
+
+int radio_mount_enabled(void);
+
+// Starts the broadcaster and registers its eventfd with the event loop.
+int radio_mount_init(void);
+
+int radio_mount_matches(const char* path);
+
+// Whether an epoll cookie is the ring's eventfd rather than a connection.
+int radio_mount_is_tick(const struct ClientState* cookie);
+
+// Worker side: queues the response head and hands the listener to the event loop.
+void radio_mount_attach(struct ClientState* client);
+
+// Event loop only, after a batch in which the ring advanced: feeds every listener.
+void radio_mount_event(void);
+
+#endif
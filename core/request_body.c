@@ -0,0 +1,248 @@
+#include "server.h"
+
+uint64_t g_request_body_limit = REQUEST_BODY_DEFAULT_LIMIT;
+
+int request_body_parse_config(const char* key, const char* value) {
+    if (strcmp(key, "MAX_REQUEST_BODY") != 0) {
+        return -1;
+    }
+
+    long long size = atoll(value);
+
+    g_request_body_limit = size > 0 ? (uint64_t)size : REQUEST_BODY_DEFAULT_LIMIT;
+
+    printf("Config: Request bodies up to %llu bytes\n", (unsigned long long)g_request_body_limit);
+
+    return 0;
+}
+
+void request_body_init(RequestBody* body) {
+    memset(body, 0, sizeof(RequestBody));
+
+    body->sink_fd = -1;
+    body->output_fd = -1;
+}
+
+int request_body_begin(RequestBody* body, const char* request, uint64_t limit) {
+    size_t te_len = 0;
+    size_t cl_len = 0;
+    const char* te = find_header_span(request, "\r\nTransfer-Encoding", &te_len);
+    const char* cl = find_header_span(request, "\r\nContent-Length", &cl_len);
+
+    body->limit = limit;
+    body->received = 0;
+
+    if (te) {
+        // Chunked must be the final coding, and a Content-Length next to it is a smuggling attempt.
+        if (cl || te_len < 7 || strncasecmp(te + te_len - 7, "chunked", 7) != 0) {
+            return REQUEST_BODY_MALFORMED;
+        }
+
+        body->framing = BODY_CHUNKED;
+
+        chunked_init(&body->chunked);
+    }
+    else if (cl) {
+        uint64_t length = 0;
+
+        if (cl_len == 0 || cl_len > 19) {
+            return REQUEST_BODY_MALFORMED;
+        }
+
+        for (size_t i = 0; i < cl_len; i++) {
+            if (cl[i] < '0' || cl[i] > '9') {
+                return REQUEST_BODY_MALFORMED;
+            }
+
+            length = length * 10 + (uint64_t)(cl[i] - '0');
+        }
+
+        if (length > limit) {
+            return REQUEST_BODY_TOO_LARGE;
+        }
+
+        body->framing = length > 0 ? BODY_LENGTH : BODY_NONE;
+        body->remaining = length;
+    }
+    else {
+        body->framing = BODY_NONE;
+    }
+
+    if (body->framing != BODY_NONE && !body->pending) {
+        body->pending = (char*)malloc(BUFFER_SIZE);
+
+        if (!body->pending) {
+            return REQUEST_BODY_ERROR;
+        }
+    }
+
+    body->pending_off = 0;
+    body->pending_len = 0;
+
+    return 0;
+}
+
+int request_body_expects_continue(const char* request) {
+    size_t len = 0;
+    const char* expect = find_header_span(request, "\r\nExpect", &len);
+
+    return expect && len == 12 && strncasecmp(expect, "100-continue", 12) == 0;
+}
+
+int request_body_done(const RequestBody* body) {
+    if (body->pending_off < body->pending_len) {
+        return 0;
+    }
+
+    if (body->framing == BODY_LENGTH) {
+        return body->remaining == 0;
+    }
+
+    if (body->framing == BODY_CHUNKED) {
+        return body->chunked.state == CHUNKED_DONE;
+    }
+
+    return 1;
+}
+
+// Decodes len bytes already sitting in body->pending.
+static int take_pending(RequestBody* body, size_t len) {
+    if (body->framing == BODY_LENGTH) {
+        if (len > body->remaining) {
+            len = (size_t)body->remaining;
+        }
+
+        body->remaining -= len;
+    }
+    else {
+        len = chunked_decode(&body->chunked, body->pending, len);
+
+        if (body->chunked.state == CHUNKED_ERROR) {
+            return REQUEST_BODY_MALFORMED;
+        }
+    }
+
+    body->received += len;
+    body->pending_off = 0;
+    body->pending_len = len;
+
+    metrics_count(METRIC_REQUEST_BODY_BYTES, len);
+
+    return body->received > body->limit ? REQUEST_BODY_TOO_LARGE : 0;
+}
+
+int request_body_feed(RequestBody* body, const char* data, size_t len) {
+    if (body->framing == BODY_NONE || len == 0) {
+        return 0;
+    }
+
+    if (len > BUFFER_SIZE) {
+        len = BUFFER_SIZE;
+    }
+
+    memcpy(body->pending, data, len);
+
+    return take_pending(body, len);
+}
+
+int request_body_pump(ClientState* client) {
+    RequestBody* body = &client->body;
+
+    while (1) {
+        while (body->pending_off < body->pending_len) {
+            ssize_t n = write(body->sink_fd, body->pending + body->pending_off, body->pending_len - body->pending_off);
+
+            if (n > 0) {
+                body->pending_off += n;
+
+                continue;
+            }
+
+            return (n < 0 && errno == EAGAIN) ? 1 : REQUEST_BODY_ERROR;
+        }
+
+        if (request_body_done(body)) {
+            return 0;
+        }
+
+        // Plaintext Content-Length bodies go socket to pipe without passing through user space.
+        if (body->framing == BODY_LENGTH && client->transport->splice_relay) {
+            size_t want = body->remaining < REQUEST_BODY_SPLICE_MAX ? (size_t)body->remaining : REQUEST_BODY_SPLICE_MAX;
+            ssize_t n = splice(client->fd, NULL, body->sink_fd, NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+            if (n > 0) {
+                body->remaining -= n;
+                body->received += n;
+
+                metrics_count(METRIC_BYTES_IN, n);
+                metrics_count(METRIC_REQUEST_BODY_BYTES, n);
+                metrics_count(METRIC_REQUEST_BODY_SPLICED, n);
+
+                continue;
+            }
+
+            // EAGAIN is either side: the socket is drained or the pipe is full. Both fds are watched.
+            return (n < 0 && errno == EAGAIN) ? 1 : REQUEST_BODY_ERROR;
+        }
+
+        size_t want = BUFFER_SIZE;
+
+        if (body->framing == BODY_LENGTH && body->remaining < want) {
+            want = (size_t)body->remaining;
+        }
+
+        ssize_t n = client->transport->read(client, body->pending, want);
+
+        if (n == TRANSPORT_AGAIN) {
+            // An h2 stream is dispatched with its whole body, so running dry means it was cut short.
+            return client->stream ? REQUEST_BODY_ERROR : 1;
+        }
+
+        if (n <= 0) {
+            return REQUEST_BODY_ERROR;
+        }
+
+        metrics_count(METRIC_BYTES_IN, n);
+
+        int ret = take_pending(body, (size_t)n);
+
+        if (ret < 0) {
+            return ret;
+        }
+    }
+}
+
+void request_body_reject(ClientState* client, int error) {
+    const char* response;
+
+    if (error == REQUEST_BODY_TOO_LARGE) {
+        response = "HTTP/1.1 413 Content Too Large\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    }
+    else if (error == REQUEST_BODY_MALFORMED) {
+        response = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    }
+    else {
+        return;
+    }
+
+    metrics_count(METRIC_REQUEST_BODY_REJECTED, 1);
+
+    client_send(client, response, strlen(response));
+    client_write_pending(client);
+}
+
+void request_body_close(RequestBody* body) {
+    if (body->sink_fd >= 0) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, body->sink_fd, NULL);
+
+        close(body->sink_fd);
+    }
+
+    if (body->output_fd >= 0) {
+        close(body->output_fd);
+    }
+
+    free(body->pending);
+
+    request_body_init(body);
+}
@@ -0,0 +1,67 @@
+#ifndef REQUEST_BODY_H
+#define REQUEST_BODY_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "chunked.h"
+
+#define REQUEST_BODY_DEFAULT_LIMIT (8 * 1024 * 1024)
+#define REQUEST_BODY_SPLICE_MAX (64 * 1024)
+
+#define REQUEST_BODY_ERROR -1
+#define REQUEST_BODY_MALFORMED -2
+#define REQUEST_BODY_TOO_LARGE -3
+
+typedef enum {
+    BODY_NONE,
+    BODY_LENGTH,
+    BODY_CHUNKED
+} BodyFraming;
+
+struct ClientState;
+
+// A request body on its way into a CGI's stdin. The worker starts it with whatever arrived
+// alongside the headers; the event loop pumps the rest, then hands output_fd back to a worker.
+typedef struct {
+    BodyFraming framing;
+    uint64_t remaining;
+    uint64_t received;
+    uint64_t limit;
+    ChunkedDecoder chunked;
+    int sink_fd;
+    int output_fd;
+    pid_t pid;
+
+    // Decoded bytes read but not yet accepted by the pipe.
+    char* pending;
+    size_t pending_off;
+    size_t pending_len;
+} RequestBody;
+
+extern uint64_t g_request_body_limit;
+
+int request_body_parse_config(const char* key, const char* value);
+
+void request_body_init(RequestBody* body);
+
+// Works out the framing from the request head. Returns 0, REQUEST_BODY_MALFORMED when it is
+// ambiguous (both Content-Length and chunked, or an unknown coding), or REQUEST_BODY_TOO_LARGE.
+int request_body_begin(RequestBody* body, const char* request, uint64_t limit);
+
+int request_body_expects_continue(const char* request);
+
+// Takes body bytes that were read together with the headers.
+int request_body_feed(RequestBody* body, const char* data, size_t len);
+
+int request_body_done(const RequestBody* body);
+
+// Moves body bytes from the client into sink_fd; plaintext Content-Length bodies are spliced
+// socket to pipe. Returns 0 when the body is complete, 1 to wait for either fd, or an error.
+int request_body_pump(struct ClientState* client);
+
+// Answers a failed body with 400 or 413; the connection must be closed afterwards.
+void request_body_reject(struct ClientState* client, int error);
+
+void request_body_close(RequestBody* body);
+
+#endif
@@ -0,0 +1,1290 @@
+#include "server.h"
+#include <sys/stat.h>
+#include <limits.h>
+#include <sys/wait.h>
+#include <poll.h>
+
+RouteRule g_routes[MAX_ROUTES];
+int g_route_count = 0;
+
+int client_send(ClientState* client, const char* response, size_t len) {
+    request_write_begin(client);
+
+    // Keep ordering: once anything is queued, later writes go behind it.
+    if (client->output.len > 0) {
+        return bufchain_append(&client->output, response, len) < 0 ? -1 : 1;
+    }
+
+    while (len > 0) {
+        size_t allowed = qos_admit(client, len);
+
+        if (allowed == 0) {
+            return bufchain_append(&client->output, response, len) < 0 ? -1 : 1;
+        }
+
+        ssize_t sent = client->transport->write(client, response, allowed);
+
+        if (sent == TRANSPORT_AGAIN) {
+            return bufchain_append(&client->output, response, len) < 0 ? -1 : 1;
+        }
+
+        if (sent <= 0) {
+            return -1;
+        }
+
+        metrics_count(METRIC_BYTES_OUT, sent);
+
+        qos_charge(client, sent);
+
+        response += sent;
+        len -= sent;
+    }
+
+    return 0;
+}
+
+// Returns 0 when the file body is fully sent, 1 when the socket is full, QOS_PARKED, -1 on error.
+int client_sendfile_continue(ClientState* client) {
+    while (client->sendfile_remaining > 0) {
+        size_t allowed = qos_admit(client, client->sendfile_remaining);
+
+        if (allowed == 0) {
+            return QOS_PARKED;
+        }
+
+        ssize_t sent = client->transport->sendfile(client, fileno(client->sendfile_stream), client->sendfile_offset, allowed);
+
+        if (sent > 0) {
+            metrics_count(METRIC_BYTES_OUT, sent);
+
+            qos_charge(client, sent);
+
+            client->sendfile_offset += sent;
+            client->sendfile_remaining -= (size_t)sent;
+
+            continue;
+        }
+
+        return sent == TRANSPORT_AGAIN ? 1 : -1;
+    }
+
+    fclose(client->sendfile_stream);
+
+    client->sendfile_stream = NULL;
+
+    return 0;
+}
+
+static char* find_header_value(char* request, const char* header_name) {
+    char* header_line = strcasestr(request, header_name);
+
+    if (!header_line) {
+        return NULL;
+    }
+
+    char* value_start = strchr(header_line, ':');
+    
+    if (!value_start) {
+        return NULL;
+    }
+
+    value_start++;
+
+    while (*value_start == ' ') {
+        value_start++;
+    }
+
+    char* value_end = strstr(value_start, "\r\n");
+
+    if (!value_end) {
+        return NULL;
+    }
+
+    *value_end = '\0';
+    char* value = strdup(value_start);
+    *value_end = '\r';
+
+    return value;
+}
+
+// Same lookup as find_header_value, but points into the request instead of copying.
+const char* find_header_span(const char* request, const char* header_name, size_t* len) {
+    const char* header_line = strcasestr(request, header_name);
+
+    if (!header_line) {
+        return NULL;
+    }
+
+    const char* value_start = strchr(header_line, ':');
+
+    if (!value_start) {
+        return NULL;
+    }
+
+    value_start++;
+
+    while (*value_start == ' ') {
+        value_start++;
+    }
+
+    const char* value_end = strstr(value_start, "\r\n");
+
+    if (!value_end) {
+        return NULL;
+    }
+
+    *len = (size_t)(value_end - value_start);
+
+    return value_start;
+}
+
+static void send_401_unauthorized(int client_socket, ClientState* client) {
+    const char* response = "HTTP/1.1 401 Unauthorized\r\n"
+                           "WWW-Authenticate: Basic realm=\"My Protected Server\"\r\n"
+                           "Content-Length: 0\r\n\r\n";
+
+    client_send(client, response, strlen(response));
+}
+
+static void send_404_not_found(int client_socket, ClientState* client) {
+    char response[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+
+    client_send(client, response, strlen(response));
+}
+
+static void send_502_bad_gateway(int client_socket, ClientState* client) {
+    char response[] = "HTTP/1.1 502 Bad Gateway\r\nContent-Length: 0\r\n\r\n";
+
+    client_send(client, response, strlen(response));
+}
+
+static void send_503_service_unavailable(ClientState* client) {
+    char response[] = "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\nContent-Length: 0\r\n\r\n";
+
+    client_send(client, response, strlen(response));
+}
+
+static const char* get_content_type(const char* path) {
+    if (strstr(path, ".html")) {
+        return "text/html";
+    }
+
+    if (strstr(path, ".css")) {
+        return "text/css";
+    }
+
+    if (strstr(path, ".js")) {
+        return "application/javascript";
+    }
+
+    if (strstr(path, ".mp3")) {
+        return "audio/mpeg";
+    }
+
+    if (strstr(path, ".jpg")) {
+        return "image/jpeg";
+    }
+
+    if (strstr(path, ".png")) {
+        return "image/png";
+    }
+
+    return "application/octet-stream";
+}
+
+static void serve_static_file(int client_socket, char* request_buffer, const char* path_prefix, const char* requested_path, ClientState* client) {
+    char full_path[512];
+    char resolved_path[PATH_MAX];
+    char resolved_prefix[PATH_MAX];
+
+    snprintf(full_path, sizeof(full_path), "%s%s", path_prefix, requested_path);
+
+    if (realpath(full_path, resolved_path) == NULL) {
+        send_404_not_found(client_socket, client);
+
+        return;
+    }
+
+    if (realpath(path_prefix, resolved_prefix) == NULL) {
+        perror("FATAL: realpath failed for path_prefix");
+
+        send_502_bad_gateway(client_socket, client);
+        
+        return;
+    }
+
+    if (strncmp(resolved_path, resolved_prefix, strlen(resolved_prefix)) != 0) {
+        send_404_not_found(client_socket, client);
+
+        return;
+    }
+    
+    const char* content_type = get_content_type(resolved_path);
+    FILE* file = fopen(resolved_path, "rb");
+
+    if (file == NULL) {
+        send_404_not_found(client_socket, client);
+
+        return;
+    }
+
+    struct stat file_stat;
+    if (fstat(fileno(file), &file_stat) < 0) {
+        perror("fstat");
+
+        fclose(file);
+
+        send_404_not_found(client_socket, client);
+
+        return;
+    }
+
+    long file_size = file_stat.st_size;
+    char header[512];
+    long start_byte = 0;
+    long end_byte = file_size - 1;
+    int status_code = 200;
+    char* range_header = find_header_value(request_buffer, "Range");
+
+    if (range_header) {
+        status_code = 206;
+        
+        if (sscanf(range_header, "bytes=%ld-%ld", &start_byte, &end_byte) == 2) {
+            
+        } 
+        else if (sscanf(range_header, "bytes=%ld-", &start_byte) == 1) {
+            end_byte = file_size - 1;
+        }
+
+        fseek(file, start_byte, SEEK_SET);
+        free(range_header);
+    }
+
+    long content_length = (end_byte - start_byte) + 1;
+
+    snprintf(header, sizeof(header),
+             "HTTP/1.1 %d %s\r\n"
+             "Content-Type: %s\r\n"
+             "Content-Length: %ld\r\n"
+             "Accept-Ranges: bytes\r\n"
+             "Content-Range: bytes %ld-%ld/%ld\r\n"
+             "Connection: keep-alive\r\n\r\n",
+             status_code, (status_code == 200 ? "OK" : "Partial Content"),
+             content_type,
+             content_length,
+             start_byte, end_byte, file_size);
+
+    if (client_send(client, header, strlen(header)) < 0) {
+        fclose(file);
+
+        return; 
+    }
+
+    // The body goes straight from the page cache (kTLS encrypts it in the kernel); the header must be out first.
+    if (client->output.len == 0 && content_length > 0 && start_byte >= 0 && client->transport->can_sendfile(client)) {
+        if (client->ssl) {
+            metrics_count(METRIC_TLS_STATIC_KTLS, 1);
+        }
+
+        printf("Worker Thread: Sending %s via %s sendfile\n", requested_path, client->transport->name);
+
+        client->sendfile_stream = file;
+        client->sendfile_offset = start_byte;
+        client->sendfile_remaining = (size_t)content_length;
+
+        if (client_sendfile_continue(client) < 0) {
+            fclose(client->sendfile_stream);
+
+            client->sendfile_stream = NULL;
+        }
+
+        return;
+    }
+
+    if (client->ssl) {
+        metrics_count(METRIC_TLS_STATIC_USERSPACE, 1);
+    }
+
+    char file_buffer[BUFFER_SIZE];
+    size_t bytes_read;
+    int transfer_complete = 1;
+
+    if (client->output.len == 0) {
+        while (!feof(file)) {
+            bytes_read = fread(file_buffer, 1, BUFFER_SIZE, file);
+            
+            if (bytes_read == 0) {
+                break;
+            }
+
+            int ret = client_send(client, file_buffer, bytes_read);
+            
+            if (ret < 0) {
+                fclose(file);
+                
+                return;
+            }
+            
+            if (ret == 1) {
+                client->file_stream = file;
+                transfer_complete = 0;
+
+                break;
+            }
+        }
+    }
+    else {
+        client->file_stream = file;
+        transfer_complete = 0;
+    }
+
+    if (transfer_complete) {
+        fclose(file);
+
+        client->file_stream = NULL;
+    }
+}
+
+// Relays the CGI's stdout to the client. Runs on a worker, either straight after the fork or
+// once the event loop has finished feeding the request body.
+// Returns 1 once the output is handed to the event loop (or the client closed), 0 when done here.
+static int send_cgi_output(ClientState* client) {
+    pid_t pid = client->body.pid;
+
+    // HTTP/1 clients get the pipe streamed by the event loop, so a CGI that runs for minutes
+    // costs a connection rather than a worker. h2 streams keep draining it here.
+    if (!client->stream) {
+        int output_fd = client->body.output_fd;
+
+        client->body.output_fd = -1;
+        client->is_cgi = 1;
+
+        if (response_stream_start(client, output_fd, NULL, NULL, 0) == 0) {
+            return 1;
+        }
+
+        close(output_fd);
+
+        cleanup_client(client);
+
+        return 1;
+    }
+
+    FILE* pipe = fdopen(client->body.output_fd, "r");
+
+    if (!pipe) {
+        perror("fdopen");
+
+        return 0;
+    }
+
+    client->body.output_fd = -1;
+
+    char buffer[1024];
+    size_t bytes_read;
+    client->is_cgi = 0;
+
+    while ((bytes_read = fread(buffer, 1, sizeof(buffer), pipe)) > 0) {
+        if (client_send(client, buffer, bytes_read) < 0) {
+            fclose(pipe);
+
+            return 0;
+        }
+
+        // Park the pipe at the cap; the event loop reads more as the client drains the buffer.
+        // SIGCHLD is ignored, so the child is reaped on exit without a waitpid.
+        if (client->output.len >= g_output_buffer_cap) {
+            metrics_count(METRIC_OUTPUT_PAUSES, 1);
+
+            client->file_stream = pipe;
+            client->is_cgi = 1;
+
+            return 0;
+        }
+    }
+
+    fclose(pipe);
+
+    waitpid(pid, NULL, 0);
+
+    trace_point(client->trace, TRACE_CGI_EXIT);
+
+    return 0;
+}
+
+// Hands a body that outlasted the headers to the event loop, which wakes on either the client
+// socket or the CGI's stdin pipe.
+static int stream_cgi_body(ClientState* client) {
+    struct epoll_event ev;
+    ev.data.ptr = client;
+
+    client->state = STATE_REQUEST_BODY;
+
+    ev.events = EPOLLOUT | EPOLLET;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client->body.sink_fd, &ev) == -1) {
+        perror("epoll_ctl: add cgi stdin");
+
+        return -1;
+    }
+
+    ev.events = EPOLLIN | EPOLLET;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client->fd, &ev) == -1) {
+        perror("epoll_ctl: add body client");
+
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->body.sink_fd, NULL);
+
+        return -1;
+    }
+
+    return 0;
+}
+
+// h2 streams arrive with the whole body buffered, so the worker only waits for the pipe to drain.
+static int pump_body_blocking(ClientState* client) {
+    int ret = request_body_pump(client);
+
+    while (ret == 1) {
+        struct pollfd pfd = { .fd = client->body.sink_fd, .events = POLLOUT };
+
+        if (poll(&pfd, 1, 2000) <= 0) {
+            printf("Worker Thread: Timeout feeding CGI stdin\n");
+
+            return REQUEST_BODY_ERROR;
+        }
+
+        ret = request_body_pump(client);
+    }
+
+    return ret;
+}
+
+// Returns 1 when the client is no longer the worker's to rearm: it was closed, or the event loop
+// owns it while the body arrives or the output streams out.
+static int handle_cgi_request(int client_socket, char* request_buffer, const char* path_prefix, const char* requested_path, RouteRule* rule, ClientState* client) {
+    char full_path[512];
+
+    snprintf(full_path, sizeof(full_path), "./%s%s", path_prefix, requested_path + strlen(path_prefix));
+
+    struct stat st;
+
+    if (stat(full_path, &st) < 0 || !(st.st_mode & S_IXUSR)) {
+        send_404_not_found(client_socket, client);
+
+        return 0;
+    }
+
+    char* method = "GET";
+
+    if (strncmp(request_buffer, "POST", 4) == 0) {
+        method = "POST";
+    }
+
+    RequestBody* body = &client->body;
+    int body_ret = request_body_begin(body, request_buffer, rule->max_body ? rule->max_body : g_request_body_limit);
+
+    if (body_ret < 0) {
+        request_body_reject(client, body_ret);
+
+        cleanup_client(client);
+
+        return 1;
+    }
+
+    char* header_end = strstr(request_buffer, "\r\n\r\n");
+    size_t header_len = header_end ? (size_t)(header_end + 4 - request_buffer) : client->bytes_read;
+    char* body_start = request_buffer + header_len;
+    size_t body_in_buffer = client->bytes_read > header_len ? client->bytes_read - header_len : 0;
+
+    body_ret = request_body_feed(body, body_start, body_in_buffer);
+
+    if (body_ret < 0) {
+        request_body_reject(client, body_ret);
+
+        cleanup_client(client);
+
+        return 1;
+    }
+
+    // Only ask for the body once the limit check passed; a client that sent it already needs no prompt.
+    if (!request_body_done(body) && !client->stream && request_body_expects_continue(request_buffer)) {
+        char response[] = "HTTP/1.1 100 Continue\r\n\r\n";
+
+        metrics_count(METRIC_EXPECT_CONTINUE, 1);
+
+        client_send(client, response, strlen(response));
+    }
+
+    int input_pipe[2], output_pipe[2];
+    int exec_pipe[2] = { -1, -1 };
+
+    if (client->trace && pipe2(exec_pipe, O_CLOEXEC) < 0) {
+        exec_pipe[0] = exec_pipe[1] = -1;
+    }
+
+    // CLOEXEC keeps other concurrently forked CGIs from holding this stdin open past our close.
+    if (pipe2(input_pipe, O_CLOEXEC) < 0 || pipe2(output_pipe, O_CLOEXEC) < 0) {
+        perror("pipe");
+
+        if (exec_pipe[0] != -1) {
+            close(exec_pipe[0]);
+            close(exec_pipe[1]);
+        }
+
+        char response[] = "HTTP/1.1 500 Internal Server Error\r\n\r\n";
+
+        client_send(client, response, strlen(response));
+
+        return 0;
+    }
+
+    trace_point(client->trace, TRACE_CGI_FORK);
+
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        perror("fork");
+
+        close(input_pipe[0]);
+        close(input_pipe[1]);
+        close(output_pipe[0]);
+        close(output_pipe[1]);
+
+        if (exec_pipe[0] != -1) {
+            close(exec_pipe[0]);
+            close(exec_pipe[1]);
+        }
+
+        char response[] = "HTTP/1.1 500 Internal Server Error\r\n\r\n";
+
+        client_send(client, response, strlen(response));
+
+        return 0;
+    }
+
+    if (pid == 0) {
+        dup2(input_pipe[0], STDIN_FILENO);
+        dup2(output_pipe[1], STDOUT_FILENO);
+
+        setenv("REQUEST_METHOD", method, 1);
+
+        // A chunked body has no length up front; the script reads stdin to EOF instead.
+        if (body->framing != BODY_CHUNKED) {
+            char len_str[32];
+
+            snprintf(len_str, sizeof(len_str), "%llu", (unsigned long long)(body->received + body->remaining));
+
+            setenv("CONTENT_LENGTH", len_str, 1);
+        }
+
+        char* query_string = "";
+        char* query_start = strchr(request_buffer, '?');
+
+        if (query_start) {
+            char* query_end = strchr(query_start, ' ');
+
+            if (query_end) {
+                *query_end = '\0';
+                query_string = query_start + 1;
+            }
+        }
+
+        setenv("QUERY_STRING", query_string, 1);
+
+        char* auth_header = find_header_value(request_buffer, "Authorization");
+
+        if (auth_header) {
+            setenv("HTTP_AUTHORIZATION", auth_header, 1);
+
+            free(auth_header);
+        }
+
+        execl(full_path, full_path, NULL);
+        exit(1);
+    }
+
+    close(input_pipe[0]);
+    close(output_pipe[1]);
+
+    if (exec_pipe[0] != -1) {
+        char exec_marker;
+
+        close(exec_pipe[1]);
+
+        // The CLOEXEC write end closes when the child execs, so EOF marks the exec.
+        while (read(exec_pipe[0], &exec_marker, 1) < 0 && errno == EINTR) {
+        }
+
+        trace_point(client->trace, TRACE_CGI_EXEC);
+
+        close(exec_pipe[0]);
+    }
+
+    body->sink_fd = input_pipe[1];
+    body->output_fd = output_pipe[0];
+    body->pid = pid;
+
+    set_nonblock(body->sink_fd);
+
+    body_ret = client->stream ? pump_body_blocking(client) : request_body_pump(client);
+
+    if (body_ret == 1) {
+        if (stream_cgi_body(client) == 0) {
+            return 1;
+        }
+
+        body_ret = REQUEST_BODY_ERROR;
+    }
+
+    if (body_ret < 0) {
+        printf("Worker Thread: Client closed during request body\n");
+
+        request_body_reject(client, body_ret);
+
+        cleanup_client(client);
+
+        return 1;
+    }
+
+    close(body->sink_fd);
+
+    body->sink_fd = -1;
+
+    metrics_observe_since(METRIC_HIST_ROUTE_CGI, client->t_dequeue);
+
+    return send_cgi_output(client);
+}
+
+static void send_internal_response(const char* content_type, const char* body, size_t body_len, ClientState* client) {
+    char header[256];
+
+    snprintf(header, sizeof(header),
+             "HTTP/1.1 200 OK\r\n"
+             "Content-Type: %s\r\n"
+             "Content-Length: %zu\r\n"
+             "Cache-Control: no-store\r\n"
+             "Connection: keep-alive\r\n\r\n",
+             content_type, body_len);
+
+    if (client_send(client, header, strlen(header)) >= 0) {
+        client_send(client, body, body_len);
+    }
+}
+
+static void serve_stats(char* request_buffer, ClientState* client) {
+    MetricsFormat format = metrics_format_from_request(request_buffer);
+    char* body = (char*)malloc(METRICS_RENDER_SIZE);
+
+    if (!body) {
+        send_502_bad_gateway(client->fd, client);
+
+        return;
+    }
+
+    size_t body_len = metrics_render(body, METRICS_RENDER_SIZE, format);
+
+    send_internal_response(format == METRICS_FORMAT_JSON ? "application/json" : "text/plain; version=0.0.4", body, body_len, client);
+
+    free(body);
+}
+
+static void serve_trace(ClientState* client) {
+    size_t body_len = 0;
+    char* body = trace_render_chrome(&body_len);
+
+    if (!body) {
+        send_502_bad_gateway(client->fd, client);
+
+        return;
+    }
+
+    send_internal_response("application/json", body, body_len, client);
+
+    free(body);
+}
+
+static int check_authentication(int client_socket, char* request_buffer, ClientState* client) {
+    size_t auth_len = 0;
+    const char* auth_header = find_header_span(request_buffer, "Authorization", &auth_len);
+    int authorized = auth_header && credentials_check(auth_header, auth_len);
+
+    if (!authorized) {
+        printf("Worker Thread: Auth failed. Sending 401.\n");
+
+        send_401_unauthorized(client_socket, client);
+    }
+
+    return authorized;
+}
+
+static void rearm_after_response(ClientState* client) {
+    if (client->stream) {
+        h2_stream_response_done(client);
+
+        return;
+    }
+
+    struct epoll_event ev;
+    ev.data.ptr = client;
+
+    // No EPOLLIN while a response body is in flight, so a pipelined request waits its turn.
+    if (client->output.len > 0 || client->file_stream != NULL || client->sendfile_stream != NULL) {
+        ev.events = EPOLLOUT | EPOLLET | EPOLLONESHOT;
+    }
+    else if (client->want_write) {
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLONESHOT;
+    }
+    else {
+        request_write_end(client);
+
+        client->state = STATE_READ_REQUEST;
+        client->bytes_read = 0;
+
+        bzero(client->buffer, BUFFER_SIZE);
+
+        ev.events = EPOLLIN | EPOLLET | EPOLLONESHOT;
+    }
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client->fd, &ev) == -1) {
+        // May still be parked in a QoS class, and owns its output chain, streams and trace.
+        cleanup_client(client);
+    }
+}
+
+static void finish_proxy_attempt(ClientState* client) {
+    trace_commit(client->trace);
+
+    client->trace = NULL;
+    client->state = STATE_READ_REQUEST;
+    client->bytes_read = 0;
+
+    bzero(client->buffer, BUFFER_SIZE);
+
+    rearm_after_response(client);
+}
+
+static void abort_proxy(ClientState* client, ClientState* upstream_state, int connected) {
+    if (connected) {
+        upstream_release(upstream_state->upstream, upstream_state->fd, 0);
+    }
+    else {
+        close(upstream_state->fd);
+    }
+
+    free(upstream_state);
+
+    client->peer = NULL;
+
+    send_502_bad_gateway(client->fd, client);
+
+    finish_proxy_attempt(client);
+}
+
+static int forward_proxy_request(ClientState* client, ClientState* upstream_state) {
+    ssize_t sent = send(upstream_state->fd, client->buffer, client->bytes_read, MSG_NOSIGNAL);
+
+    if (sent != (ssize_t)client->bytes_read) {
+        perror("proxy: send");
+
+        return -1;
+    }
+
+    upstream_request_sent(&upstream_state->response, client->buffer, client->bytes_read);
+
+    printf("[Proxy] Forwarded %ld bytes to %s\n", sent, upstream_state->upstream->name);
+
+    return 0;
+}
+
+static int start_proxy_relay(ClientState* client, ClientState* upstream_state, int upstream_op) {
+    client->state = STATE_PROXYING;
+    upstream_state->state = STATE_PROXYING;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.ptr = upstream_state;
+
+    if (epoll_ctl(epoll_fd, upstream_op, upstream_state->fd, &ev) == -1) {
+        perror("epoll_ctl: upstream_socket");
+
+        return -1;
+    }
+
+    // An h2 stream has no socket; its session's scheduler re-arms the upstream instead.
+    if (client->stream) {
+        return 0;
+    }
+
+    // Only the event loop touches the client while proxying, so it drops EPOLLONESHOT until the relay ends.
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.ptr = client;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client->fd, &ev) == -1) {
+        perror("epoll_ctl: re-add proxy client");
+    }
+
+    return 0;
+}
+
+// Pooled connections are used right away; fresh ones finish connecting in the event loop.
+static void handle_proxy_request_async(ClientState* client, RouteRule* rule) {
+    Upstream* up = rule->upstreams ? upstream_group_pick(rule->upstreams, client->addr_hash) : NULL;
+    int reused = 0;
+    int upstream_socket = -1;
+
+    trace_point(client->trace, TRACE_PROXY_CONNECT_START);
+
+    if (up) {
+        upstream_socket = upstream_acquire(up, &reused);
+    }
+
+    if (upstream_socket < 0) {
+        if (up && errno == EAGAIN) {
+            printf("[Proxy] Too many connects in flight to %s. Sending 503.\n", up->name);
+
+            send_503_service_unavailable(client);
+        }
+        else if (up && errno == EBUSY) {
+            printf("[Proxy] Accept backlog of %s is full. Sending 503.\n", up->name);
+
+            send_503_service_unavailable(client);
+        }
+        else {
+            send_502_bad_gateway(client->fd, client);
+        }
+
+        finish_proxy_attempt(client);
+
+        return;
+    }
+
+    printf("[Proxy] %s connection to %s (fd=%d)\n", reused ? "Reusing" : "Opening", up->name, upstream_socket);
+
+    ClientState* upstream_state = create_client_state(upstream_socket);
+    upstream_state->is_upstream = 1;
+    upstream_state->upstream = up;
+    upstream_state->peer = client;
+    client->peer = upstream_state;
+
+    upstream_response_begin(&upstream_state->response);
+
+    if (reused) {
+        trace_point(client->trace, TRACE_PROXY_CONNECT);
+
+        if (forward_proxy_request(client, upstream_state) < 0 || start_proxy_relay(client, upstream_state, EPOLL_CTL_ADD) < 0) {
+            abort_proxy(client, upstream_state, 1);
+        }
+
+        return;
+    }
+
+    upstream_state->state = STATE_UPSTREAM_CONNECTING;
+
+    struct epoll_event ev;
+    ev.events = EPOLLOUT | EPOLLET;
+    ev.data.ptr = upstream_state;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, upstream_socket, &ev) == -1) {
+        perror("epoll_ctl: add upstream_socket");
+
+        upstream_connect_done(up, 0);
+
+        abort_proxy(client, upstream_state, 0);
+    }
+}
+
+void proxy_connect_complete(ClientState* upstream_state) {
+    ClientState* client = upstream_state->peer;
+    int ok = (upstream_finish_connect(upstream_state->fd) == 0);
+
+    if (!ok) {
+        perror("proxy: connect");
+    }
+
+    upstream_connect_done(upstream_state->upstream, ok);
+
+    if (!ok) {
+        abort_proxy(client, upstream_state, 0);
+
+        return;
+    }
+
+    trace_point(client->trace, TRACE_PROXY_CONNECT);
+
+    if (forward_proxy_request(client, upstream_state) < 0 || start_proxy_relay(client, upstream_state, EPOLL_CTL_MOD) < 0) {
+        abort_proxy(client, upstream_state, 1);
+    }
+}
+
+void load_config_file(const char* filename) {
+    printf("Loading config file: %s\n", filename);
+
+    FILE* file = fopen(filename, "r");
+
+    if (file == NULL) {
+        perror("FATAL: Could not open server.conf");
+
+        exit(1);
+    }
+
+    char line[512];
+    g_route_count = 0;
+
+    while (fgets(line, sizeof(line), file)) {
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r') {
+            continue;
+        }
+
+        char type_str[32], path[256], target[256];
+
+        if (sscanf(line, "%s %s %s", type_str, path, target) == 3 && strcmp(type_str, "BALANCE") == 0) {
+            for (int i = 0; i < g_route_count; i++) {
+                if (strcmp(g_routes[i].path, path) == 0 && g_routes[i].upstreams) {
+                    if (upstream_group_set_balance(g_routes[i].upstreams, target) == 0) {
+                        printf("Config: Route %s balances by %s\n", path, target);
+                    }
+                    else {
+                        fprintf(stderr, "Config: Unknown BALANCE mode %s\n", target);
+                    }
+                }
+            }
+        }
+        else if (sscanf(line, "%s %s %s", type_str, path, target) == 3 && strcmp(type_str, "BODY_LIMIT") == 0) {
+            for (int i = 0; i < g_route_count; i++) {
+                if (strcmp(g_routes[i].path, path) == 0) {
+                    g_routes[i].max_body = strtoull(target, NULL, 10);
+
+                    printf("Config: Route %s accepts request bodies up to %s bytes\n", path, target);
+                }
+            }
+        }
+        else if (sscanf(line, "%s %s %s", type_str, path, target) == 3 && strcmp(type_str, "QOS_CLASS") == 0) {
+            int cls = qos_class_from_name(target);
+
+            for (int i = 0; i < g_route_count && cls >= 0; i++) {
+                if (strcmp(g_routes[i].path, path) == 0) {
+                    g_routes[i].qos_class = (QosClass)cls;
+
+                    printf("Config: Route %s egress class %s\n", path, target);
+                }
+            }
+        }
+        else if (sscanf(line, "%s %s %s", type_str, path, target) == 3 && qos_parse_class_config(type_str, path, target) == 0) {
+            continue;
+        }
+        else if (sscanf(line, "%s %s %s", type_str, path, target) == 3 && strcmp(type_str, "LISTEN") == 0) {
+            listener_parse_config(path, target);
+        }
+        else if (sscanf(line, "%s %s %s", type_str, path, target) == 3) {
+            if (g_route_count >= MAX_ROUTES) {
+                fprintf(stderr, "FATAL: Exceeded MAX_ROUTES\n");
+
+                break;
+            }
+
+            RouteRule* rule = &g_routes[g_route_count];
+
+            strncpy(rule->path, path, sizeof(rule->path) - 1);
+            strncpy(rule->target, target, sizeof(rule->target) - 1);
+
+            rule->needs_auth = 0;
+            rule->replay_safe = 0;
+            rule->max_body = 0;
+            rule->upstreams = NULL;
+
+            if (strcmp(type_str, "STATIC") == 0) {
+                rule->type = ROUTE_STATIC;
+                rule->qos_class = QOS_CLASS_BULK;
+            }
+            else if (strcmp(type_str, "CGI") == 0) {
+                rule->type = ROUTE_CGI;
+                rule->qos_class = QOS_CLASS_INTERACTIVE;
+            }
+            else if (strcmp(type_str, "PROXY") == 0) {
+                rule->type = ROUTE_PROXY;
+                rule->qos_class = QOS_CLASS_INTERACTIVE;
+                rule->upstreams = upstream_group_create(rule->target);
+            }
+            else {
+                continue; 
+            }
+
+            printf("Config: Loaded route %s -> %s (%s)\n", rule->path, rule->target, type_str);
+
+            g_route_count++;
+        }
+        else if (sscanf(line, "%s %s", type_str, path) == 2) {
+            if (strcmp(type_str, "TRACE_SAMPLE") == 0) {
+                trace_set_sample_rate(atoi(path));
+            }
+            else if (topology_parse_config(type_str, path) == 0) {
+                continue;
+            }
+            else if (upstream_parse_config(type_str, path) == 0) {
+                continue;
+            }
+            else if (relay_parse_config(type_str, path) == 0) {
+                continue;
+            }
+            else if (bufchain_parse_config(type_str, path) == 0) {
+                continue;
+            }
+            else if (credentials_parse_config(type_str, path) == 0) {
+                continue;
+            }
+            else if (tls_session_parse_config(type_str, path) == 0) {
+                continue;
+            }
+            else if (handshake_parse_config(type_str, path) == 0) {
+                continue;
+            }
+            else if (h2_parse_config(type_str, path) == 0) {
+                continue;
+            }
+            else if (request_body_parse_config(type_str, path) == 0) {
+                continue;
+            }
+            else if (metrics_parse_config(type_str, path) == 0) {
+                continue;
+            }
+            else if (qos_parse_config(type_str, path) == 0) {
+                continue;
+            }
+            else if (radio_mount_parse_config(type_str, path) == 0) {
+                continue;
+            }
+            else if (strcmp(type_str, "AUTH") == 0) {
+                for (int i = 0; i < g_route_count; i++) {
+                    if (strcmp(g_routes[i].path, path) == 0) {
+                        g_routes[i].needs_auth = 1;
+
+                        printf("Config: Added AUTH to route %s\n", path);
+                    }
+                }
+            }
+            else if (strcmp(type_str, "EARLY_DATA") == 0) {
+                for (int i = 0; i < g_route_count; i++) {
+                    if (strcmp(g_routes[i].path, path) == 0) {
+                        g_routes[i].replay_safe = 1;
+
+                        printf("Config: Route %s accepts 0-RTT requests\n", path);
+                    }
+                }
+            }
+        }
+    }
+
+    fclose(file);
+    
+    printf("Loaded %d rules:\n", g_route_count);
+    for (int i = 0; i < g_route_count; i++) {
+        printf("  Rule %d: %s -> %s (Auth: %d)\n", i, 
+            g_routes[i].path, g_routes[i].target, g_routes[i].needs_auth);
+    }
+}
+
+// A request read from 0-RTT data may be a replay, so it is only served before the handshake
+// completes when it is a complete GET or HEAD on a route marked EARLY_DATA.
+int request_replay_safe(const char* request) {
+    if (!strstr(request, "\r\n\r\n")) {
+        return 0;
+    }
+
+    const char* path = NULL;
+
+    if (strncmp(request, "GET ", 4) == 0) {
+        path = request + 4;
+    }
+    else if (strncmp(request, "HEAD ", 5) == 0) {
+        path = request + 5;
+    }
+    else {
+        return 0;
+    }
+
+    size_t path_len = strcspn(path, " ?\r\n");
+    RouteRule* best_rule = NULL;
+    size_t best_match_len = 0;
+
+    for (int i = 0; i < g_route_count; i++) {
+        size_t rule_len = strlen(g_routes[i].path);
+
+        if (rule_len <= path_len && strncmp(path, g_routes[i].path, rule_len) == 0 && (!best_rule || rule_len > best_match_len)) {
+            best_match_len = rule_len;
+            best_rule = &g_routes[i];
+        }
+    }
+
+    return best_rule && best_rule->replay_safe;
+}
+
+// Copies the request-target, without its query, into requested_path. -1 for a malformed
+// request line, an oversized path or one that tries to climb out with "..".
+static int parse_request_path(const char* request_buffer, char* requested_path, size_t cap) {
+    const char* path_start = strchr(request_buffer, ' ');
+
+    if (!path_start) {
+        return -1;
+    }
+
+    path_start++;
+
+    const char* path_end = strchr(path_start, ' ');
+
+    if (!path_end) {
+        return -1;
+    }
+
+    const char* query_pos = strchr(path_start, '?');
+
+    if (query_pos != NULL && query_pos < path_end) {
+        path_end = query_pos;
+    }
+
+    size_t path_len = path_end - path_start;
+
+    if (path_len > cap - 1) {
+        return -1;
+    }
+
+    strncpy(requested_path, path_start, path_len);
+
+    requested_path[path_len] = '\0';
+
+    if (strcmp(requested_path, "/") == 0) {
+        strncpy(requested_path, "/index.html", cap - 1);
+    }
+
+    if (strstr(requested_path, "..") != NULL) {
+        return -1;
+    }
+
+    return 0;
+}
+
+void handle_work(ClientState* client) {
+    char* request_buffer = client->buffer;
+    int client_socket = client->fd;
+
+    if (request_buffer == NULL) {
+        return;
+    }
+
+    // Back from the event loop with the CGI's stdin fed; what is left is relaying its output.
+    if (client->body.output_fd >= 0) {
+        metrics_observe_since(METRIC_HIST_ROUTE_CGI, client->t_dequeue);
+
+        if (send_cgi_output(client)) {
+            return;
+        }
+
+        rearm_after_response(client);
+
+        return;
+    }
+    
+    char requested_path[256];
+
+    // The connection (or h2 stream) still has to be re-armed or finished after the 404.
+    if (parse_request_path(request_buffer, requested_path, sizeof(requested_path)) < 0) {
+        send_404_not_found(client_socket, client);
+
+        rearm_after_response(client);
+
+        return;
+    }
+
+    RouteRule* best_rule = NULL;
+    int best_match_len = -1;
+
+    for (int i = 0; i < g_route_count; i++) {
+        int rule_len = strlen(g_routes[i].path);
+
+        if (strncmp(requested_path, g_routes[i].path, rule_len) == 0) {
+            if (rule_len > best_match_len) {
+                best_match_len = rule_len;
+                best_rule = &g_routes[i];
+            }
+        }
+    }
+
+    qos_classify(client, best_rule ? best_rule->qos_class : QOS_CLASS_INTERACTIVE);
+
+    // Internal pages show route timings, upstreams and traces; refused ones fall through to normal routing.
+    int internal = metrics_is_stats_path(requested_path) || trace_is_trace_path(requested_path);
+
+    if (internal && metrics_internal_allowed(client->local_peer)) {
+        trace_set_route(client->trace, TRACE_ROUTE_INTERNAL, requested_path);
+
+        if (trace_is_trace_path(requested_path)) {
+            serve_trace(client);
+        }
+        else {
+            serve_stats(request_buffer, client);
+        }
+
+        metrics_count(METRIC_REQUESTS_INTERNAL, 1);
+    }
+    else if (radio_mount_matches(requested_path) && !client->stream) {
+        printf("Worker Thread: Attaching listener to the radio ring\n");
+
+        metrics_count(METRIC_REQUESTS_RADIO, 1);
+
+        request_write_end(client);
+
+        radio_mount_attach(client);
+
+        return;
+    }
+    else if (best_rule == NULL) {
+        printf("Worker Thread: 404 Not Found (No route rule for: %s)\n", requested_path);
+
+        metrics_count(METRIC_REQUESTS_NOT_FOUND, 1);
+
+        send_404_not_found(client_socket, client);
+    }
+    else {
+        if (best_rule->needs_auth) {
+            if (!check_authentication(client_socket, request_buffer, client)) {
+                rearm_after_response(client);
+
+                return;
+            }
+        }
+
+        trace_set_route(client->trace, (TraceRoute)(TRACE_ROUTE_STATIC + best_rule->type), requested_path);
+
+        if (best_rule->type == ROUTE_STATIC) {
+            printf("Worker Thread: Routing to STATIC: %s\n", best_rule->target);
+            
+            serve_static_file(client_socket, request_buffer, best_rule->target, requested_path, client);
+
+            metrics_count(METRIC_REQUESTS_STATIC, 1);
+            metrics_observe_since(METRIC_HIST_ROUTE_STATIC, client->t_dequeue);
+        }
+        else if (best_rule->type == ROUTE_CGI) {
+            printf("Worker Thread: Routing to CGI: %s\n", best_rule->target);
+ 
+            metrics_count(METRIC_REQUESTS_CGI, 1);
+
+            if (handle_cgi_request(client_socket, request_buffer, best_rule->target, requested_path, best_rule, client)) {
+                return;
+            }
+        }
+        else if (best_rule->type == ROUTE_PROXY) {
+            printf("Worker Thread: Routing to PROXY: %s\n", best_rule->target);
+
+            metrics_count(METRIC_REQUESTS_PROXY, 1);
+            metrics_observe_since(METRIC_HIST_ROUTE_PROXY, client->t_dequeue);
+
+            request_write_end(client);
+
+            handle_proxy_request_async(client, best_rule);
+
+            return;
+        }
+    }
+    
+    rearm_after_response(client);
+}
\ No newline at end of file
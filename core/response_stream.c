@@ -0,0 +1,191 @@
+#include "server.h"
+
+static int g_active_streams = 0;
+
+static void response_stream_metrics_source(MetricsWriter* w) {
+    metrics_write_value(w, "response_streams_active", "Responses currently streamed by the event loop", (uint64_t)__atomic_load_n(&g_active_streams, __ATOMIC_RELAXED));
+}
+
+void response_stream_global_init(void) {
+    metrics_register_source(response_stream_metrics_source);
+}
+
+void response_stream_init(ResponseStream* rs) {
+    memset(rs, 0, sizeof(ResponseStream));
+
+    rs->fd = -1;
+}
+
+int response_stream_start(ClientState* client, int fd, const ResponseProducer* producer, void* arg, int flags) {
+    ResponseStream* rs = &client->producer;
+    struct epoll_event ev;
+    ev.data.ptr = client;
+
+    if (fd >= 0 && set_nonblock(fd) == -1) {
+        return -1;
+    }
+
+    rs->fd = fd;
+    rs->flags = flags;
+    rs->eof = 0;
+    rs->producer = producer;
+    rs->arg = arg;
+
+    client->state = STATE_STREAMING;
+
+    ev.events = EPOLLIN | EPOLLET;
+
+    if (fd >= 0 && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        perror("epoll_ctl: add response producer");
+
+        response_stream_init(rs);
+
+        client->state = STATE_READ_REQUEST;
+
+        return -1;
+    }
+
+    __atomic_add_fetch(&g_active_streams, 1, __ATOMIC_RELAXED);
+
+    metrics_count(METRIC_RESPONSE_STREAMS, 1);
+
+    // Registered last: from here the event loop may run the stream before the worker returns.
+    ev.events = EPOLLOUT | EPOLLRDHUP | EPOLLET;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client->fd, &ev) == -1) {
+        perror("epoll_ctl: add stream client");
+
+        if (fd >= 0) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+        }
+
+        __atomic_sub_fetch(&g_active_streams, 1, __ATOMIC_RELAXED);
+
+        response_stream_init(rs);
+
+        client->state = STATE_READ_REQUEST;
+
+        return -1;
+    }
+
+    return 0;
+}
+
+static ssize_t produce(ResponseStream* rs, char* buf, size_t cap) {
+    ssize_t n;
+
+    do {
+        n = rs->producer ? rs->producer->read(rs->arg, rs->fd, buf, cap) : read(rs->fd, buf, cap);
+    } while (n < 0 && errno == EINTR);
+
+    return n;
+}
+
+// Pulls from the producer until the output chain is at its cap. Returns 1 if the producer has
+// nothing more for now, 0 when it filled the chain or finished, -1 on error.
+static int fill_output(ClientState* client) {
+    ResponseStream* rs = &client->producer;
+
+    while (!rs->eof && client->output.len < g_output_buffer_cap) {
+        ssize_t n;
+
+        if (rs->flags & RESPONSE_STREAM_CHUNKED) {
+            char buffer[RESPONSE_STREAM_READ];
+            char size_line[24];
+
+            n = produce(rs, buffer, sizeof(buffer));
+
+            if (n > 0) {
+                int size_len = snprintf(size_line, sizeof(size_line), "%zx\r\n", (size_t)n);
+
+                if (bufchain_append(&client->output, size_line, size_len) < 0 || bufchain_append(&client->output, buffer, n) < 0 || bufchain_append(&client->output, "\r\n", 2) < 0) {
+                    return -1;
+                }
+            }
+            else if (n == 0 && bufchain_append(&client->output, "0\r\n\r\n", 5) < 0) {
+                return -1;
+            }
+        }
+        else {
+            size_t avail;
+            char* dst = bufchain_reserve(&client->output, &avail);
+
+            if (!dst) {
+                return -1;
+            }
+
+            n = produce(rs, dst, avail);
+
+            if (n > 0) {
+                bufchain_commit(&client->output, n);
+            }
+        }
+
+        if (n > 0) {
+            metrics_count(METRIC_RESPONSE_STREAM_BYTES, n);
+        }
+        else if (n == 0) {
+            rs->eof = 1;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 1;
+        }
+        else {
+            perror("response stream read");
+
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int response_stream_pump(ClientState* client) {
+    while (1) {
+        int ret = client_write_pending(client);
+
+        if (ret < 0) {
+            return -1;
+        }
+
+        // Socket full or parked by QoS; leave the producer alone until the client drains.
+        if (ret != 0) {
+            return 1;
+        }
+
+        if (client->producer.eof) {
+            return 0;
+        }
+
+        ret = fill_output(client);
+
+        if (ret < 0) {
+            return -1;
+        }
+
+        if (ret == 1 && client->output.len == 0) {
+            return 1;
+        }
+    }
+}
+
+void response_stream_close(ResponseStream* rs) {
+    if (rs->fd < 0 && rs->producer == NULL) {
+        return;
+    }
+
+    if (rs->fd >= 0) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, rs->fd, NULL);
+    }
+
+    if (rs->producer && rs->producer->close) {
+        rs->producer->close(rs->arg, rs->fd);
+    }
+    else if (rs->fd >= 0) {
+        close(rs->fd);
+    }
+
+    __atomic_sub_fetch(&g_active_streams, 1, __ATOMIC_RELAXED);
+
+    response_stream_init(rs);
+}
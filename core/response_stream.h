@@ -0,0 +1,52 @@
+#ifndef RESPONSE_STREAM_H
+#define RESPONSE_STREAM_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define RESPONSE_STREAM_READ (16 * 1024)
+
+// Frame producer bytes as HTTP/1.1 chunks and finish with a last-chunk at EOF. Without it
+// the bytes go out as they are, for producers (NPH-style CGIs) that write their own framing.
+#define RESPONSE_STREAM_CHUNKED 1
+
+struct ClientState;
+
+// A source of response bytes that wakes the event loop through fd. A NULL producer means
+// read(2) and close(2) on the fd itself; push endpoints can hand an eventfd or socketpair
+// end over with their own read that pulls from wherever their data lives.
+typedef struct {
+    // Returns bytes produced, 0 once the body is complete, or -1 with errno (EAGAIN: nothing yet).
+    ssize_t (*read)(void* arg, int fd, char* buf, size_t cap);
+
+    // Called exactly once, when the response ends or the client goes away.
+    void (*close)(void* arg, int fd);
+} ResponseProducer;
+
+// The tail of a response that outlives its worker. The event loop owns it: it reads from the
+// producer while the client drains, and stops reading once the output chain reaches its cap.
+typedef struct {
+    int fd;
+    int flags;
+    int eof;
+    const ResponseProducer* producer;
+    void* arg;
+} ResponseStream;
+
+void response_stream_global_init(void);
+
+void response_stream_init(ResponseStream* rs);
+
+// Worker side: anything already queued on the client (typically the head) goes out first. fd is
+// -1 for a producer with no fd of its own, whose owner calls response_stream_pump when it has data.
+// On success the client belongs to the event loop and must not be touched again. On failure
+// the caller still owns both the client and fd.
+int response_stream_start(struct ClientState* client, int fd, const ResponseProducer* producer, void* arg, int flags);
+
+// Event loop side. Returns 0 when the response is complete, 1 to wait for either fd, -1 on error.
+int response_stream_pump(struct ClientState* client);
+
+// Unregisters and releases the producer; safe on a stream that never started.
+void response_stream_close(ResponseStream* rs);
+
+#endif
@@ -0,0 +1,1410 @@
+#include "server.h"
+#include <signal.h>
+
+TaskQueue task_queue;
+int epoll_fd;
+
+static Listener g_listeners[MAX_LISTENERS];
+static int g_listener_count = 0;
+static int g_tls_enabled = 0;
+
+static int g_handshake_epfd = -1;
+static int g_handshake_threads = 0;
+static int g_handshake_max_inflight = HANDSHAKE_DEFAULT_MAX_INFLIGHT;
+static int g_handshake_timeout_sec = HANDSHAKE_DEFAULT_TIMEOUT;
+static int g_handshakes_inflight = 0;
+static int g_accept_paused = 0;
+static uint64_t g_accept_pauses = 0;
+static uint64_t g_handshake_timeouts = 0;
+
+static ClientState* g_handshake_list = NULL;
+static pthread_mutex_t g_handshake_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Cuts an iovec list down to at most max bytes; returns the new count.
+static int iov_limit(struct iovec* iov, int count, size_t max) {
+    for (int i = 0; i < count; i++) {
+        if (iov[i].iov_len >= max) {
+            iov[i].iov_len = max;
+
+            return i + 1;
+        }
+
+        max -= iov[i].iov_len;
+    }
+
+    return count;
+}
+
+int client_write_pending(ClientState* client) {
+    struct iovec iov[16];
+
+    while (client->output.len > 0) {
+        ssize_t sent;
+        size_t allowed = qos_admit(client, client->output.len);
+
+        if (allowed == 0) {
+            return QOS_PARKED;
+        }
+
+        if (client->transport->writev) {
+            int count = iov_limit(iov, bufchain_iov(&client->output, iov, 16), allowed);
+
+            sent = client->transport->writev(client, iov, count);
+        }
+        else {
+            size_t len;
+            const char* data = bufchain_peek(&client->output, &len);
+
+            sent = client->transport->write(client, data, len < allowed ? len : allowed);
+        }
+
+        if (sent > 0) {
+            metrics_count(METRIC_BYTES_OUT, sent);
+
+            qos_charge(client, sent);
+
+            bufchain_consume(&client->output, sent);
+
+            continue;
+        }
+
+        return sent == TRANSPORT_AGAIN ? 1 : -1;
+    }
+
+    return 0;
+}
+
+// Drains the output chain and refills it straight from a parked file or CGI pipe, never past the cap.
+// Returns 0 once the response is complete, 1 when the socket is full, QOS_PARKED, or -1 on error.
+int client_pump_output(ClientState* client) {
+    while (1) {
+        int ret = client_write_pending(client);
+
+        if (ret != 0 || client->file_stream == NULL) {
+            return ret;
+        }
+
+        while (client->output.len < g_output_buffer_cap) {
+            size_t avail;
+            char* dst = bufchain_reserve(&client->output, &avail);
+
+            if (!dst) {
+                return -1;
+            }
+
+            size_t n = fread(dst, 1, avail, client->file_stream);
+
+            if (n == 0) {
+                fclose(client->file_stream);
+
+                if (client->is_cgi) {
+                    trace_point(client->trace, TRACE_CGI_EXIT);
+
+                    client->is_cgi = 0;
+                }
+
+                client->file_stream = NULL;
+
+                break;
+            }
+
+            bufchain_commit(&client->output, n);
+        }
+    }
+}
+
+void queue_init(TaskQueue* q) {
+    q->head = NULL;
+    q->tail = NULL;
+
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->cond, NULL);
+}
+
+void queue_push(TaskQueue* q, ClientState* client) {
+    Task* new_task = (Task*)malloc(sizeof(Task));
+    new_task->client = client;
+    new_task->next = NULL;
+
+    pthread_mutex_lock(&q->mutex);
+
+    if (q->tail) {
+        q->tail->next = new_task;
+    }
+
+    q->tail = new_task;
+
+    if (q->head == NULL) {
+        q->head = new_task;
+    }
+
+    pthread_mutex_unlock(&q->mutex);
+
+    metrics_queue_depth_add(1);
+
+    pthread_cond_signal(&q->cond);
+}
+
+ClientState* queue_pop(TaskQueue* q) {
+    pthread_mutex_lock(&q->mutex);
+
+    while (q->head == NULL) {
+        pthread_cond_wait(&q->cond, &q->mutex);
+    }
+
+    Task* task = q->head;
+    q->head = q->head->next;
+
+    if (q->head == NULL) {
+        q->tail = NULL;
+    }
+
+    pthread_mutex_unlock(&q->mutex);
+
+    metrics_queue_depth_add(-1);
+
+    ClientState* client = task->client;
+
+    free(task);
+
+    return client;
+}
+
+void* worker_thread_function(void* arg) {
+    topology_pin_current_thread(THREAD_ROLE_WORKER, (int)(intptr_t)arg);
+
+    while (1) {
+        ClientState* client = queue_pop(&task_queue);
+
+        if (client) {
+            client->t_dequeue = metrics_now_ns();
+
+            metrics_observe(METRIC_HIST_STAGE_QUEUE, client->t_dequeue - client->t_enqueue);
+
+            trace_point(client->trace, TRACE_DEQUEUE);
+
+            handle_work(client);
+        }
+    }
+
+    return NULL;
+}
+
+int set_nonblock(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+
+    if (flags == -1) {
+        perror("fcntl F_GETFL");
+
+        return -1;
+    }
+
+    if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        perror("fcntl F_SETFL O_NONBLOCK");
+
+        return -1;
+    }
+
+    return 0;
+}
+
+ClientState* create_client_state(int fd) {
+    ClientState* client = (ClientState*)calloc(1, sizeof(ClientState));
+    client->fd = fd;
+
+    bufchain_init(&client->output);
+    relay_pipe_init(&client->relay);
+    client->transport = &g_transport_plain;
+    client->ssl = NULL;
+    client->state = STATE_READ_REQUEST;
+    client->peer = NULL;
+    client->bytes_read = 0;
+
+    request_body_init(&client->body);
+    response_stream_init(&client->producer);
+
+    return client;
+}
+
+void request_write_begin(ClientState* client) {
+    if (client->t_dequeue == 0 || client->t_write_start != 0) {
+        return;
+    }
+
+    client->t_write_start = metrics_now_ns();
+
+    trace_point(client->trace, TRACE_FIRST_WRITE);
+
+    metrics_observe(METRIC_HIST_STAGE_HANDLE, client->t_write_start - client->t_dequeue);
+}
+
+void request_write_end(ClientState* client) {
+    if (client->t_write_start != 0) {
+        metrics_observe_since(METRIC_HIST_STAGE_WRITE, client->t_write_start);
+    }
+    else if (client->t_dequeue != 0) {
+        metrics_observe_since(METRIC_HIST_STAGE_HANDLE, client->t_dequeue);
+    }
+
+    client->t_dequeue = 0;
+    client->t_write_start = 0;
+
+    if (client->trace && client->trace->route != TRACE_ROUTE_PROXY) {
+        trace_commit(client->trace);
+
+        client->trace = NULL;
+    }
+}
+
+static void release_connection(ClientState* client) {
+    if (client->fd >= 0) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    }
+
+    qos_forget(client);
+
+    trace_commit(client->trace);
+
+    client->trace = NULL;
+
+    bufchain_free(&client->output);
+    relay_pipe_close(&client->relay);
+    request_body_close(&client->body);
+    response_stream_close(&client->producer);
+
+    if (client->file_stream) {
+        fclose(client->file_stream);
+    }
+
+    if (client->sendfile_stream) {
+        fclose(client->sendfile_stream);
+    }
+
+    if (client->transport->close) {
+        client->transport->close(client);
+    }
+
+    if (client->fd >= 0) {
+        if (client->upstream) {
+            upstream_release(client->upstream, client->fd, 0);
+        }
+        else {
+            close(client->fd);
+        }
+    }
+}
+
+void cleanup_client(ClientState* client) {
+    if (!client->stream) {
+        metrics_count(METRIC_CONNECTIONS_CLOSED, 1);
+    }
+
+    release_connection(client);
+
+    if (client->peer) {
+        ClientState* peer = client->peer;
+
+        peer->peer = NULL;
+
+        release_connection(peer);
+
+        free(peer);
+    }
+
+    free(client);
+}
+
+// The upstream sent a complete, length-delimited response: pool the connection and let the client send its next request.
+static void proxy_response_complete(ClientState* upstream_state) {
+    ClientState* client = upstream_state->peer;
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, upstream_state->fd, NULL);
+
+    upstream_release(upstream_state->upstream, upstream_state->fd, 1);
+
+    // An h2 stream is one exchange; its connection keeps going without it.
+    if (client && client->stream) {
+        client->peer = NULL;
+
+        cleanup_client(client);
+    }
+    else if (client) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLET | EPOLLONESHOT;
+        ev.data.ptr = client;
+
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->fd, &ev);
+
+        client->peer = NULL;
+        client->state = STATE_READ_REQUEST;
+        client->bytes_read = 0;
+
+        bzero(client->buffer, BUFFER_SIZE);
+
+        trace_commit(client->trace);
+
+        client->trace = NULL;
+    }
+
+    relay_pipe_close(&upstream_state->relay);
+    bufchain_free(&upstream_state->output);
+    free(upstream_state);
+}
+
+static int upstream_write_pending(ClientState* upstream) {
+    struct iovec iov[16];
+
+    while (upstream->output.len > 0) {
+        int count = bufchain_iov(&upstream->output, iov, 16);
+        ssize_t sent = writev(upstream->fd, iov, count);
+
+        if (sent > 0) {
+            bufchain_consume(&upstream->output, sent);
+
+            continue;
+        }
+
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 1;
+        }
+
+        return -1;
+    }
+
+    return 0;
+}
+
+// Both relay directions buffer at most g_relay_buffer_cap bytes for a slow peer and then stop
+// reading the source; the peer's EPOLLOUT resumes them. Return -1 to close, 0 to wait.
+static int relay_browser_to_upstream(ClientState* browser, ClientState* upstream) {
+    char buffer[BUFFER_SIZE];
+
+    while (1) {
+        int blocked = upstream_write_pending(upstream);
+
+        if (blocked < 0) {
+            return -1;
+        }
+
+        if (browser->relay_eof) {
+            return blocked ? 0 : -1;
+        }
+
+        if (upstream->output.len >= g_relay_buffer_cap) {
+            metrics_count(METRIC_PROXY_STALLS, 1);
+
+            return 0;
+        }
+
+        ssize_t n = browser->transport->read(browser, buffer, sizeof(buffer));
+
+        if (n == TRANSPORT_AGAIN) {
+            return 0;
+        }
+
+        if (n <= 0) {
+            browser->relay_eof = 1;
+
+            continue;
+        }
+
+        metrics_count(METRIC_BYTES_IN, n);
+        metrics_count(METRIC_PROXY_BYTES_TO_UPSTREAM, n);
+
+        // Anything after the initial request (body, pipelining, upgrades) makes the exchange unframed.
+        upstream->response.request_done = 0;
+
+        if (bufchain_append(&upstream->output, buffer, n) < 0) {
+            return -1;
+        }
+    }
+}
+
+// Same as above in the other direction; returns 1 once a pooled response has been fully delivered.
+static int relay_upstream_to_browser(ClientState* upstream, ClientState* browser) {
+    char buffer[BUFFER_SIZE];
+
+    while (1) {
+        int blocked = client_write_pending(browser);
+
+        if (blocked < 0) {
+            return -1;
+        }
+
+        if (upstream->relay_eof) {
+            return blocked ? 0 : -1;
+        }
+
+        if (upstream->response_complete) {
+            return blocked ? 0 : 1;
+        }
+
+        if (browser->output.len >= g_relay_buffer_cap) {
+            metrics_count(METRIC_PROXY_STALLS, 1);
+
+            return 0;
+        }
+
+        ssize_t n = recv(upstream->fd, buffer, sizeof(buffer), 0);
+
+        if (n == 0) {
+            upstream->relay_eof = 1;
+
+            continue;
+        }
+
+        if (n < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+
+        metrics_count(METRIC_BYTES_IN, n);
+        metrics_count(METRIC_PROXY_BYTES_TO_CLIENT, n);
+
+        trace_point(browser->trace, TRACE_PROXY_FIRST_BYTE);
+        trace_point(browser->trace, TRACE_FIRST_WRITE);
+
+        if (upstream_response_feed(&upstream->response, buffer, n)) {
+            upstream->response_complete = 1;
+        }
+
+        if (bufchain_append(&browser->output, buffer, n) < 0) {
+            return -1;
+        }
+    }
+}
+
+// Plaintext relay: moves bytes from src to its peer through a pipe until the source is drained or
+// the peer stops accepting them. Returns 1 when a pooled upstream finished its response, -1 when
+// the pair must be closed, 0 otherwise.
+static int relay_direction(ClientState* src) {
+    ClientState* dst = src->peer;
+
+    while (1) {
+        // Only the leg towards the browser is egress that QoS shapes.
+        size_t queued = src->relay.pending;
+        size_t allowed = src->is_upstream ? qos_admit(dst, queued) : queued;
+        int blocked = relay_drain(&src->relay, dst->fd, allowed);
+
+        if (src->is_upstream) {
+            qos_charge(dst, queued - src->relay.pending);
+        }
+
+        if (blocked < 0) {
+            return -1;
+        }
+
+        if (blocked) {
+            // Leave the rest in the source socket; EPOLLOUT on dst resumes us.
+            metrics_count(METRIC_PROXY_STALLS, 1);
+
+            return 0;
+        }
+
+        // Parked by QoS; qos_tick re-arms dst when it is this client's turn.
+        if (allowed < queued) {
+            return 0;
+        }
+
+        if (src->relay_eof) {
+            return -1;
+        }
+
+        if (src->response_complete) {
+            return 1;
+        }
+
+        char head[BUFFER_SIZE];
+        const char* peeked = NULL;
+        size_t max = g_relay_buffer_cap;
+
+        if (src->is_upstream && src->response.state == UPSTREAM_RESPONSE_HEADERS) {
+            ssize_t n = recv(src->fd, head, sizeof(head), MSG_PEEK);
+
+            if (n > 0) {
+                peeked = head;
+                max = n;
+            }
+        }
+
+        ssize_t moved = relay_fill(&src->relay, src->fd, max);
+
+        if (moved == 0) {
+            src->relay_eof = 1;
+
+            continue;
+        }
+
+        if (moved < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+
+        metrics_count(METRIC_BYTES_IN, moved);
+
+        if (src->is_upstream) {
+            metrics_count(METRIC_PROXY_BYTES_TO_CLIENT, moved);
+
+            trace_point(dst->trace, TRACE_PROXY_FIRST_BYTE);
+            trace_point(dst->trace, TRACE_FIRST_WRITE);
+
+            if (upstream_response_feed(&src->response, peeked, moved)) {
+                src->response_complete = 1;
+            }
+        }
+        else {
+            metrics_count(METRIC_PROXY_BYTES_TO_UPSTREAM, moved);
+
+            // Anything after the initial request (body, pipelining, upgrades) makes the exchange unframed.
+            dst->response.request_done = 0;
+        }
+    }
+}
+
+static void forget_events(struct epoll_event* events, int from, int count, ClientState* gone) {
+    for (int i = from; i < count; i++) {
+        if (events[i].data.ptr == gone) {
+            events[i].data.ptr = NULL;
+        }
+    }
+}
+
+static void relay_event(ClientState* client, struct epoll_event* events, int next, int count) {
+    ClientState* peer = client->peer;
+
+    if (!peer) {
+        cleanup_client(client);
+
+        return;
+    }
+
+    ClientState* browser = client->is_upstream ? peer : client;
+    ClientState* upstream = client->is_upstream ? client : peer;
+    int down;
+    int up = 0;
+
+    // Each event can make either side readable or writable, so pump both directions.
+    if (browser->transport->splice_relay) {
+        down = relay_direction(upstream);
+
+        if (down == 0) {
+            up = relay_direction(browser);
+        }
+    }
+    else {
+        down = relay_upstream_to_browser(upstream, browser);
+
+        if (down == 0) {
+            up = relay_browser_to_upstream(browser, upstream);
+        }
+    }
+
+    if (down > 0) {
+        forget_events(events, next, count, upstream);
+
+        proxy_response_complete(upstream);
+
+        return;
+    }
+
+    if (down < 0 || up < 0) {
+        forget_events(events, next, count, browser);
+        forget_events(events, next, count, upstream);
+
+        cleanup_client(browser);
+    }
+}
+
+// A CGI body arriving after its headers: the client socket and the CGI's stdin pipe both point
+// here. Once the body is in, the CGI's output goes back to a worker.
+static void request_body_event(ClientState* client, struct epoll_event* events, int next, int count) {
+    int ret = 0;
+
+    // An interim 100 Continue that did not fit in the socket goes out first.
+    if (client->output.len > 0) {
+        ret = client_write_pending(client) < 0 ? REQUEST_BODY_ERROR : 0;
+    }
+
+    if (ret == 0) {
+        ret = request_body_pump(client);
+    }
+
+    if (ret == 1) {
+        return;
+    }
+
+    forget_events(events, next, count, client);
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+
+    if (ret < 0) {
+        request_body_reject(client, ret);
+
+        cleanup_client(client);
+
+        return;
+    }
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->body.sink_fd, NULL);
+
+    close(client->body.sink_fd);
+
+    client->body.sink_fd = -1;
+    client->state = STATE_READ_REQUEST;
+    client->t_enqueue = metrics_now_ns();
+
+    queue_push(&task_queue, client);
+}
+
+static void response_stream_event(ClientState* client, struct epoll_event* events, int current, int count) {
+    int ret = response_stream_pump(client);
+
+    // Pipes never raise EPOLLRDHUP, so this is the client hanging up on an idle stream.
+    if (ret == 1 && (events[current].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+        char probe;
+        ssize_t n = recv(client->fd, &probe, 1, MSG_PEEK | MSG_DONTWAIT);
+
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 1) {
+        return;
+    }
+
+    forget_events(events, current + 1, count, client);
+
+    if (ret < 0) {
+        cleanup_client(client);
+
+        return;
+    }
+
+    response_stream_close(&client->producer);
+
+    if (client->is_cgi) {
+        trace_point(client->trace, TRACE_CGI_EXIT);
+
+        client->is_cgi = 0;
+    }
+
+    request_write_end(client);
+
+    client->state = STATE_READ_REQUEST;
+    client->bytes_read = 0;
+
+    bzero(client->buffer, BUFFER_SIZE);
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET | EPOLLONESHOT;
+    ev.data.ptr = client;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->fd, &ev) == -1) {
+        cleanup_client(client);
+    }
+}
+
+void enqueue_request(ClientState* client) {
+    client->t_enqueue = metrics_now_ns();
+
+    metrics_observe(METRIC_HIST_STAGE_READ, client->t_enqueue - client->t_read_start);
+
+    client->trace = trace_maybe_start(client->fd, client->t_accept ? client->t_accept : client->t_read_start, client->t_enqueue);
+    client->t_accept = 0;
+
+    trace_point(client->trace, TRACE_ENQUEUE);
+
+    queue_push(&task_queue, client);
+}
+
+int listener_parse_config(const char* port, const char* transport) {
+    if (g_listener_count >= MAX_LISTENERS) {
+        fprintf(stderr, "Config: Exceeded MAX_LISTENERS\n");
+
+        return -1;
+    }
+
+    Listener* listener = &g_listeners[g_listener_count];
+
+    if (strcmp(transport, "plain") == 0) {
+        listener->transport = &g_transport_plain;
+    }
+    else if (strcmp(transport, "tls") == 0) {
+        listener->transport = &g_transport_tls;
+    }
+    else {
+        fprintf(stderr, "Config: Unknown LISTEN transport %s\n", transport);
+
+        return -1;
+    }
+
+    listener->port = atoi(port);
+    listener->fd = -1;
+
+    g_listener_count++;
+
+    printf("Config: Listening on port %d (%s)\n", listener->port, transport);
+
+    return 0;
+}
+
+int handshake_parse_config(const char* key, const char* value) {
+    if (strcmp(key, "HANDSHAKE_THREADS") == 0) {
+        g_handshake_threads = atoi(value);
+    }
+    else if (strcmp(key, "HANDSHAKE_MAX_INFLIGHT") == 0) {
+        g_handshake_max_inflight = atoi(value) > 0 ? atoi(value) : HANDSHAKE_DEFAULT_MAX_INFLIGHT;
+    }
+    else if (strcmp(key, "HANDSHAKE_TIMEOUT") == 0) {
+        g_handshake_timeout_sec = atoi(value);
+    }
+    else {
+        return -1;
+    }
+
+    printf("Config: Handshake %s = %s\n", key, value);
+
+    return 0;
+}
+
+static void handshake_metrics_source(MetricsWriter* w) {
+    metrics_write_value(w, "tls_handshakes_in_progress", "Handshakes owned by the handshake pool", (uint64_t)__atomic_load_n(&g_handshakes_inflight, __ATOMIC_RELAXED));
+    metrics_write_value(w, "tls_handshake_max_inflight", "Cap on concurrent handshakes before accept pauses", (uint64_t)g_handshake_max_inflight);
+    metrics_write_value(w, "tls_accept_pauses_total", "Times accepting stopped because the handshake cap was reached", __atomic_load_n(&g_accept_pauses, __ATOMIC_RELAXED));
+    metrics_write_value(w, "tls_handshake_timeouts_total", "Handshakes aborted after HANDSHAKE_TIMEOUT", __atomic_load_n(&g_handshake_timeouts, __ATOMIC_RELAXED));
+}
+
+// Only listeners that feed the handshake pool are paused; plaintext ones keep accepting.
+static void set_accepting(int on) {
+    for (int i = 0; i < g_listener_count; i++) {
+        Listener* listener = &g_listeners[i];
+
+        if (!listener->transport->handshake) {
+            continue;
+        }
+
+        struct epoll_event ev;
+        ev.events = on ? EPOLLIN : 0;
+        ev.data.ptr = listener->state;
+
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, listener->fd, &ev) == -1) {
+            perror("set_accepting: epoll_ctl");
+        }
+    }
+}
+
+// Connections stay in the kernel backlog while paused instead of piling onto the handshake pool.
+static void pause_accepting(void) {
+    set_accepting(0);
+
+    __atomic_store_n(&g_accept_paused, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&g_accept_pauses, 1, __ATOMIC_RELAXED);
+
+    // A handshake may have finished between the cap check and the flag store.
+    if (__atomic_load_n(&g_handshakes_inflight, __ATOMIC_SEQ_CST) < g_handshake_max_inflight &&
+        __atomic_exchange_n(&g_accept_paused, 0, __ATOMIC_SEQ_CST)) {
+        set_accepting(1);
+    }
+}
+
+static void handshake_track(ClientState* client) {
+    pthread_mutex_lock(&g_handshake_list_mutex);
+
+    client->hs_prev = NULL;
+    client->hs_next = g_handshake_list;
+
+    if (g_handshake_list) {
+        g_handshake_list->hs_prev = client;
+    }
+
+    g_handshake_list = client;
+
+    pthread_mutex_unlock(&g_handshake_list_mutex);
+
+    __atomic_add_fetch(&g_handshakes_inflight, 1, __ATOMIC_SEQ_CST);
+}
+
+static void handshake_untrack(ClientState* client) {
+    pthread_mutex_lock(&g_handshake_list_mutex);
+
+    if (client->hs_prev) {
+        client->hs_prev->hs_next = client->hs_next;
+    }
+    else {
+        g_handshake_list = client->hs_next;
+    }
+
+    if (client->hs_next) {
+        client->hs_next->hs_prev = client->hs_prev;
+    }
+
+    client->hs_prev = NULL;
+    client->hs_next = NULL;
+
+    pthread_mutex_unlock(&g_handshake_list_mutex);
+
+    int left = __atomic_sub_fetch(&g_handshakes_inflight, 1, __ATOMIC_SEQ_CST);
+
+    if (left < g_handshake_max_inflight && __atomic_exchange_n(&g_accept_paused, 0, __ATOMIC_SEQ_CST)) {
+        set_accepting(1);
+    }
+}
+
+// Runs on the event loop tick. Shutting the socket down wakes the owning handshake thread,
+// whose handshake then fails and frees the client, so nothing is freed across threads here.
+static void handshake_expire(void) {
+    if (g_handshake_timeout_sec <= 0) {
+        return;
+    }
+
+    uint64_t now = metrics_now_ns();
+    uint64_t limit = (uint64_t)g_handshake_timeout_sec * 1000000000ull;
+
+    pthread_mutex_lock(&g_handshake_list_mutex);
+
+    for (ClientState* c = g_handshake_list; c; c = c->hs_next) {
+        if (!c->hs_expired && now - c->t_accept > limit) {
+            c->hs_expired = 1;
+
+            shutdown(c->fd, SHUT_RDWR);
+
+            __atomic_add_fetch(&g_handshake_timeouts, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    pthread_mutex_unlock(&g_handshake_list_mutex);
+}
+
+static void* handshake_thread_function(void* arg) {
+    topology_pin_current_thread(THREAD_ROLE_WORKER, g_topology.worker_threads + (int)(intptr_t)arg);
+
+    struct epoll_event events[HANDSHAKE_EPOLL_EVENTS];
+
+    while (1) {
+        int n = epoll_wait(g_handshake_epfd, events, HANDSHAKE_EPOLL_EVENTS, -1);
+
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            perror("handshake: epoll_wait");
+
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            ClientState* client = (ClientState*)events[i].data.ptr;
+            int ret = client->transport->handshake(client);
+
+            struct epoll_event ev;
+            ev.data.ptr = client;
+
+            if (ret == 1) {
+                ev.events = EPOLLIN | EPOLLONESHOT | (client->want_write ? EPOLLOUT : 0);
+
+                if (epoll_ctl(g_handshake_epfd, EPOLL_CTL_MOD, client->fd, &ev) == 0) {
+                    continue;
+                }
+
+                ret = -1;
+            }
+
+            epoll_ctl(g_handshake_epfd, EPOLL_CTL_DEL, client->fd, NULL);
+
+            handshake_untrack(client);
+
+            if (ret < 0) {
+                cleanup_client(client);
+
+                continue;
+            }
+
+            client->state = STATE_READ_REQUEST;
+
+            // A request that arrived with the handshake (0-RTT) will not raise another EPOLLIN.
+            if (ret == 2) {
+                enqueue_request(client);
+
+                continue;
+            }
+
+            // Hand the connection back to the request loop; ADD reports a request that is already waiting.
+            // An h2 connection stays armed for good, and EPOLLOUT sends the server preface right away.
+            ev.events = client->h2 ? (EPOLLIN | EPOLLOUT | EPOLLET) : (EPOLLIN | EPOLLET | EPOLLONESHOT);
+
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client->fd, &ev) == -1) {
+                perror("handshake: epoll_ctl add client");
+
+                cleanup_client(client);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static int start_handshake_pool(void) {
+    int threads = g_handshake_threads > 0 ? g_handshake_threads : g_topology.effective_cpus;
+
+    if (threads > HANDSHAKE_MAX_THREADS) {
+        threads = HANDSHAKE_MAX_THREADS;
+    }
+
+    g_handshake_epfd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (g_handshake_epfd == -1) {
+        perror("handshake: epoll_create1");
+
+        return -1;
+    }
+
+    for (int i = 0; i < threads; i++) {
+        pthread_t tid;
+
+        if (pthread_create(&tid, NULL, handshake_thread_function, (void*)(intptr_t)i) != 0) {
+            perror("Could not create handshake thread");
+
+            return -1;
+        }
+
+        pthread_detach(tid);
+    }
+
+    g_handshake_threads = threads;
+
+    metrics_register_source(handshake_metrics_source);
+
+    return 0;
+}
+
+void rearm_client(int epoll_fd, ClientState* client) {
+    struct epoll_event ev;
+    ev.data.ptr = client;
+    ev.events = EPOLLIN | EPOLLET | EPOLLONESHOT;
+
+    if (client->want_write) {
+        ev.events |= EPOLLOUT;
+    }
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->fd, &ev) == -1) {
+        perror("rearm_client: epoll_ctl");
+
+        cleanup_client(client);
+    }
+}
+
+static int open_listener(Listener* listener) {
+    struct sockaddr_in6 server_addr;
+    int server_socket = socket(AF_INET6, SOCK_STREAM, 0);
+
+    if (server_socket == -1) {
+        perror("Could not create socket");
+
+        return -1;
+    }
+
+    int reuse = 1;
+
+    if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) {
+        perror("setsockopt(SO_REUSEADDR) failed");
+
+        close(server_socket);
+
+        return -1;
+    }
+
+    if (set_nonblock(server_socket) < 0){
+        close(server_socket);
+
+        return -1;
+    }
+
+    int optval = 0;
+
+    if (setsockopt(server_socket, IPPROTO_IPV6, IPV6_V6ONLY, &optval, sizeof(optval)) < 0) {
+        perror("setsockopt IPV6_V6ONLY failed");
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+
+    server_addr.sin6_family = AF_INET6;
+    server_addr.sin6_addr = in6addr_any;
+    server_addr.sin6_port = htons(listener->port);
+
+    if (bind(server_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        perror("Bind failed");
+
+        close(server_socket);
+
+        return -1;
+    }
+
+    if (listen(server_socket, 128) < 0) {
+        perror("Listen failed");
+
+        close(server_socket);
+
+        return -1;
+    }
+
+    listener->fd = server_socket;
+    listener->state = create_client_state(server_socket);
+    listener->state->listener = listener;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = listener->state;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_socket, &ev) == -1) {
+        perror("epoll_ctl: add server_socket");
+
+        return -1;
+    }
+
+    return 0;
+}
+
+static void accept_connections(Listener* listener) {
+    struct sockaddr_in6 client_addr;
+    socklen_t client_len = sizeof(client_addr);
+    int handshake = listener->transport->handshake != NULL;
+
+    while (1) {
+        if (handshake && __atomic_load_n(&g_handshakes_inflight, __ATOMIC_SEQ_CST) >= g_handshake_max_inflight) {
+            pause_accepting();
+
+            break;
+        }
+
+        int client_socket = accept(listener->fd, (struct sockaddr *)&client_addr, &client_len);
+
+        if (client_socket == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            else {
+                perror("accept");
+
+                break;
+            }
+        }
+
+        printf("Main Thread: Connection accepted (fd=%d, %s)\n", client_socket, listener->transport->name);
+
+        int keepalive = 1;
+
+        if (setsockopt(client_socket, SOL_SOCKET, SO_KEEPALIVE, &keepalive, sizeof(keepalive)) < 0) {
+            perror("setsockopt(SO_KEEPALIVE) failed");
+        }
+
+        set_nonblock(client_socket);
+
+        ClientState* new_client = create_client_state(client_socket);
+
+        new_client->transport = listener->transport;
+        new_client->addr_hash = upstream_client_hash((struct sockaddr*)&client_addr);
+        new_client->local_peer = metrics_peer_is_local((struct sockaddr*)&client_addr);
+        new_client->t_accept = metrics_now_ns();
+
+        metrics_count(METRIC_CONNECTIONS_ACCEPTED, 1);
+
+        if (new_client->transport->attach && new_client->transport->attach(new_client) < 0) {
+            cleanup_client(new_client);
+
+            continue;
+        }
+
+        struct epoll_event ev;
+        ev.data.ptr = new_client;
+
+        if (!handshake) {
+            ev.events = EPOLLIN | EPOLLET | EPOLLONESHOT;
+
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_socket, &ev) == -1) {
+                perror("epoll_ctl: add client_socket");
+
+                cleanup_client(new_client);
+            }
+
+            continue;
+        }
+
+        new_client->state = STATE_SSL_HANDSHAKE;
+
+        // The handshake pool owns the connection until the transport is ready for requests.
+        handshake_track(new_client);
+
+        ev.events = EPOLLIN | EPOLLONESHOT;
+
+        if (epoll_ctl(g_handshake_epfd, EPOLL_CTL_ADD, client_socket, &ev) == -1) {
+            perror("epoll_ctl: add client_socket");
+
+            handshake_untrack(new_client);
+
+            cleanup_client(new_client);
+        }
+    }
+}
+
+static void read_request(ClientState* client) {
+    while (client->bytes_read < BUFFER_SIZE - 1) {
+        ssize_t bytes_received = client->transport->read(client, client->buffer + client->bytes_read, BUFFER_SIZE - client->bytes_read - 1);
+
+        if (bytes_received == TRANSPORT_AGAIN) {
+            rearm_client(epoll_fd, client);
+
+            return;
+        }
+
+        if (bytes_received <= 0) {
+            cleanup_client(client);
+
+            return;
+        }
+
+        if (client->bytes_read == 0) {
+            client->t_read_start = metrics_now_ns();
+        }
+
+        client->bytes_read += bytes_received;
+        client->buffer[client->bytes_read] = '\0';
+
+        metrics_count(METRIC_BYTES_IN, bytes_received);
+
+        if (strstr(client->buffer, "\r\n\r\n")) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+
+            enqueue_request(client);
+
+            return;
+        }
+    }
+
+    fprintf(stderr, "Request too large. Closing %d\n", client->fd);
+
+    cleanup_client(client);
+}
+
+int main() {
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGCHLD, SIG_IGN);
+
+    g_metrics_server_name = "server";
+
+    queue_init(&task_queue);
+
+    trace_install_signal();
+    trace_signal_mask(SIG_BLOCK);
+
+    topology_init("SERVER");
+
+    load_config_file("server.conf");
+
+    if (g_listener_count == 0) {
+        char http_port[16], https_port[16];
+
+        snprintf(http_port, sizeof(http_port), "%d", HTTP_PORT);
+        snprintf(https_port, sizeof(https_port), "%d", HTTPS_PORT);
+
+        listener_parse_config(http_port, "plain");
+        listener_parse_config(https_port, "tls");
+    }
+
+    unsigned roles = TOPOLOGY_ROLE(THREAD_ROLE_EVENT_LOOP) | TOPOLOGY_ROLE(THREAD_ROLE_WORKER);
+
+    if (radio_mount_enabled()) {
+        roles |= TOPOLOGY_ROLE(THREAD_ROLE_BROADCAST);
+    }
+
+    topology_finalize(roles);
+    topology_pin_current_thread(THREAD_ROLE_EVENT_LOOP, 0);
+
+    relay_init();
+    qos_init();
+    response_stream_global_init();
+    bufchain_init_metrics();
+    credentials_init();
+
+    for (int i = 0; i < g_listener_count; i++) {
+        if (g_listeners[i].transport == &g_transport_tls && !g_tls_enabled) {
+            if (transport_tls_init() < 0) {
+                return 1;
+            }
+
+            g_tls_enabled = 1;
+
+            h2_init();
+        }
+    }
+
+    for (int i = 0; i < g_topology.worker_threads; i++) {
+        pthread_t worker_thread;
+
+        if (pthread_create(&worker_thread, NULL, worker_thread_function, (void*)(intptr_t)i) != 0) {
+            perror("Could not create worker thread");
+
+            return 1;
+        }
+
+        pthread_detach(worker_thread);
+    }
+
+    if (g_tls_enabled && start_handshake_pool() < 0) {
+        return 1;
+    }
+
+    trace_signal_mask(SIG_UNBLOCK);
+
+    epoll_fd = epoll_create1(0);
+
+    if (epoll_fd == -1) {
+        perror("epoll_create1");
+
+        return 1;
+    }
+
+    for (int i = 0; i < g_listener_count; i++) {
+        if (open_listener(&g_listeners[i]) < 0) {
+            return 1;
+        }
+
+        printf("Server listening on port %d (%s)\n", g_listeners[i].port, g_listeners[i].transport->name);
+    }
+
+    if (radio_mount_enabled() && radio_mount_init() < 0) {
+        return 1;
+    }
+
+    int max_events = g_topology.max_epoll_events;
+    struct epoll_event* events = (struct epoll_event*)calloc(max_events, sizeof(struct epoll_event));
+
+    if (!events) {
+        perror("calloc epoll events");
+
+        return 1;
+    }
+
+    uint64_t last_idle_sweep = metrics_now_ns();
+
+    printf("Serving %d listeners with %d worker threads, %d handshake threads (max %d in flight)\n",
+           g_listener_count, g_topology.worker_threads, g_handshake_threads, g_handshake_max_inflight);
+
+    while (1) {
+        int qos_wait = qos_tick();
+        int n_events = epoll_wait(epoll_fd, events, max_events, qos_wait >= 0 ? qos_wait : 1000);
+
+        if (metrics_now_ns() - last_idle_sweep >= 1000000000ull) {
+            last_idle_sweep = metrics_now_ns();
+
+            upstream_expire_idle();
+            upstream_health_tick();
+
+            if (g_tls_enabled) {
+                tls_session_tick();
+                handshake_expire();
+            }
+        }
+
+        if (g_trace_dump_requested) {
+            g_trace_dump_requested = 0;
+
+            trace_dump_file();
+        }
+
+        if (n_events == -1) {
+            if (errno == EINTR){
+                continue;
+            }
+
+            perror("epoll_wait");
+
+            break;
+        }
+
+        int radio_due = 0;
+
+        for (int i = 0; i < n_events; i++) {
+            ClientState* client = (ClientState*)events[i].data.ptr;
+
+            if (client == NULL) {
+                continue;
+            }
+
+            if (radio_mount_is_tick(client)) {
+                radio_due = 1;
+            }
+            else if (client->listener) {
+                accept_connections(client->listener);
+            }
+            else if (client->h2) {
+                h2_connection_event(client);
+            }
+            else if (client->state == STATE_UPSTREAM_CONNECTING) {
+                proxy_connect_complete(client);
+            }
+            else if (client->state == STATE_PROXYING) {
+                relay_event(client, events, i + 1, n_events);
+            }
+            else if (client->state == STATE_REQUEST_BODY) {
+                request_body_event(client, events, i + 1, n_events);
+            }
+            else if (client->state == STATE_STREAMING) {
+                response_stream_event(client, events, i, n_events);
+            }
+            else if ((events[i].events & EPOLLIN) || (client->want_write && client->output.len == 0 && client->file_stream == NULL && client->sendfile_stream == NULL)) {
+                if (client->state == STATE_READ_REQUEST) {
+                    read_request(client);
+                }
+            }
+            else if (events[i].events & EPOLLOUT) {
+                int ret = client_pump_output(client);
+
+                if (ret == 0 && client->sendfile_stream != NULL) {
+                    ret = client_sendfile_continue(client);
+                }
+
+                if (ret == QOS_PARKED) {
+                    continue;
+                }
+
+                if (ret < 0) {
+                    cleanup_client(client);
+
+                    continue;
+                }
+
+                if (ret == 0) {
+                    request_write_end(client);
+
+                    client->state = STATE_READ_REQUEST;
+                    client->bytes_read = 0;
+
+                    bzero(client->buffer, BUFFER_SIZE);
+                }
+
+                struct epoll_event ev;
+                ev.events = (ret == 1 ? EPOLLOUT : EPOLLIN) | EPOLLET | EPOLLONESHOT;
+                ev.data.ptr = client;
+
+                if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->fd, &ev) == -1) {
+                    cleanup_client(client);
+                }
+            }
+        }
+
+        // After the batch, so listeners freed here cannot be handed a stale event.
+        if (radio_due) {
+            radio_mount_event();
+        }
+    }
+
+    free(events);
+
+    for (int i = 0; i < g_listener_count; i++) {
+        close(g_listeners[i].fd);
+    }
+
+    close(epoll_fd);
+
+    return 0;
+}
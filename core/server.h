@@ -0,0 +1,188 @@
+#define _GNU_SOURCE
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <jansson.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <signal.h>
+#include "metrics.h"
+#include "trace.h"
+#include "topology.h"
+#include "upstream.h"
+#include "relay.h"
+#include "credentials.h"
+#include "bufchain.h"
+#include "chunked.h"
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include "tls_session.h"
+#include "transport.h"
+#include "hpack.h"
+#include "h2.h"
+#include "request_body.h"
+#include "qos.h"
+#include "response_stream.h"
+#include "radio_mount.h"
+
+#define HTTP_PORT 8080
+#define HTTPS_PORT 8081
+#define MAX_LISTENERS 8
+#define RADIO_PORT 9001
+#define BUFFER_SIZE 4096
+#define MAX_ROUTES 32
+#define HANDSHAKE_MAX_THREADS 16
+#define HANDSHAKE_DEFAULT_MAX_INFLIGHT 1024
+#define HANDSHAKE_DEFAULT_TIMEOUT 10
+#define HANDSHAKE_EPOLL_EVENTS 64
+
+typedef enum {
+    STATE_SSL_HANDSHAKE,
+    STATE_READ_REQUEST,
+    STATE_UPSTREAM_CONNECTING,
+    STATE_PROXYING,
+    STATE_REQUEST_BODY,
+    STATE_STREAMING
+} ClientConnState;
+
+struct Listener;
+
+typedef struct ClientState {
+    int fd;
+    const Transport* transport;
+    SSL* ssl;
+    char buffer[BUFFER_SIZE];
+    size_t bytes_read;
+    ClientConnState state;
+    struct ClientState* peer;
+
+    // Hash of the client's address from accept and whether it is on this host; h2 streams inherit both.
+    uint32_t addr_hash;
+    int local_peer;
+
+    uint64_t t_accept;
+    uint64_t t_read_start;
+    uint64_t t_enqueue;
+    uint64_t t_dequeue;
+    uint64_t t_write_start;
+    TraceRecord* trace;
+    int is_upstream;
+    Upstream* upstream;
+    UpstreamResponse response;
+    RelayPipe relay;
+    int relay_eof;
+    int response_complete;
+
+    BufChain output;
+    TlsRecordState record;
+    FILE* file_stream;
+    int is_cgi;
+
+    // Static body still to be sent from the page cache (sendfile, or SSL_sendfile under kTLS).
+    FILE* sendfile_stream;
+    off_t sendfile_offset;
+    size_t sendfile_remaining;
+    int want_write;
+
+    // CGI request body still streaming in from the event loop.
+    RequestBody body;
+
+    // Response tail fed from a producer fd by the event loop, with no worker attached.
+    ResponseStream producer;
+
+    QosState qos;
+
+    // Still draining 0-RTT data; reads go through SSL_read_early_data until the client's EndOfEarlyData.
+    int early_reading;
+
+    // Links in the in-progress handshake list, owned by the handshake pool until the handshake ends.
+    struct ClientState* hs_prev;
+    struct ClientState* hs_next;
+    int hs_expired;
+
+    // Set only on the epoll cookie of a listening socket.
+    struct Listener* listener;
+
+    // An h2 connection owns a session; each of its requests is a ClientState with fd -1 and a stream.
+    struct H2Session* h2;
+    struct H2Stream* stream;
+} ClientState;
+
+typedef struct Listener {
+    int port;
+    const Transport* transport;
+    int fd;
+    ClientState* state;
+} Listener;
+
+
+typedef struct Task {
+    ClientState* client;
+    struct Task* next;
+} Task;
+
+typedef struct {
+    Task* head;
+    Task* tail;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} TaskQueue;
+
+typedef enum {
+    ROUTE_STATIC,
+    ROUTE_CGI,
+    ROUTE_PROXY
+} RouteType;
+
+typedef struct {
+    char path[256];
+    RouteType type;
+    char target[256];
+    int needs_auth;
+    int replay_safe;
+    uint64_t max_body;
+    QosClass qos_class;
+    UpstreamGroup* upstreams;
+} RouteRule;
+
+extern RouteRule g_routes[MAX_ROUTES];
+extern int g_route_count;
+extern int epoll_fd;
+
+void queue_init(TaskQueue* q);
+void queue_push(TaskQueue* q, ClientState* client);
+ClientState* queue_pop(TaskQueue* q);
+void handle_work(ClientState* client);
+int set_nonblock(int fd);
+ClientState* create_client_state(int fd);
+void request_write_begin(ClientState* client);
+void request_write_end(ClientState* client);
+void proxy_connect_complete(ClientState* upstream_state);
+void enqueue_request(ClientState* client);
+void cleanup_client(ClientState* client);
+int handshake_parse_config(const char* key, const char* value);
+int listener_parse_config(const char* port, const char* transport);
+int request_replay_safe(const char* request);
+const char* find_header_span(const char* request, const char* header_name, size_t* len);
+
+void load_config_file(const char* filename);
+int client_send(ClientState* client, const char* response, size_t len);
+
+int client_sendfile_continue(ClientState* client);
+
+int client_write_pending(ClientState* client);
+
+int client_pump_output(ClientState* client);
+#endif
\ No newline at end of file
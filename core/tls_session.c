@@ -0,0 +1,514 @@
+#define _GNU_SOURCE
+#include "tls_session.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <pthread.h>
+#include <openssl/rand.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/core_names.h>
+#include <openssl/err.h>
+
+static int g_tickets_enabled = 1;
+static long g_cache_size = 0;
+static long g_rotate_sec = TICKET_DEFAULT_ROTATE_SEC;
+static char g_key_file[256] = "";
+static int g_ktls_enabled = 1;
+static int g_record_sizing = 1;
+static size_t g_record_small = TLS_DEFAULT_SMALL_RECORD;
+static uint64_t g_record_ramp = TLS_DEFAULT_RECORD_RAMP;
+static uint64_t g_record_idle_ns = (uint64_t)TLS_DEFAULT_RECORD_IDLE_MS * 1000000ull;
+static int g_early_data = 0;
+static long g_early_window = TLS_DEFAULT_EARLY_DATA_WINDOW;
+static time_t g_started = 0;
+
+static unsigned char g_shared_secret[64];
+static size_t g_shared_secret_len = 0;
+
+// Slot 0 encrypts new tickets; older slots only decrypt, so a ticket lives up to TICKET_KEY_RING epochs.
+static TicketKey g_keys[TICKET_KEY_RING];
+static pthread_rwlock_t g_keys_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static SSL_CTX* g_ctx = NULL;
+
+// Fingerprints of tickets that already carried early data, kept until they fall out of the window.
+typedef struct {
+    uint64_t fingerprint;
+    time_t expires;
+} EarlyDataStrike;
+
+static EarlyDataStrike g_strikes[EARLY_DATA_STRIKE_SLOTS];
+static pthread_mutex_t g_strikes_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t g_full_handshakes = 0;
+static uint64_t g_resumed_handshakes = 0;
+static uint64_t g_tickets_issued = 0;
+static uint64_t g_tickets_renewed = 0;
+static uint64_t g_tickets_unknown = 0;
+static uint64_t g_key_rotations = 0;
+
+static void tls_session_metrics_source(MetricsWriter* w) {
+    metrics_write_value(w, "tls_handshakes_full_total", "TLS handshakes without resumption", __atomic_load_n(&g_full_handshakes, __ATOMIC_RELAXED));
+    metrics_write_value(w, "tls_handshakes_resumed_total", "TLS handshakes resumed from a ticket or the session cache", __atomic_load_n(&g_resumed_handshakes, __ATOMIC_RELAXED));
+    metrics_write_value(w, "tls_tickets_issued_total", "Session tickets encrypted", __atomic_load_n(&g_tickets_issued, __ATOMIC_RELAXED));
+    metrics_write_value(w, "tls_tickets_renewed_total", "Tickets accepted under an older key and reissued", __atomic_load_n(&g_tickets_renewed, __ATOMIC_RELAXED));
+    metrics_write_value(w, "tls_tickets_unknown_key_total", "Tickets rejected because their key was rotated out", __atomic_load_n(&g_tickets_unknown, __ATOMIC_RELAXED));
+    metrics_write_value(w, "tls_ticket_key_rotations_total", "Ticket key rotations", __atomic_load_n(&g_key_rotations, __ATOMIC_RELAXED));
+    metrics_write_value(w, "tls_ktls_requested", "Whether kTLS offload is requested from OpenSSL", (uint64_t)g_ktls_enabled);
+
+    if (g_ctx && g_cache_size > 0) {
+        metrics_write_value(w, "tls_session_cache_entries", "Sessions held in the shared cache", (uint64_t)SSL_CTX_sess_number(g_ctx));
+        metrics_write_value(w, "tls_session_cache_hits_total", "Session cache lookups that resumed", (uint64_t)SSL_CTX_sess_hits(g_ctx));
+        metrics_write_value(w, "tls_session_cache_misses_total", "Session cache lookups that missed", (uint64_t)SSL_CTX_sess_misses(g_ctx));
+        metrics_write_value(w, "tls_session_cache_full_total", "Sessions evicted because the cache was full", (uint64_t)SSL_CTX_sess_cache_full(g_ctx));
+    }
+}
+
+int tls_session_parse_config(const char* key, const char* value) {
+    if (strcmp(key, "TLS_SESSION_TICKETS") == 0) {
+        g_tickets_enabled = (strcasecmp(value, "on") == 0 || strcmp(value, "1") == 0);
+    }
+    else if (strcmp(key, "TLS_SESSION_CACHE") == 0) {
+        g_cache_size = atol(value);
+    }
+    else if (strcmp(key, "TLS_TICKET_ROTATE") == 0) {
+        g_rotate_sec = atol(value) > 0 ? atol(value) : TICKET_DEFAULT_ROTATE_SEC;
+    }
+    else if (strcmp(key, "TLS_TICKET_KEY_FILE") == 0) {
+        strncpy(g_key_file, value, sizeof(g_key_file) - 1);
+    }
+    else if (strcmp(key, "KTLS") == 0) {
+        g_ktls_enabled = (strcasecmp(value, "on") == 0 || strcmp(value, "1") == 0);
+    }
+    else if (strcmp(key, "TLS_EARLY_DATA") == 0) {
+        g_early_data = (strcasecmp(value, "on") == 0 || strcmp(value, "1") == 0);
+    }
+    else if (strcmp(key, "TLS_EARLY_DATA_WINDOW") == 0) {
+        g_early_window = atol(value) > 0 ? atol(value) : TLS_DEFAULT_EARLY_DATA_WINDOW;
+    }
+    else if (strcmp(key, "TLS_RECORD_SIZING") == 0) {
+        g_record_sizing = (strcasecmp(value, "on") == 0 || strcmp(value, "1") == 0);
+    }
+    else if (strcmp(key, "TLS_RECORD_SMALL") == 0) {
+        long size = atol(value);
+
+        g_record_small = size < 512 ? 512 : (size > TLS_MAX_RECORD ? TLS_MAX_RECORD : (size_t)size);
+    }
+    else if (strcmp(key, "TLS_RECORD_RAMP") == 0) {
+        g_record_ramp = (uint64_t)atoll(value);
+    }
+    else if (strcmp(key, "TLS_RECORD_IDLE_MS") == 0) {
+        g_record_idle_ns = (uint64_t)atoll(value) * 1000000ull;
+    }
+    else {
+        return -1;
+    }
+
+    printf("Config: TLS %s = %s\n", key, value);
+
+    return 0;
+}
+
+// With a shared secret every process derives the same key for an epoch, so a ticket issued by
+// one instance (or before a restart) resumes on any other. Without one, keys are random per process.
+static int derive_key(TicketKey* key, uint64_t epoch) {
+    key->epoch = epoch;
+    key->valid = 1;
+
+    if (g_shared_secret_len == 0) {
+        return (RAND_bytes(key->name, sizeof(key->name)) == 1 &&
+                RAND_bytes(key->aes_key, sizeof(key->aes_key)) == 1 &&
+                RAND_bytes(key->hmac_key, sizeof(key->hmac_key)) == 1) ? 0 : -1;
+    }
+
+    const char* labels[3] = { "name", "aes", "hmac" };
+    unsigned char* outputs[3] = { key->name, key->aes_key, key->hmac_key };
+    size_t sizes[3] = { sizeof(key->name), sizeof(key->aes_key), sizeof(key->hmac_key) };
+
+    for (int i = 0; i < 3; i++) {
+        unsigned char msg[32];
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int digest_len = 0;
+        int msg_len = snprintf((char*)msg, sizeof(msg), "ticket-%s-%llu", labels[i], (unsigned long long)epoch);
+
+        if (!HMAC(EVP_sha256(), g_shared_secret, (int)g_shared_secret_len, msg, (size_t)msg_len, digest, &digest_len)) {
+            return -1;
+        }
+
+        memcpy(outputs[i], digest, sizes[i]);
+    }
+
+    return 0;
+}
+
+static int load_shared_secret(const char* filename) {
+    FILE* file = fopen(filename, "rb");
+
+    if (!file) {
+        perror("tls_session: fopen ticket key file");
+
+        return -1;
+    }
+
+    g_shared_secret_len = fread(g_shared_secret, 1, sizeof(g_shared_secret), file);
+
+    fclose(file);
+
+    if (g_shared_secret_len < 32) {
+        fprintf(stderr, "tls_session: %s must hold at least 32 bytes, using random ticket keys\n", filename);
+
+        g_shared_secret_len = 0;
+
+        return -1;
+    }
+
+    return 0;
+}
+
+// Only the event loop rotates, so it can read g_keys freely and just locks out the callbacks while swapping.
+static void rotate_keys(uint64_t epoch) {
+    TicketKey fresh[TICKET_KEY_RING];
+
+    memset(fresh, 0, sizeof(fresh));
+
+    for (int i = 0; i < TICKET_KEY_RING; i++) {
+        uint64_t wanted = epoch - (uint64_t)i;
+
+        // Keep existing keys as they age into the decrypt-only slots.
+        for (int j = 0; j < TICKET_KEY_RING; j++) {
+            if (g_keys[j].valid && g_keys[j].epoch == wanted) {
+                fresh[i] = g_keys[j];
+            }
+        }
+
+        // Derived keys can be recomputed for past epochs; random ones cannot, so those slots stay empty.
+        if (!fresh[i].valid && (i == 0 || g_shared_secret_len > 0) && derive_key(&fresh[i], wanted) < 0) {
+            fresh[i].valid = 0;
+        }
+    }
+
+    pthread_rwlock_wrlock(&g_keys_lock);
+
+    memcpy(g_keys, fresh, sizeof(g_keys));
+
+    pthread_rwlock_unlock(&g_keys_lock);
+
+    OPENSSL_cleanse(fresh, sizeof(fresh));
+
+    __atomic_add_fetch(&g_key_rotations, 1, __ATOMIC_RELAXED);
+}
+
+static int set_ticket_keys(const TicketKey* key, unsigned char* iv, EVP_CIPHER_CTX* cipher, EVP_MAC_CTX* mac, int enc) {
+    OSSL_PARAM params[3];
+
+    params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, (void*)key->hmac_key, sizeof(key->hmac_key));
+    params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "SHA256", 0);
+    params[2] = OSSL_PARAM_construct_end();
+
+    if (!EVP_MAC_CTX_set_params(mac, params)) {
+        return -1;
+    }
+
+    if (enc) {
+        return EVP_EncryptInit_ex(cipher, EVP_aes_256_cbc(), NULL, key->aes_key, iv) == 1 ? 0 : -1;
+    }
+
+    return EVP_DecryptInit_ex(cipher, EVP_aes_256_cbc(), NULL, key->aes_key, iv) == 1 ? 0 : -1;
+}
+
+static int ticket_key_cb(SSL* ssl, unsigned char key_name[16], unsigned char* iv, EVP_CIPHER_CTX* cipher, EVP_MAC_CTX* mac, int enc) {
+    (void)ssl;
+
+    int ret = 0;
+
+    pthread_rwlock_rdlock(&g_keys_lock);
+
+    if (enc) {
+        if (g_keys[0].valid && RAND_bytes(iv, EVP_MAX_IV_LENGTH) == 1 && set_ticket_keys(&g_keys[0], iv, cipher, mac, 1) == 0) {
+            memcpy(key_name, g_keys[0].name, 16);
+
+            __atomic_add_fetch(&g_tickets_issued, 1, __ATOMIC_RELAXED);
+
+            ret = 1;
+        }
+        else {
+            ret = -1;
+        }
+    }
+    else {
+        for (int i = 0; i < TICKET_KEY_RING; i++) {
+            if (!g_keys[i].valid || memcmp(key_name, g_keys[i].name, 16) != 0) {
+                continue;
+            }
+
+            if (set_ticket_keys(&g_keys[i], iv, cipher, mac, 0) == 0) {
+                // 2 asks OpenSSL to resume and hand out a ticket under the current key.
+                ret = (i == 0) ? 1 : 2;
+            }
+
+            break;
+        }
+
+        if (ret == 2) {
+            __atomic_add_fetch(&g_tickets_renewed, 1, __ATOMIC_RELAXED);
+        }
+        else if (ret == 0) {
+            __atomic_add_fetch(&g_tickets_unknown, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    pthread_rwlock_unlock(&g_keys_lock);
+
+    return ret;
+}
+
+static uint64_t fingerprint(const unsigned char* data, size_t len) {
+    uint64_t hash = 1469598103934665603ull;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash ? hash : 1;
+}
+
+// Returns 1 the first time a ticket is seen inside the window, 0 for a replay or when the register is full.
+static int strike_register(uint64_t fp, time_t now) {
+    int free_slot = -1;
+    int result = 0;
+
+    pthread_mutex_lock(&g_strikes_mutex);
+
+    for (int i = 0; i < EARLY_DATA_STRIKE_PROBES; i++) {
+        EarlyDataStrike* slot = &g_strikes[(fp + (uint64_t)i) % EARLY_DATA_STRIKE_SLOTS];
+
+        if (slot->expires > now && slot->fingerprint == fp) {
+            free_slot = -1;
+
+            metrics_count(METRIC_TLS_EARLY_REPLAYS, 1);
+
+            break;
+        }
+
+        if (slot->expires <= now && free_slot < 0) {
+            free_slot = (int)((fp + (uint64_t)i) % EARLY_DATA_STRIKE_SLOTS);
+        }
+    }
+
+    if (free_slot >= 0) {
+        g_strikes[free_slot].fingerprint = fp;
+        g_strikes[free_slot].expires = now + g_early_window;
+
+        result = 1;
+    }
+
+    pthread_mutex_unlock(&g_strikes_mutex);
+
+    return result;
+}
+
+// Each resumption secret may carry early data once. Tickets older than the window, or issued before
+// this process started (the strike register does not survive a restart), fall back to a full round trip.
+static int allow_early_data_cb(SSL* ssl, void* arg) {
+    (void)arg;
+
+    SSL_SESSION* session = SSL_get0_session(ssl);
+    time_t now = time(NULL);
+
+    if (!session) {
+        return 0;
+    }
+
+    time_t issued = (time_t)SSL_SESSION_get_time(session);
+
+    if (issued < g_started || now - issued > g_early_window) {
+        return 0;
+    }
+
+    unsigned char secret[SSL_MAX_MASTER_KEY_LENGTH];
+    size_t len = SSL_SESSION_get_master_key(session, secret, sizeof(secret));
+
+    if (len == 0) {
+        return 0;
+    }
+
+    int ok = strike_register(fingerprint(secret, len), now);
+
+    OPENSSL_cleanse(secret, sizeof(secret));
+
+    return ok;
+}
+
+static uint64_t current_epoch(void) {
+    return (uint64_t)time(NULL) / (uint64_t)g_rotate_sec;
+}
+
+void tls_session_init(SSL_CTX* ctx) {
+    g_ctx = ctx;
+
+    SSL_CTX_set_session_id_context(ctx, (const unsigned char*)"caligo", 6);
+
+    // Tickets outlive neither their key ring nor the server's idea of a session.
+    SSL_CTX_set_timeout(ctx, g_rotate_sec * (TICKET_KEY_RING - 1));
+
+    if (g_cache_size > 0) {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(ctx, g_cache_size);
+    }
+    else {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+    }
+
+    if (g_tickets_enabled) {
+        if (g_key_file[0]) {
+            load_shared_secret(g_key_file);
+        }
+
+        rotate_keys(current_epoch());
+
+        SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, ticket_key_cb);
+    }
+    else {
+        // TLS 1.3 then falls back to stateful tickets backed by the session cache.
+        SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+    }
+
+    g_started = time(NULL);
+
+    if (g_early_data) {
+        SSL_CTX_set_max_early_data(ctx, TLS_EARLY_DATA_MAX);
+        SSL_CTX_set_recv_max_early_data(ctx, TLS_EARLY_DATA_MAX);
+        SSL_CTX_set_allow_early_data_cb(ctx, allow_early_data_cb, NULL);
+
+        // OpenSSL's own anti-replay would silently switch to stateful tickets; the strike register covers stateless ones.
+        if (g_tickets_enabled) {
+            SSL_CTX_set_options(ctx, SSL_OP_NO_ANTI_REPLAY);
+        }
+
+        printf("TLS: 0-RTT early data on (up to %d bytes, anti-replay window %lds)\n", TLS_EARLY_DATA_MAX, g_early_window);
+    }
+    else {
+        SSL_CTX_set_recv_max_early_data(ctx, 0);
+    }
+
+#ifndef OPENSSL_NO_KTLS
+    // OpenSSL only switches a connection to kTLS when the kernel module and negotiated cipher allow it.
+    if (g_ktls_enabled) {
+        SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+    }
+#else
+    g_ktls_enabled = 0;
+#endif
+
+    metrics_register_source(tls_session_metrics_source);
+
+    printf("TLS: kTLS %s\n", g_ktls_enabled ? "requested" : "off");
+
+    if (g_record_sizing) {
+        printf("TLS: %zu byte records for the first %llu bytes after %llu ms idle, then %d\n",
+               g_record_small, (unsigned long long)g_record_ramp, (unsigned long long)(g_record_idle_ns / 1000000ull), TLS_MAX_RECORD);
+    }
+
+    printf("TLS: session tickets %s (%s keys, rotate every %lds), session cache %ld entries\n",
+           g_tickets_enabled ? "on" : "off", g_shared_secret_len ? "shared" : "per-process",
+           g_rotate_sec, g_cache_size > 0 ? g_cache_size : 0);
+}
+
+void tls_session_tick(void) {
+    if (!g_tickets_enabled) {
+        return;
+    }
+
+    uint64_t epoch = current_epoch();
+
+    if (epoch != g_keys[0].epoch) {
+        rotate_keys(epoch);
+    }
+}
+
+void tls_session_note_handshake(SSL* ssl) {
+    if (SSL_session_reused(ssl)) {
+        __atomic_add_fetch(&g_resumed_handshakes, 1, __ATOMIC_RELAXED);
+    }
+    else {
+        __atomic_add_fetch(&g_full_handshakes, 1, __ATOMIC_RELAXED);
+    }
+}
+
+int tls_early_data_enabled(void) {
+    return g_early_data;
+}
+
+int tls_ktls_send_active(SSL* ssl) {
+#ifndef OPENSSL_NO_KTLS
+    // Responses to early data go out before the handshake is confirmed; keep those on SSL_write.
+    return g_ktls_enabled && SSL_is_init_finished(ssl) && BIO_get_ktls_send(SSL_get_wbio(ssl)) ? 1 : 0;
+#else
+    (void)ssl;
+
+    return 0;
+#endif
+}
+
+// Small records let the browser decrypt and parse the start of a response before a full 16 KB
+// record has arrived; once the connection is moving bulk data, full records cost less CPU and framing.
+int tls_record_write(SSL* ssl, TlsRecordState* rs, const void* data, size_t len) {
+    uint64_t now = metrics_now_ns();
+    size_t cap = TLS_MAX_RECORD;
+
+    if (g_record_sizing) {
+        if (rs->bytes_sent > 0 && now - rs->last_write_ns > g_record_idle_ns) {
+            rs->bytes_sent = 0;
+
+            metrics_count(METRIC_TLS_RECORD_IDLE_RESETS, 1);
+        }
+
+        if (rs->bytes_sent < g_record_ramp) {
+            cap = g_record_small;
+        }
+    }
+
+    // After WANT_WRITE, OpenSSL needs the retry to be at least as long as the failed call.
+    if (rs->retry_len > cap) {
+        cap = rs->retry_len;
+    }
+
+    size_t n = len < cap ? len : cap;
+    int sent;
+
+    if (SSL_is_init_finished(ssl)) {
+        sent = SSL_write(ssl, data, (int)n);
+    }
+    else {
+        // Answering a 0-RTT request: write at 0.5-RTT, ahead of the client's Finished.
+        size_t written = 0;
+
+        sent = SSL_write_early_data(ssl, data, n, &written) == 1 ? (int)written : -1;
+    }
+
+    if (sent <= 0) {
+        rs->retry_len = n;
+
+        return sent;
+    }
+
+    rs->retry_len = 0;
+    rs->bytes_sent += (uint64_t)sent;
+    rs->last_write_ns = now;
+
+    if (cap < TLS_MAX_RECORD) {
+        metrics_count(METRIC_TLS_RECORDS_SMALL, 1);
+        metrics_count(METRIC_TLS_RECORD_BYTES_SMALL, sent);
+    }
+    else {
+        metrics_count(METRIC_TLS_RECORDS_FULL, 1);
+        metrics_count(METRIC_TLS_RECORD_BYTES_FULL, sent);
+    }
+
+    return sent;
+}
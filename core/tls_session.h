@@ -0,0 +1,48 @@
+#ifndef TLS_SESSION_H
+#define TLS_SESSION_H
+
+#include <stdint.h>
+#include <openssl/ssl.h>
+
+#define TICKET_KEY_RING 3
+#define TICKET_DEFAULT_ROTATE_SEC 3600
+#define TLS_MAX_RECORD 16384
+#define TLS_DEFAULT_SMALL_RECORD 1400
+#define TLS_DEFAULT_RECORD_RAMP (64 * 1024)
+#define TLS_DEFAULT_RECORD_IDLE_MS 1000
+#define TLS_EARLY_DATA_MAX 4096
+#define TLS_DEFAULT_EARLY_DATA_WINDOW 600
+#define EARLY_DATA_STRIKE_SLOTS 8192
+#define EARLY_DATA_STRIKE_PROBES 8
+
+typedef struct {
+    unsigned char name[16];
+    unsigned char aes_key[32];
+    unsigned char hmac_key[32];
+    uint64_t epoch;
+    int valid;
+} TicketKey;
+
+// Per-connection record sizing: about one MSS per record until the ramp threshold, then full records.
+typedef struct {
+    uint64_t bytes_sent;
+    uint64_t last_write_ns;
+    size_t retry_len;
+} TlsRecordState;
+
+int tls_session_parse_config(const char* key, const char* value);
+
+void tls_session_init(SSL_CTX* ctx);
+
+// Called from the event loop about once a second; rotates ticket keys at epoch boundaries.
+void tls_session_tick(void);
+
+void tls_session_note_handshake(SSL* ssl);
+
+int tls_ktls_send_active(SSL* ssl);
+
+int tls_early_data_enabled(void);
+
+int tls_record_write(SSL* ssl, TlsRecordState* rs, const void* data, size_t len);
+
+#endif
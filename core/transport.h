@@ -0,0 +1,49 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define TRANSPORT_AGAIN -1
+#define TRANSPORT_ERROR -2
+
+struct ClientState;
+
+// How bytes reach a client. read/write/sendfile return a byte count, 0 when the peer closed
+// (reads only), TRANSPORT_AGAIN when the socket would block, or TRANSPORT_ERROR.
+typedef struct Transport {
+    const char* name;
+
+    // Per-connection setup right after accept; NULL when there is nothing to set up.
+    int (*attach)(struct ClientState* client);
+
+    // Runs on the handshake pool: 0 when ready for requests, 1 to wait for the socket,
+    // 2 when a request is already buffered and may be served, -1 on error. NULL skips the pool.
+    int (*handshake)(struct ClientState* client);
+
+    ssize_t (*read)(struct ClientState* client, char* buf, size_t len);
+
+    ssize_t (*write)(struct ClientState* client, const char* buf, size_t len);
+
+    // Gathered write of queued output; NULL falls back to one write per segment.
+    ssize_t (*writev)(struct ClientState* client, const struct iovec* iov, int count);
+
+    // File bodies straight from the page cache, when can_sendfile says the connection allows it.
+    int (*can_sendfile)(struct ClientState* client);
+
+    ssize_t (*sendfile)(struct ClientState* client, int file_fd, off_t offset, size_t len);
+
+    void (*close)(struct ClientState* client);
+
+    // Bytes on the wire are the payload, so proxied traffic can be spliced socket to socket.
+    int splice_relay;
+} Transport;
+
+extern const Transport g_transport_plain;
+extern const Transport g_transport_tls;
+extern const Transport g_transport_h2;
+
+int transport_tls_init(void);
+
+#endif
@@ -0,0 +1,69 @@
+#include "server.h"
+#include <sys/sendfile.h>
+
+static ssize_t plain_read(ClientState* client, char* buf, size_t len) {
+    ssize_t n = recv(client->fd, buf, len, 0);
+
+    if (n >= 0) {
+        return n;
+    }
+
+    return (errno == EAGAIN || errno == EWOULDBLOCK) ? TRANSPORT_AGAIN : TRANSPORT_ERROR;
+}
+
+static ssize_t plain_write(ClientState* client, const char* buf, size_t len) {
+    ssize_t n = send(client->fd, buf, len, MSG_NOSIGNAL);
+
+    if (n > 0) {
+        return n;
+    }
+
+    return (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) ? TRANSPORT_AGAIN : TRANSPORT_ERROR;
+}
+
+static ssize_t plain_writev(ClientState* client, const struct iovec* iov, int count) {
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+
+    msg.msg_iov = (struct iovec*)iov;
+    msg.msg_iovlen = count;
+
+    ssize_t n = sendmsg(client->fd, &msg, MSG_NOSIGNAL);
+
+    if (n > 0) {
+        return n;
+    }
+
+    return (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) ? TRANSPORT_AGAIN : TRANSPORT_ERROR;
+}
+
+static int plain_can_sendfile(ClientState* client) {
+    (void)client;
+
+    return 1;
+}
+
+static ssize_t plain_sendfile(ClientState* client, int file_fd, off_t offset, size_t len) {
+    ssize_t n = sendfile(client->fd, file_fd, &offset, len);
+
+    if (n > 0) {
+        return n;
+    }
+
+    // 0 means the file shrank under us; stop rather than spin.
+    return (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) ? TRANSPORT_AGAIN : TRANSPORT_ERROR;
+}
+
+const Transport g_transport_plain = {
+    .name = "plain",
+    .attach = NULL,
+    .handshake = NULL,
+    .read = plain_read,
+    .write = plain_write,
+    .writev = plain_writev,
+    .can_sendfile = plain_can_sendfile,
+    .sendfile = plain_sendfile,
+    .close = NULL,
+    .splice_relay = 1
+};
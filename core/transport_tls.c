@@ -0,0 +1,303 @@
+#include "server.h"
+
+static SSL_CTX* ctx = NULL;
+
+// Server preference order, in ALPN wire format.
+static const unsigned char g_alpn_h2[] = "\x02h2\x08http/1.1";
+static const unsigned char g_alpn_http1[] = "\x08http/1.1";
+
+static int alpn_select(SSL* ssl, const unsigned char** out, unsigned char* outlen, const unsigned char* in, unsigned int inlen, void* arg) {
+    (void)ssl;
+    (void)arg;
+
+    const unsigned char* prefs = h2_enabled() ? g_alpn_h2 : g_alpn_http1;
+    unsigned int prefs_len = h2_enabled() ? sizeof(g_alpn_h2) - 1 : sizeof(g_alpn_http1) - 1;
+
+    if (SSL_select_next_proto((unsigned char**)out, outlen, prefs, prefs_len, in, inlen) != OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+
+    return SSL_TLSEXT_ERR_OK;
+}
+
+int transport_tls_init(void) {
+    const SSL_METHOD *method = TLS_server_method();
+
+    ctx = SSL_CTX_new(method);
+
+    if (!ctx) {
+        perror("Unable to create SSL context");
+
+        ERR_print_errors_fp(stderr);
+
+        return -1;
+    }
+
+    long opts = SSL_OP_IGNORE_UNEXPECTED_EOF | SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE;
+
+    SSL_CTX_set_options(ctx, opts);
+
+    // Pending output is realloc'd as it grows, so retried writes may come from a new address.
+    SSL_CTX_set_mode(ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    if (!SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION)) {
+        ERR_print_errors_fp(stderr);
+
+        fprintf(stderr, "Failed to set the minimum TLS protocol version\n");
+
+        return -1;
+    }
+
+    if (SSL_CTX_use_certificate_file(ctx, "cert.pem", SSL_FILETYPE_PEM) <= 0) {
+        ERR_print_errors_fp(stderr);
+
+        return -1;
+    }
+
+    if (SSL_CTX_use_PrivateKey_file(ctx, "key.pem", SSL_FILETYPE_PEM) <= 0 ) {
+        ERR_print_errors_fp(stderr);
+
+        return -1;
+    }
+
+    SSL_CTX_set_alpn_select_cb(ctx, alpn_select, NULL);
+
+    tls_session_init(ctx);
+
+    return 0;
+}
+
+static int tls_attach(ClientState* client) {
+    client->ssl = SSL_new(ctx);
+
+    if (!client->ssl) {
+        ERR_print_errors_fp(stderr);
+
+        return -1;
+    }
+
+    SSL_set_fd(client->ssl, client->fd);
+
+    client->early_reading = tls_early_data_enabled();
+
+    return 0;
+}
+
+// Same contract as SSL_read, but finishes draining 0-RTT data first; the SSL_read after that completes the handshake.
+static int client_ssl_read(ClientState* client, char* buf, int len) {
+    if (client->early_reading) {
+        size_t got = 0;
+        int ret = SSL_read_early_data(client->ssl, buf, (size_t)len, &got);
+
+        if (ret == SSL_READ_EARLY_DATA_SUCCESS) {
+            metrics_count(METRIC_TLS_EARLY_BYTES, got);
+
+            return (int)got;
+        }
+
+        if (ret == SSL_READ_EARLY_DATA_ERROR) {
+            return -1;
+        }
+
+        client->early_reading = 0;
+    }
+
+    return SSL_read(client->ssl, buf, len);
+}
+
+static ssize_t tls_read(ClientState* client, char* buf, size_t len) {
+    int n = client_ssl_read(client, buf, (int)len);
+
+    if (n > 0) {
+        client->want_write = 0;
+
+        return n;
+    }
+
+    int err = SSL_get_error(client->ssl, n);
+
+    client->want_write = (err == SSL_ERROR_WANT_WRITE);
+
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+        return TRANSPORT_AGAIN;
+    }
+
+    return err == SSL_ERROR_ZERO_RETURN ? 0 : TRANSPORT_ERROR;
+}
+
+static ssize_t tls_write(ClientState* client, const char* buf, size_t len) {
+    int sent = tls_record_write(client->ssl, &client->record, buf, len);
+
+    if (sent > 0) {
+        return sent;
+    }
+
+    int err = SSL_get_error(client->ssl, sent);
+
+    if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) {
+        return TRANSPORT_AGAIN;
+    }
+
+    return TRANSPORT_ERROR;
+}
+
+static int tls_can_sendfile(ClientState* client) {
+    return tls_ktls_send_active(client->ssl);
+}
+
+static ssize_t tls_sendfile(ClientState* client, int file_fd, off_t offset, size_t len) {
+    ossl_ssize_t sent = SSL_sendfile(client->ssl, file_fd, offset, len, 0);
+
+    if (sent > 0) {
+        metrics_count(METRIC_TLS_KTLS_BYTES, sent);
+
+        return sent;
+    }
+
+    int err = SSL_get_error(client->ssl, (int)sent);
+
+    if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) {
+        return TRANSPORT_AGAIN;
+    }
+
+    ERR_print_errors_fp(stderr);
+
+    return TRANSPORT_ERROR;
+}
+
+static void tls_close(ClientState* client) {
+    if (client->ssl) {
+        SSL_shutdown(client->ssl);
+
+        SSL_free(client->ssl);
+
+        client->ssl = NULL;
+    }
+}
+
+// Returns 0 once early data is over, 1 to wait for more, 2 when the buffered request can be
+// answered before the handshake completes, -1 on error.
+static int read_early_data(ClientState* client) {
+    while (client->bytes_read < BUFFER_SIZE - 1) {
+        size_t got = 0;
+        int ret = SSL_read_early_data(client->ssl, client->buffer + client->bytes_read, BUFFER_SIZE - client->bytes_read - 1, &got);
+
+        if (ret == SSL_READ_EARLY_DATA_SUCCESS) {
+            if (client->bytes_read == 0) {
+                client->t_read_start = metrics_now_ns();
+
+                metrics_count(METRIC_TLS_EARLY_ACCEPTED, 1);
+            }
+
+            client->bytes_read += got;
+            client->buffer[client->bytes_read] = '\0';
+
+            metrics_count(METRIC_BYTES_IN, got);
+            metrics_count(METRIC_TLS_EARLY_BYTES, got);
+
+            // Dispatch before reading on: the client's EndOfEarlyData may already be queued behind the request.
+            if (request_replay_safe(client->buffer)) {
+                return 2;
+            }
+
+            continue;
+        }
+
+        if (ret == SSL_READ_EARLY_DATA_FINISH) {
+            client->early_reading = 0;
+
+            if (SSL_get_early_data_status(client->ssl) == SSL_EARLY_DATA_REJECTED) {
+                metrics_count(METRIC_TLS_EARLY_REJECTED, 1);
+            }
+
+            return 0;
+        }
+
+        int err = SSL_get_error(client->ssl, -1);
+
+        client->want_write = (err == SSL_ERROR_WANT_WRITE);
+
+        if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+            return 1;
+        }
+
+        ERR_print_errors_fp(stderr);
+
+        return -1;
+    }
+
+    fprintf(stderr, "Early data too large. Closing %d\n", client->fd);
+
+    return -1;
+}
+
+static int tls_handshake(ClientState* client) {
+    if (client->early_reading) {
+        int early = read_early_data(client);
+
+        if (early == 2) {
+            // 0.5-RTT: the response goes out while the client's Finished is still in flight.
+            tls_session_note_handshake(client->ssl);
+
+            metrics_count(METRIC_TLS_EARLY_REQUESTS, 1);
+        }
+
+        if (early != 0) {
+            return early;
+        }
+    }
+
+    int ret = SSL_accept(client->ssl);
+
+    if (ret == 1) {
+        printf("SSL Handshake complete for fd %d\n", client->fd);
+
+        tls_session_note_handshake(client->ssl);
+
+        client->want_write = 0;
+
+        if (h2_negotiated(client->ssl)) {
+            return h2_session_create(client) ? 0 : -1;
+        }
+
+        // Early data that was not replay-safe waited for the handshake; nothing more will arrive for it.
+        if (client->bytes_read > 0 && strstr(client->buffer, "\r\n\r\n")) {
+            metrics_count(METRIC_TLS_EARLY_DEFERRED, 1);
+
+            return 2;
+        }
+
+        return 0;
+    }
+
+    int err = SSL_get_error(client->ssl, ret);
+
+    if (err == SSL_ERROR_WANT_WRITE) {
+        client->want_write = 1;
+
+        return 1;
+    }
+
+    client->want_write = 0;
+
+    if (err == SSL_ERROR_WANT_READ) {
+        return 1;
+    }
+
+    ERR_print_errors_fp(stderr);
+
+    return -1;
+}
+
+const Transport g_transport_tls = {
+    .name = "tls",
+    .attach = tls_attach,
+    .handshake = tls_handshake,
+    .read = tls_read,
+    .write = tls_write,
+    .writev = NULL,
+    .can_sendfile = tls_can_sendfile,
+    .sendfile = tls_sendfile,
+    .close = tls_close,
+    .splice_relay = 0
+};
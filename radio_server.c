@@ -1,34 +1,64 @@
 #include "server.h"
+#include "unixsock.h"
+#include "broadcast.h"
 #include <sys/stat.h>
 #include <signal.h>
 #include <time.h>
 #include <sys/time.h>
 #include <errno.h>
+#include <sys/eventfd.h>
+#include <linux/errqueue.h>
 
-#define STREAM_BITRATE 128000
-#define BYTES_PER_SEC (STREAM_BITRATE / 8)
-#define RADIO_PLAYLIST "public_html/mixtape/radio_playlist_cbr.mp3"
-#define BROADCAST_BUFFER_SLOTS 64
-#define NUM_SENDER_THREADS 12
+// Small enough that a stalled listener shows up as ring lag within seconds instead of sitting
+// on megabytes of autotuned kernel buffer.
+#define RADIO_LISTENER_SNDBUF (8 * BROADCAST_CHUNK_SIZE)
+#define SENDER_EPOLL_EVENTS 64
 
+// Zero-copy sends a listener may have awaiting completion; past this it falls back to copying.
+#define RADIO_ZEROCOPY_INFLIGHT 32
+
+// A sender carrying more than this many listeners above the least-loaded one hands one over.
+#define RADIO_REBALANCE_SLACK 1
+
+// Where a listener is in the stream: the chunk it is on, and how many bytes of that (pre-framed)
+// slot have already gone out.
 typedef struct RadioClient {
     int fd;
-    int read_index;
+    uint64_t seq;
+    size_t offset;
+    int blocked;
+
+    // MSG_ZEROCOPY bookkeeping: the kernel numbers each zero-copy send on a socket from 0 and
+    // reports finished ranges on the error queue; zc_slot maps those numbers back to pinned slots.
+    int zerocopy;
+    int zc_reap;
+    uint32_t zc_sent;
+    uint32_t zc_done;
+    int zc_slot[RADIO_ZEROCOPY_INFLIGHT];
+
     struct RadioClient* next;
 } RadioClient;
 
+// Each sender waits on its own eventfd, which the broadcaster only bumps while listeners is
+// non-zero. listeners changes under list_mutex but is read without it for placement.
 typedef struct {
     int thread_id;
+    int epoll_fd;
+    int tick_fd;
+    int listeners;
     RadioClient* client_list_head;
     pthread_mutex_t list_mutex;
 } SenderContext;
 
-static char g_broadcast_buffer[BROADCAST_BUFFER_SLOTS][BUFFER_SIZE];
-static size_t g_buffer_chunk_size[BROADCAST_BUFFER_SLOTS];
-static volatile int g_write_index = 0;
-static pthread_mutex_t g_buffer_mutex = PTHREAD_MUTEX_INITIALIZER; 
-static pthread_cond_t g_new_data_cond = PTHREAD_COND_INITIALIZER;
-static SenderContext g_senders[NUM_SENDER_THREADS];
+static SenderContext* g_senders = NULL;
+static int g_num_senders = 0;
+static uint64_t g_rebalanced_listeners = 0;
+static uint64_t g_dropped_listeners = 0;
+static uint64_t g_zerocopy_copied = 0;
+
+// A listener further behind than this is dropped rather than left to read slots the broadcaster
+// is about to overwrite: its connect burst plus the lag slack the ring is sized for.
+static uint64_t g_max_lag_slots = BROADCAST_LAG_SLOTS;
 
 int set_nonblock(int fd) {
     int flags = fcntl(fd, F_GETFL, 0);
@@ -40,116 +70,214 @@ int set_nonblock(int fd) {
     return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 }
 
-void sync_stream_timing(size_t total_bytes_streamed, struct timespec* start_time) {
-    struct timespec current_time;
-
-    clock_gettime(CLOCK_MONOTONIC, &current_time);
+static SenderContext* least_loaded_sender(void) {
+    SenderContext* best = &g_senders[0];
 
-    double expected_duration = (double)total_bytes_streamed / BYTES_PER_SEC;
+    for (int i = 1; i < g_num_senders; i++) {
+        if (__atomic_load_n(&g_senders[i].listeners, __ATOMIC_RELAXED) < __atomic_load_n(&best->listeners, __ATOMIC_RELAXED)) {
+            best = &g_senders[i];
+        }
+    }
 
-    double actual_elapsed = (current_time.tv_sec - start_time->tv_sec) + (current_time.tv_nsec - start_time->tv_nsec) / 1e9;
+    return best;
+}
 
-    if (actual_elapsed < expected_duration) {
-        double sleep_needed = expected_duration - actual_elapsed;
+// Links a listener into a sender. Edge-triggered EPOLLOUT in the sender's own set fires right
+// away, which starts the listener off, and later resumes it after a short write.
+static int attach_listener(SenderContext* sender, RadioClient* client) {
+    struct epoll_event out_ev;
 
-        struct timespec req;
-        req.tv_sec = (time_t)sleep_needed;
-        req.tv_nsec = (long)((sleep_needed - req.tv_sec) * 1e9);
+    out_ev.events = EPOLLOUT | EPOLLET;
+    out_ev.data.ptr = client;
 
-        nanosleep(&req, NULL);
-    }
-}
+    pthread_mutex_lock(&sender->list_mutex);
 
-void* broadcast_thread_function(void* arg) {
-    (void)arg;
-    char local_buffer[BUFFER_SIZE];
-    FILE* file = fopen(RADIO_PLAYLIST, "rb");
+    if (epoll_ctl(sender->epoll_fd, EPOLL_CTL_ADD, client->fd, &out_ev) == -1) {
+        pthread_mutex_unlock(&sender->list_mutex);
 
-    if (file == NULL) {
-        perror("radio_server: fopen");
+        perror("epoll_ctl: add listener");
 
-        exit(1);
+        return -1;
     }
-    
-    printf("[Radio Broadcaster] Starting stream (Bitrate: %d bps)\n", STREAM_BITRATE);
 
-    struct timespec start_time;
-    size_t total_bytes_in_loop = 0;
+    client->next = sender->client_list_head;
+    sender->client_list_head = client;
 
-    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    __atomic_add_fetch(&sender->listeners, 1, __ATOMIC_RELAXED);
 
-    while (1) {
-        size_t bytes_read = fread(local_buffer, 1, BUFFER_SIZE, file);
+    pthread_mutex_unlock(&sender->list_mutex);
+
+    return 0;
+}
 
-        if (bytes_read == 0) {
-            if (feof(file)) {
-                printf("[Radio Broadcaster] Playlist loop. Resetting clock.\n");
+static void unpin_slot(int slot) {
+    __atomic_sub_fetch(&g_slot_pins[slot], 1, __ATOMIC_RELEASE);
+}
 
-                fclose(file);
+// Releases slots whose zero-copy sends the kernel has finished with.
+static void reap_zerocopy(RadioClient* client) {
+    char control[128];
 
-                file = fopen(RADIO_PLAYLIST, "rb");
+    while (client->zc_done != client->zc_sent) {
+        struct msghdr msg;
 
-                total_bytes_in_loop = 0;
+        memset(&msg, 0, sizeof(msg));
 
-                clock_gettime(CLOCK_MONOTONIC, &start_time);
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
 
-                if (file == NULL) { 
-                    perror("radio_server: fopen");
-                    
-                    exit(1); 
-                }
+        if (recvmsg(client->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            break;
+        }
 
+        for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            struct sock_extended_err* serr = (struct sock_extended_err*)CMSG_DATA(cm);
+
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0) {
                 continue;
             }
 
-            perror("radio_server: fread");
+            // Loopback and some NICs copy anyway; worth knowing when judging the mode.
+            if ((serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) && __atomic_fetch_add(&g_zerocopy_copied, 1, __ATOMIC_RELAXED) == 0) {
+                printf("[Radio Sender] Kernel fell back to copying zero-copy sends (loopback or no NIC support).\n");
+            }
 
-            sleep(1);
+            for (uint32_t id = serr->ee_info; id != serr->ee_data + 1; id++) {
+                unpin_slot(client->zc_slot[id % RADIO_ZEROCOPY_INFLIGHT]);
+            }
 
-            continue;
+            client->zc_done = serr->ee_data + 1;
         }
+    }
+}
 
-        pthread_mutex_lock(&g_buffer_mutex);
+// Drops a listener. Unfinished zero-copy sends would keep their slots pinned with no one left
+// to read the completions, so the connection is reset, which frees them on the spot.
+static void close_listener(RadioClient* client) {
+    if (client->zc_done != client->zc_sent) {
+        struct linger abort_linger = { 1, 0 };
 
-        g_write_index = (g_write_index + 1) % BROADCAST_BUFFER_SLOTS;
+        setsockopt(client->fd, SOL_SOCKET, SO_LINGER, &abort_linger, sizeof(abort_linger));
 
-        memcpy(g_broadcast_buffer[g_write_index], local_buffer, bytes_read);
+        for (uint32_t id = client->zc_done; id != client->zc_sent; id++) {
+            unpin_slot(client->zc_slot[id % RADIO_ZEROCOPY_INFLIGHT]);
+        }
+    }
 
-        g_buffer_chunk_size[g_write_index] = bytes_read;
+    close(client->fd);
+}
 
-        pthread_mutex_unlock(&g_buffer_mutex);
+// Sends from the listener's cursor up to the newest chunk, one send() per slot since slots are
+// already framed. Returns 0 when caught up or the socket is full (blocked is then set until
+// EPOLLOUT), -1 when the listener must go.
+static int send_from_cursor(RadioClient* client) {
+    uint64_t newest = broadcast_newest();
 
-        pthread_cond_broadcast(&g_new_data_cond);
+    while (client->seq <= newest) {
+        int slot = (int)(client->seq % BROADCAST_SLOTS);
+        size_t framed = g_buffer_chunk_size[slot];
+        int zerocopy = client->zerocopy && client->zc_sent - client->zc_done < RADIO_ZEROCOPY_INFLIGHT;
 
-        total_bytes_in_loop += bytes_read;
+        ssize_t sent = send(client->fd, g_broadcast_buffer[slot] + client->offset, framed - client->offset, MSG_NOSIGNAL | (zerocopy ? MSG_ZEROCOPY : 0));
 
-        sync_stream_timing(total_bytes_in_loop, &start_time);
-    }
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                client->blocked = 1;
 
-    fclose(file);
+                return 0;
+            }
 
-    return NULL;
+            // Out of optmem for zero-copy state; this one goes by copy.
+            if (errno == ENOBUFS && zerocopy) {
+                sent = send(client->fd, g_broadcast_buffer[slot] + client->offset, framed - client->offset, MSG_NOSIGNAL);
+
+                zerocopy = 0;
+            }
+
+            if (sent < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    client->blocked = 1;
+
+                    return 0;
+                }
+
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                return -1;
+            }
+        }
+
+        if (zerocopy) {
+            __atomic_add_fetch(&g_slot_pins[slot], 1, __ATOMIC_ACQUIRE);
+
+            client->zc_slot[client->zc_sent % RADIO_ZEROCOPY_INFLIGHT] = slot;
+            client->zc_sent++;
+        }
+
+        client->offset += (size_t)sent;
+
+        if (client->offset < framed) {
+            client->blocked = 1;
+
+            return 0;
+        }
+
+        client->seq++;
+        client->offset = 0;
+    }
+
+    return 0;
 }
 
 void* sender_worker_thread(void* arg) {
     SenderContext* ctx = (SenderContext*)arg;
-    char chunk_header[32];
+    struct epoll_event events[SENDER_EPOLL_EVENTS];
+
+    topology_pin_current_thread(THREAD_ROLE_SENDER, ctx->thread_id);
     
     printf("[Radio Sender #%d] Worker thread live.\n", ctx->thread_id);
     
-    int last_processed_idx = -1;
     while (1) {
-        pthread_mutex_lock(&g_buffer_mutex);
+        int nfds = epoll_wait(ctx->epoll_fd, events, SENDER_EPOLL_EVENTS, -1);
+
+        if (nfds == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            perror("radio_server: sender epoll_wait");
 
-        while (last_processed_idx == g_write_index) {
-            pthread_cond_wait(&g_new_data_cond, &g_buffer_mutex);
+            break;
+        }
+
+        // Only flag listeners here; the walk below is the one place they are freed or handed
+        // over. The NULL cookie is this sender's tick eventfd.
+        for (int i = 0; i < nfds; i++) {
+            RadioClient* ready = (RadioClient*)events[i].data.ptr;
+
+            if (ready == NULL) {
+                uint64_t ticks;
+
+                while (read(ctx->tick_fd, &ticks, sizeof(ticks)) > 0) {
+                }
+            }
+            else {
+                if (events[i].events & EPOLLOUT) {
+                    ready->blocked = 0;
+                }
+
+                // Zero-copy completions land on the error queue and raise EPOLLERR.
+                if (events[i].events & EPOLLERR) {
+                    ready->zc_reap = 1;
+                }
+            }
         }
-        
-        int current_write_idx = g_write_index;
-        last_processed_idx = current_write_idx;
-        size_t current_chunk_size = g_buffer_chunk_size[current_write_idx];
-        
-        pthread_mutex_unlock(&g_buffer_mutex);
+
+        uint64_t newest = broadcast_newest();
+        SenderContext* target = least_loaded_sender();
+        RadioClient* handoff = NULL;
 
         pthread_mutex_lock(&ctx->list_mutex);
         
@@ -157,66 +285,139 @@ void* sender_worker_thread(void* arg) {
         RadioClient* prev = NULL;
 
         while (curr != NULL) {
-            snprintf(chunk_header, sizeof(chunk_header), "%lx\r\n", current_chunk_size);
-            
-            int success = 1;
-            
-            if (send(curr->fd, chunk_header, strlen(chunk_header), MSG_NOSIGNAL) < 0) {
-                 success = 0;
+            int drop = 0;
+
+            if (curr->zc_reap) {
+                curr->zc_reap = 0;
+
+                reap_zerocopy(curr);
             }
-            else if (send(curr->fd, g_broadcast_buffer[current_write_idx], current_chunk_size, MSG_NOSIGNAL) < 0) {
-                success = 0;
+
+            if (newest >= curr->seq && newest - curr->seq >= g_max_lag_slots) {
+                uint64_t dropped = __atomic_add_fetch(&g_dropped_listeners, 1, __ATOMIC_RELAXED);
+
+                printf("[Radio Sender #%d] Listener fell %llu slots behind (fd=%d), dropped (%llu so far).\n",
+                       ctx->thread_id, (unsigned long long)(newest - curr->seq), curr->fd, (unsigned long long)dropped);
+
+                drop = 1;
             }
-            else if (send(curr->fd, "\r\n", 2, MSG_NOSIGNAL) < 0) {
-                success = 0;
+            else if (!curr->blocked && curr->seq <= newest && send_from_cursor(curr) < 0) {
+                printf("[Radio Sender #%d] Listener disconnected (fd=%d).\n", ctx->thread_id, curr->fd);
+
+                drop = 1;
             }
 
-            if (!success) {
-                if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                    printf("[Radio Sender #%d] Listener disconnected (fd=%d).\n", ctx->thread_id, curr->fd);
-                    
-                    close(curr->fd);
-                    
-                    if (prev == NULL) { 
-                        ctx->client_list_head = curr->next;
-                    }
-                    else { 
-                        prev->next = curr->next; 
-                    }
-                    
-                    RadioClient* to_free = curr;
-                    curr = curr->next;
+            if (drop) {
+                __atomic_sub_fetch(&ctx->listeners, 1, __ATOMIC_RELAXED);
 
-                    free(to_free);
-                    
-                    continue; 
+                close_listener(curr);
+
+                if (prev == NULL) { 
+                    ctx->client_list_head = curr->next;
                 }
-            }
-            else {
-                curr->read_index = current_write_idx;
+                else { 
+                    prev->next = curr->next; 
+                }
+
+                RadioClient* to_free = curr;
+                curr = curr->next;
+
+                free(to_free);
+
+                continue;
             }
 
             prev = curr;
             curr = curr->next;
         }
 
+        // Departures leave senders uneven; shed one listener per pass to the least-loaded one.
+        // Once out of this epoll set no event can name it here, so the move needs no shared lock.
+        if (target != ctx && ctx->client_list_head != NULL
+            && __atomic_load_n(&ctx->listeners, __ATOMIC_RELAXED) > __atomic_load_n(&target->listeners, __ATOMIC_RELAXED) + RADIO_REBALANCE_SLACK) {
+            handoff = ctx->client_list_head;
+            ctx->client_list_head = handoff->next;
+
+            epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, handoff->fd, NULL);
+
+            __atomic_sub_fetch(&ctx->listeners, 1, __ATOMIC_RELAXED);
+        }
+
         pthread_mutex_unlock(&ctx->list_mutex);
+
+        if (handoff != NULL) {
+            // The new sender's EPOLLOUT edge resumes it whether or not it was blocked here, and
+            // it checks for completions that landed while the listener was between sets.
+            handoff->blocked = 0;
+            handoff->zc_reap = handoff->zerocopy;
+
+            if (attach_listener(target, handoff) < 0) {
+                close_listener(handoff);
+
+                free(handoff);
+            }
+            else {
+                uint64_t moved = __atomic_add_fetch(&g_rebalanced_listeners, 1, __ATOMIC_RELAXED);
+
+                printf("[Radio Sender #%d] Handed listener (fd=%d) to Thread %d (%llu moved so far).\n",
+                       ctx->thread_id, handoff->fd, target->thread_id, (unsigned long long)moved);
+            }
+        }
     }
 
     return NULL;
 }
 
-int main(void) {
+int main(int argc, char* argv[]) {
     signal(SIGPIPE, SIG_IGN);
 
     int server_socket, epoll_fd;
+    int unix_socket = -1;
     struct sockaddr_in server_addr;
 
-    pthread_t sender_tids[NUM_SENDER_THREADS];
+    topology_init("RADIO");
+    topology_load_config_file("server.conf");
+    broadcast_load_config_file("server.conf");
+    topology_finalize(TOPOLOGY_ROLE(THREAD_ROLE_EVENT_LOOP) | TOPOLOGY_ROLE(THREAD_ROLE_BROADCAST) | TOPOLOGY_ROLE(THREAD_ROLE_SENDER));
+    topology_pin_current_thread(THREAD_ROLE_EVENT_LOOP, 0);
+
+    g_max_lag_slots = (uint64_t)g_broadcast_burst_seconds * BROADCAST_SLOTS_PER_SEC + BROADCAST_LAG_SLOTS;
+
+    int num_senders = g_topology.sender_threads;
+
+    g_num_senders = num_senders;
+    int max_events = g_topology.max_epoll_events;
+
+    g_senders = (SenderContext*)calloc(num_senders, sizeof(SenderContext));
+
+    if (g_senders == NULL) {
+        perror("radio_server: calloc");
+
+        return 1;
+    }
+
+    for (int i = 0; i < num_senders; i++) {
+        pthread_t sender_tid;
+        struct epoll_event tick_ev;
 
-    for (int i = 0; i < NUM_SENDER_THREADS; i++) {
         g_senders[i].thread_id = i;
+        g_senders[i].listeners = 0;
         g_senders[i].client_list_head = NULL;
+        g_senders[i].epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        g_senders[i].tick_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        tick_ev.events = EPOLLIN | EPOLLET;
+        tick_ev.data.ptr = NULL;
+
+        if (g_senders[i].epoll_fd == -1 || g_senders[i].tick_fd == -1 || epoll_ctl(g_senders[i].epoll_fd, EPOLL_CTL_ADD, g_senders[i].tick_fd, &tick_ev) == -1) {
+            perror("radio_server: sender epoll");
+
+            return 1;
+        }
+
+        if (broadcast_add_waiter(g_senders[i].tick_fd, &g_senders[i].listeners) < 0) {
+            return 1;
+        }
 
         if (pthread_mutex_init(&g_senders[i].list_mutex, NULL) != 0) {
             perror("radio_server: pthread_mutex_init");
@@ -224,25 +425,19 @@ int main(void) {
             return 1;
         }
         
-        if (pthread_create(&sender_tids[i], NULL, sender_worker_thread, &g_senders[i]) != 0) {
+        if (pthread_create(&sender_tid, NULL, sender_worker_thread, &g_senders[i]) != 0) {
             perror("radio_server: pthread_create");
 
             return 1;
         }
 
-        pthread_detach(sender_tids[i]);
+        pthread_detach(sender_tid);
     }
 
-    pthread_t broadcast_tid;
-
-    if (pthread_create(&broadcast_tid, NULL, broadcast_thread_function, NULL) != 0) {
-        perror("radio_server: pthread_create");
-
+    if (broadcast_start(BROADCAST_PLAYLIST) < 0) {
         return 1;
     }
 
-    pthread_detach(broadcast_tid);
-
     server_socket = socket(AF_INET, SOCK_STREAM, 0);
 
     if (server_socket == -1) {
@@ -289,7 +484,15 @@ int main(void) {
         return 1;
     }
 
-    struct epoll_event ev, events[MAX_EPOLL_EVENTS];
+    struct epoll_event ev;
+    struct epoll_event* events = (struct epoll_event*)calloc(max_events, sizeof(struct epoll_event));
+
+    if (events == NULL) {
+        perror("radio_server: calloc");
+
+        return 1;
+    }
+
     ev.events = EPOLLIN;
     ev.data.fd = server_socket;
 
@@ -299,12 +502,30 @@ int main(void) {
         return 1;
     }
 
-    printf("[Radio Server] Live on port %d... (%d Threads)\n", RADIO_PORT, NUM_SENDER_THREADS);
+    // Optional Unix-socket listener so a co-located server can PROXY to unix:/path.
+    if (argc > 1) {
+        unix_socket = unixsock_listen(argv[1], 128);
+
+        if (unix_socket < 0) {
+            return 1;
+        }
+
+        ev.events = EPOLLIN;
+        ev.data.fd = unix_socket;
+
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, unix_socket, &ev) == -1) {
+            perror("radio_server: epoll_ctl");
+
+            return 1;
+        }
+
+        printf("[Radio Server] Also listening on unix:%s\n", argv[1]);
+    }
 
-    int current_thread_idx = 0;
+    printf("[Radio Server] Live on port %d... (%d Threads)\n", RADIO_PORT, num_senders);
 
     while (1) {
-        int nfds = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+        int nfds = epoll_wait(epoll_fd, events, max_events, -1);
 
         if (nfds == -1) {
             if (errno == EINTR) {
@@ -317,11 +538,13 @@ int main(void) {
         }
 
         for (int i = 0; i < nfds; i++) {
-            if (events[i].data.fd == server_socket) {
+            if (events[i].data.fd == server_socket || events[i].data.fd == unix_socket) {
+                int listen_fd = events[i].data.fd;
+
                 while(1) {
-                    struct sockaddr_in client_addr;
+                    struct sockaddr_storage client_addr;
                     socklen_t client_len = sizeof(client_addr);
-                    int client_fd = accept(server_socket, (struct sockaddr *)&client_addr, &client_len);
+                    int client_fd = accept(listen_fd, (struct sockaddr *)&client_addr, &client_len);
                     
                     if (client_fd < 0) {
                         if (errno == EAGAIN || errno == EWOULDBLOCK) {
@@ -373,15 +596,25 @@ int main(void) {
                                      "Connection: keep-alive\r\n"
                                      "Cache-Control: no-cache, no-store\r\n"
                                      "Access-Control-Allow-Origin: *\r\n\r\n";
-                
-                if (send(client_fd, header, strlen(header), MSG_NOSIGNAL) < 0) {
+
+                // The connect burst starts on an MP3 frame inside a chunk; that partial chunk rides
+                // along with the header, and the sender picks up from the next whole slot.
+                char opening[512 + BROADCAST_SLOT_SIZE];
+                size_t header_len = strlen(header);
+                size_t lead_len;
+
+                memcpy(opening, header, header_len);
+
+                uint64_t first = broadcast_burst_start(opening + header_len, &lead_len);
+
+                if (send(client_fd, opening, header_len + lead_len, MSG_NOSIGNAL) != (ssize_t)(header_len + lead_len)) {
                     close(client_fd);
 
                     continue;
                 }
 
-                SenderContext* target_thread = &g_senders[current_thread_idx];
-                
+                SenderContext* target_thread = least_loaded_sender();
+
                 RadioClient* new_client = malloc(sizeof(RadioClient));
                 
                 if (new_client == NULL) {
@@ -392,24 +625,50 @@ int main(void) {
                     continue;
                 }
 
+                int sndbuf = RADIO_LISTENER_SNDBUF;
+
+                setsockopt(client_fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
                 new_client->fd = client_fd;
-                new_client->read_index = g_write_index;
+                new_client->seq = first;
+                new_client->offset = 0;
+                new_client->blocked = 0;
+                new_client->zerocopy = 0;
+                new_client->zc_reap = 0;
+                new_client->zc_sent = 0;
+                new_client->zc_done = 0;
+
+                // AF_UNIX listeners refuse SO_ZEROCOPY and simply keep copying.
+                if (g_broadcast_zerocopy) {
+                    int one = 1;
+
+                    new_client->zerocopy = setsockopt(client_fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+                }
 
-                pthread_mutex_lock(&target_thread->list_mutex);
+                if (attach_listener(target_thread, new_client) < 0) {
+                    close(client_fd);
 
-                new_client->next = target_thread->client_list_head;
-                target_thread->client_list_head = new_client;
+                    free(new_client);
 
-                pthread_mutex_unlock(&target_thread->list_mutex);
-                
-                printf("[Radio Main] Assigned Listener (fd=%d) to Thread %d\n", client_fd, current_thread_idx);
+                    continue;
+                }
 
-                current_thread_idx = (current_thread_idx + 1) % NUM_SENDER_THREADS;
+                printf("[Radio Main] Assigned Listener (fd=%d) to Thread %d, burst of %llu chunks\n", client_fd, target_thread->thread_id,
+                       (unsigned long long)(broadcast_newest() + 1 - first));
             }
         }
     }
 
+    free(events);
+
     close(server_socket);
+
+    if (unix_socket >= 0) {
+        close(unix_socket);
+
+        unlink(argv[1]);
+    }
+
     close(epoll_fd);
 
     return 0;
@@ -0,0 +1,62 @@
+#!/bin/sh
+# Requests that end before routing (a ".." path, a failed AUTH check) must still finish their
+# h2 stream. Afterwards only the stream fetching /__stats may be counted as open.
+# Run from the repo root after `make server`; needs curl with HTTP/2 and cert.pem/key.pem.
+
+ROOT=$(pwd)
+PORT=${H2_TEST_PORT:-18443}
+DIR=$(mktemp -d)
+
+trap 'kill $PID 2>/dev/null; rm -rf "$DIR"' EXIT
+
+for f in cert.pem key.pem; do
+    if [ ! -f "$ROOT/$f" ]; then
+        echo "h2_early_exit: $f missing in $ROOT" >&2
+
+        exit 1
+    fi
+
+    ln -s "$ROOT/$f" "$DIR/$f"
+done
+
+ln -s "$ROOT/public_html" "$DIR/public_html"
+
+cat > "$DIR/server.conf" <<EOF
+LISTEN $PORT tls
+
+STATIC / public_html/
+
+STATIC /private/ public_html/
+
+AUTH /private/
+EOF
+
+(cd "$DIR" && exec "$ROOT/server" > server.log 2>&1) &
+PID=$!
+
+sleep 2
+
+URL=https://127.0.0.1:$PORT
+
+GOT=$(curl -sk --http2 --path-as-is --max-time 5 -w "%{http_version}:%{http_code} " \
+    -o /dev/null "$URL/../server.conf" -o /dev/null "$URL/private/index.html" -o /dev/null "$URL/index.html")
+
+EXPECT="2:404 2:401 2:200 "
+
+if [ "$GOT" != "$EXPECT" ]; then
+    echo "h2_early_exit: FAIL, expected '$EXPECT', got '$GOT'" >&2
+
+    cat "$DIR/server.log" >&2
+
+    exit 1
+fi
+
+ACTIVE=$(curl -sk --http2 --max-time 5 "$URL/__stats" | sed -n 's/^caligo_h2_streams_active{[^}]*} //p')
+
+if [ "$ACTIVE" != "1" ]; then
+    echo "h2_early_exit: FAIL, $ACTIVE h2 streams still open (expected only the stats one)" >&2
+
+    exit 1
+fi
+
+echo "h2_early_exit: ok"
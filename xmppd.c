@@ -9,6 +9,7 @@
 #include <sys/epoll.h>
 #include <fcntl.h>
 #include <signal.h>
+#include "unixsock.h"
 
 #define MAX_EVENTS 64
 #define BUFFER_SIZE 4096
@@ -551,10 +552,11 @@ void broadcast_user_count() {
     }
 }
 
-int main() {
+int main(int argc, char* argv[]) {
     signal(SIGPIPE, SIG_IGN);
 
     int listener, epoll_fd;
+    int unix_listener = -1;
     struct sockaddr_in addr;
     struct epoll_event ev, events[MAX_EVENTS];
 
@@ -594,16 +596,30 @@ int main() {
     
     epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listener, &ev);
 
+    // Optional Unix-socket listener for a co-located bridge ("bridge 8082 unix:/path").
+    if (argc > 1) {
+        if ((unix_listener = unixsock_listen(argv[1], 10)) < 0) {
+            exit(1);
+        }
+
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.fd = unix_listener;
+
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, unix_listener, &ev);
+
+        printf("Caligo XMPP Server also listening on unix:%s\n", argv[1]);
+    }
+
     printf("Caligo XMPP Server started on port %d\n", PORT);
     
     while (1) {
         int nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
 
         for (int i = 0; i < nfds; i++) {
-            if (events[i].data.fd == listener) {
-                struct sockaddr_in client_addr;
+            if (events[i].data.fd == listener || events[i].data.fd == unix_listener) {
+                struct sockaddr_storage client_addr;
                 socklen_t client_len = sizeof(client_addr);
-                int client_fd = accept(listener, (struct sockaddr*)&client_addr, &client_len);
+                int client_fd = accept(events[i].data.fd, (struct sockaddr*)&client_addr, &client_len);
                 
                 if (client_fd < 0) {
                     continue;
@@ -676,6 +692,12 @@ int main() {
     }
 
     close(listener);
+
+    if (unix_listener >= 0) {
+        close(unix_listener);
+
+        unlink(argv[1]);
+    }
     
     return 0;
 }
\ No newline at end of file